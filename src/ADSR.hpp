@@ -1,6 +1,10 @@
+#ifndef ADSR_HPP_
+#define ADSR_HPP_
+
 #include <array>
 #include <cmath>
 #include <functional>
+#include "SharedTables.hpp"
 
 /**
 ADSR envelope class.
@@ -110,6 +114,14 @@ class ADSR
     */
     const bool is_active() const;
 
+    /**
+    Sets a sine table for the SINE_1_4 fader. Faster than std::sin, but not
+    exact (see SineTable). The table isn't owned by the ADSR and must outlive
+    it (and its copies).
+    @param table    Pointer to the table or nullptr (default) to use std::sin.
+    */
+    void set_sine_table (const SineTable* table);
+
     /**
     Sets a callback function for one of the events START, PHASE_CHANGE, STOP. The passed callback function will
     be called upon the respective event together with this object and optional arguments.
@@ -129,6 +141,7 @@ class ADSR
     std::array<T, 4> param_;
     Phase phase_;
     Fader fader_;
+    const SineTable* sine_;
 
     /* Time exceeded in phase_. May be negative. */
     T phase_time_;
@@ -160,6 +173,7 @@ template <class T> inline ADSR<T>::ADSR (const T attack, const T decay, const T
     param_({attack, decay, sustain, release}),
     phase_(ATTACK),
     fader_(fader),
+    sine_(nullptr),
     phase_time_(0.0)
 {
     callbacks_.fill(std::pair<std::function<void(ADSR<T>&, void*)>, void*>(&defaultCallback_, nullptr));
@@ -194,7 +208,7 @@ template <class T> inline void ADSR<T>::set_parameter(const Phase phase, const T
     run ();
 }
 
-template <class T> inline const T ADSR<T>::get_parameter (const Phase phase) const {return phase_;}
+template <class T> inline const T ADSR<T>::get_parameter (const Phase phase) const {return param_[phase];}
 
 template <class T> inline const T ADSR<T>::get_value () const
 {
@@ -211,7 +225,7 @@ template <class T> inline const T ADSR<T>::get_value () const
         case LINEAR:    return prev + (next - prev) * phase_time_ / phase_total;
         case INVSQR:    return prev + (next - prev) * (1.0 - pow(1.0 - phase_time_ / phase_total, 2.0));
         case SQRT:      return prev + (next - prev) * std::sqrt(std::abs(phase_time_) / phase_total);
-        case SINE_1_4:  return prev + (next - prev) * std::sin(0.5 * M_PI * phase_time_/phase_total);
+        case SINE_1_4:  return prev + (next - prev) * (sine_ ? sine_->sin(0.25 * phase_time_/phase_total) : std::sin(0.5 * M_PI * phase_time_/phase_total));
         default: return 0;
     }
     
@@ -252,6 +266,8 @@ template <class T> inline void ADSR<T>::run () {run (0.0);}
 template <class T> inline const typename ADSR<T>::Phase ADSR<T>::getPhase () const {return phase_;}
 
 template <class T> inline const T ADSR<T>::getPhaseTime () const {return phase_time_;}
+
+template <class T> inline void ADSR<T>::set_sine_table (const SineTable* table) {sine_ = table;}
     
 template <class T> inline void ADSR<T>::release ()
 {
@@ -283,4 +299,6 @@ template <class T> void ADSR<T>::removeCallbackFunction(const typename ADSR<T>::
 template <class T> void ADSR<T>::on_event_(const typename ADSR<T>::Event event)
 {
     callbacks_[event].first(*this, callbacks_[event].second);
-}
\ No newline at end of file
+}
+
+#endif /* ADSR_HPP_ */
@@ -0,0 +1,215 @@
+#ifndef ARENA_HPP_
+#define ARENA_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define ARENA_ALIGNMENT 64                  // Cache line size
+#define ARENA_HUGEPAGE_SIZE 0x200000        // 2 MB
+
+/**
+Memory arena. Maps a single memory block and distributes cache line aligned
+chunks of this block. The memory is freed as a whole if the arena is
+destroyed. The arena doesn't construct or destruct any objects.
+*/
+class Arena
+{
+public:
+    /**
+    Constructs an empty arena.
+    */
+    Arena ();
+
+    /**
+    Constructs an arena and maps the memory block.
+    @param size         Size of the memory block in bytes.
+    @param hugepages    Try to back the memory with huge pages. Falls back
+                        to normal pages if huge pages are not available.
+    @throws std::bad_alloc if the memory can't be mapped.
+    */
+    Arena (const size_t size, const bool hugepages = false);
+
+    Arena (const Arena& that) = delete;
+    Arena (Arena&& that);
+    ~Arena ();
+
+    Arena& operator= (const Arena& that) = delete;
+    Arena& operator= (Arena&& that);
+
+    /**
+    Gets the next cache line aligned chunk of memory for n objects of the
+    type T. Doesn't construct the objects.
+    @param n    Number of objects.
+    @return     Pointer to the memory.
+    @throws std::bad_alloc if the arena is exhausted.
+    */
+    template <class T> T* allocate (const size_t n = 1);
+
+    /**
+    Gets the size of a memory block required to allocate n objects of the
+    type T.
+    @param n    Number of objects.
+    @return     Size in bytes.
+    */
+    template <class T> static constexpr size_t required (const size_t n = 1);
+
+    /**
+    Sets a chunk of the arena memory to zero. Whole pages are returned to
+    the operating system instead of being overwritten. They are provided
+    as zero pages again on the next access.
+    @param ptr  Pointer to the start of the chunk.
+    @param size Size of the chunk in bytes.
+    */
+    void zero (void* ptr, const size_t size);
+
+    /**
+    Gets the size of the mapped memory block.
+    @return Size in bytes.
+    */
+    size_t size () const;
+
+    /**
+    Gets the size of the already distributed memory.
+    @return Size in bytes.
+    */
+    size_t used () const;
+
+    /**
+    Tests if the arena is backed by huge pages (either explicitly or as
+    transparent huge pages).
+    @return True if huge pages were requested and granted, otherwise false.
+    */
+    bool hugepages () const;
+
+protected:
+    uint8_t* data_;
+    size_t size_;
+    size_t used_;
+    bool hugepages_;
+
+    void unmap_ ();
+};
+
+inline Arena::Arena () : data_ (nullptr), size_ (0), used_ (0), hugepages_ (false) {}
+
+inline Arena::Arena (const size_t size, const bool hugepages) : Arena ()
+{
+    if (size == 0) return;
+
+    void* ptr = MAP_FAILED;
+    size_t mapped = 0;
+
+#ifdef MAP_HUGETLB
+    // Explicit huge pages (requires reserved huge pages)
+    if (hugepages)
+    {
+        mapped = ((size + ARENA_HUGEPAGE_SIZE - 1) / ARENA_HUGEPAGE_SIZE) * ARENA_HUGEPAGE_SIZE;
+        ptr = mmap (nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr != MAP_FAILED) hugepages_ = true;
+    }
+#endif
+
+    // Normal pages
+    if (ptr == MAP_FAILED)
+    {
+        const size_t page = sysconf (_SC_PAGESIZE);
+        mapped = ((size + page - 1) / page) * page;
+        ptr = mmap (nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED) throw std::bad_alloc ();
+
+#ifdef MADV_HUGEPAGE
+        // Transparent huge pages as fallback
+        if (hugepages) hugepages_ = (madvise (ptr, mapped, MADV_HUGEPAGE) == 0);
+#endif
+    }
+
+    data_ = static_cast<uint8_t*> (ptr);
+    size_ = mapped;
+}
+
+inline Arena::Arena (Arena&& that) : data_ (that.data_), size_ (that.size_), used_ (that.used_), hugepages_ (that.hugepages_)
+{
+    that.data_ = nullptr;
+    that.size_ = 0;
+    that.used_ = 0;
+    that.hugepages_ = false;
+}
+
+inline Arena::~Arena () {unmap_ ();}
+
+inline Arena& Arena::operator= (Arena&& that)
+{
+    if (this == &that) return *this;
+
+    unmap_ ();
+    data_ = that.data_;
+    size_ = that.size_;
+    used_ = that.used_;
+    hugepages_ = that.hugepages_;
+    that.data_ = nullptr;
+    that.size_ = 0;
+    that.used_ = 0;
+    that.hugepages_ = false;
+    return *this;
+}
+
+template <class T> inline T* Arena::allocate (const size_t n)
+{
+    const size_t chunk = required<T> (n);
+    if (used_ + chunk > size_) throw std::bad_alloc ();
+
+    T* ptr = reinterpret_cast<T*> (data_ + used_);
+    used_ += chunk;
+    return ptr;
+}
+
+template <class T> inline constexpr size_t Arena::required (const size_t n)
+{
+    return ((n * sizeof (T) + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT) * ARENA_ALIGNMENT;
+}
+
+inline void Arena::zero (void* ptr, const size_t size)
+{
+    uint8_t* start = static_cast<uint8_t*> (ptr);
+    uint8_t* end = start + size;
+    if ((start < data_) || (end > data_ + size_)) return;
+
+    // Page boundaries within the chunk
+    const size_t page = (hugepages_ ? ARENA_HUGEPAGE_SIZE : sysconf (_SC_PAGESIZE));
+    uint8_t* page_start = data_ + ((start - data_ + page - 1) / page) * page;
+    uint8_t* page_end = data_ + ((end - data_) / page) * page;
+
+#ifdef MADV_DONTNEED
+    if (page_start < page_end)
+    {
+        if (madvise (page_start, page_end - page_start, MADV_DONTNEED) == 0)
+        {
+            memset (start, 0, page_start - start);
+            memset (page_end, 0, end - page_end);
+            return;
+        }
+    }
+#endif
+
+    memset (start, 0, size);
+}
+
+inline size_t Arena::size () const {return size_;}
+
+inline size_t Arena::used () const {return used_;}
+
+inline bool Arena::hugepages () const {return hugepages_;}
+
+inline void Arena::unmap_ ()
+{
+    if (data_) munmap (data_, size_);
+    data_ = nullptr;
+    size_ = 0;
+    used_ = 0;
+}
+
+#endif /* ARENA_HPP_ */
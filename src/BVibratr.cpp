@@ -1,59 +1,112 @@
 #include "BVibratr.hpp"
 #include "Ports.hpp"
-#include "Limits.hpp"
 
 // Utilities
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
+#include <cstdlib>
 #include <lv2/atom/util.h>
 #include <lv2/midi/midi.h>
 
-#define SQRT_12_2 (pow (2.0, 1.0 / 12.0))
+#ifdef BVIBRATR_TRACE
+#include <atomic>
+#include <string>
+#include <unistd.h>
+#endif
 
-BVibratr::BVibratr (double samplerate, const char* bundlePath, const LV2_Feature* const* features) :
-	rate (samplerate),
+BVibratr* BVibratr::create (double samplerate, const char* bundlePath, const LV2_Feature* const* features)
+{
+	// Place the instance at the front of its own arena
+	Arena memory (arena_size (samplerate), BVIBRATR_USE_HUGEPAGES);
+	BVibratr* storage = memory.allocate<BVibratr> ();
+	return new (storage) BVibratr (samplerate, bundlePath, features, memory);
+}
+
+void BVibratr::destroy (BVibratr* instance)
+{
+	if (!instance) return;
+
+	// Keep the arena until the instance is destructed
+	Arena memory = std::move (instance->arena);
+	instance->~BVibratr ();
+}
+
+size_t BVibratr::arena_size (double samplerate)
+{
+	return Arena::required<BVibratr> () + BVibratrEngine::arena_size (samplerate);
+}
+
+BVibratr::BVibratr (double samplerate, const char* bundlePath, const LV2_Feature* const* features, Arena& memory) :
+	arena (std::move (memory)),		// Take over the memory
+	engine (samplerate, arena),
+	samplerate (samplerate),
 	midi_in (nullptr),
 	audio_in_1 (nullptr),
 	audio_in_2 (nullptr),
 	audio_out_1 (nullptr),
 	audio_out_2 (nullptr),
 	latency_port(nullptr),
+	notify_port(nullptr),
+	midi_out(nullptr),
+	vibrato_output_port(nullptr),
+	bend_rate_port(nullptr),
+	bend_range_port(nullptr),
+	bend_channel_port(nullptr),
+	cv_modulation_port(nullptr),
+	cv_tremolo_port(nullptr),
+	cv_shift_port(nullptr),
+	cv_pitch_in_port(nullptr),
+	cv_tremolo_in_port(nullptr),
+	modulation_group_port(nullptr),
+	modulation_offset_port(nullptr),
+	modulation_source_port(nullptr),
+	modulation_buses (get_modulation_buses<BVibratrModulatorState> ()),
+	stats(),
+	bend_state(),
+	forge(),
+	notify_frame(),
+	midi_forge(),
+	midi_frame(),
+	trajectory_requested (false),
+	trajectory_pending (false),
+	trajectory_failed (false),
+	trajectory_controllers (),
+	trajectory_replaced (nullptr),
 	map (nullptr),
-	adsr(0, 0, 1, 0, ADSR<double>::INVSQR),
-	osc1(),
-	osc2(),
-	osc3(),
-	note(0xFF),
-	depth_cc (1.0),
-	buffer_1(0x10000),
-	buffer_2(0x10000),
-	buffer_offset((SQRT_12_2 - 1.0) *	// Up to 1 semitone
-					samplerate			// Up to 1 second phase length
-				 ),						// TODO report latency
-	osc1_mode(0),
-	osc2_mode(0),
-	osc3_mode(0),
-	depth(0.0),
-	shift(0.0, (SQRT_12_2 - 1.0)),	// Limit temporal shift to 1 semitone
-	amp(1.0f, 0.001f),
-	mix(0.0f, 0.001f)
-{
-	// Init controllers
+	schedule (nullptr)
+{
 	controller_ports.fill(nullptr);
 
 	// Map urids
     urids.init (features, map);
-
-	// Init buffers
-	buffer_1.fill(0.0f);
-	buffer_2.fill(0.0f);
-
-	osc1.setCallbackFunction(LFO<double>::PHASE_RESTART, &on_osc1_restart, this);
-	osc2.setCallbackFunction(LFO<double>::PHASE_RESTART, &on_osc2_restart, this);
-	osc3.setCallbackFunction(LFO<double>::PHASE_RESTART, &on_osc3_restart, this);
+	schedule = static_cast<LV2_Worker_Schedule*> (lv2_features_data (features, LV2_WORKER__schedule));
+	lv2_atom_forge_init (&forge, map);
+	lv2_atom_forge_init (&midi_forge, map);
+	clear_stats ();
+
+#ifdef BVIBRATR_TRACE
+	// Record a trace to BVIBRATR_TRACE.PID.INSTANCE.bvtrace if requested
+	const char* trace_path = getenv ("BVIBRATR_TRACE");
+	if (trace_path && trace_path[0])
+	{
+		static std::atomic<unsigned int> instance_nr (0);
+		const char* trace_audio = getenv ("BVIBRATR_TRACE_AUDIO");
+		const std::string path =	std::string (trace_path) + "." + std::to_string (getpid()) + "." +
+									std::to_string (instance_nr++) + ".bvtrace";
+		trace.reset (new TraceRecorder (path, samplerate, BVIBRATR_NR_CONTROLLERS, trace_audio && (trace_audio[0] == '1')));
+	}
+#endif
 }
 
-BVibratr::~BVibratr () {}
+BVibratr::~BVibratr ()
+{
+	delete engine.set_trajectory (nullptr);
+	delete trajectory_replaced;
+}
 
 void BVibratr::connect_port (uint32_t port, void *data)
 {
@@ -84,343 +137,460 @@ void BVibratr::connect_port (uint32_t port, void *data)
 			{
 				latency_port = static_cast<float*>(data);
 			}
+
+			else if (port == BVIBRATR_NOTIFY)
+			{
+				notify_port = static_cast<LV2_Atom_Sequence*>(data);
+				engine.track_shift_range (notify_port != nullptr);
+			}
+
+			else if (port == BVIBRATR_MIDI_OUT) midi_out = static_cast<LV2_Atom_Sequence*>(data);
+			else if (port == BVIBRATR_VIBRATO_OUTPUT) vibrato_output_port = static_cast<float*>(data);
+			else if (port == BVIBRATR_BEND_RATE) bend_rate_port = static_cast<float*>(data);
+			else if (port == BVIBRATR_BEND_RANGE) bend_range_port = static_cast<float*>(data);
+			else if (port == BVIBRATR_BEND_CHANNEL) bend_channel_port = static_cast<float*>(data);
+			else if (port == BVIBRATR_CV_MODULATION) cv_modulation_port = static_cast<float*>(data);
+			else if (port == BVIBRATR_CV_TREMOLO) cv_tremolo_port = static_cast<float*>(data);
+			else if (port == BVIBRATR_CV_SHIFT) cv_shift_port = static_cast<float*>(data);
+			else if (port == BVIBRATR_CV_PITCH_IN) cv_pitch_in_port = static_cast<float*>(data);
+			else if (port == BVIBRATR_CV_TREMOLO_IN) cv_tremolo_in_port = static_cast<float*>(data);
+			else if (port == BVIBRATR_MODULATION_GROUP) modulation_group_port = static_cast<float*>(data);
+			else if (port == BVIBRATR_MODULATION_OFFSET) modulation_offset_port = static_cast<float*>(data);
+			else if (port == BVIBRATR_MODULATION_SOURCE) modulation_source_port = static_cast<float*>(data);
 	}
 }
 
 void BVibratr::activate ()
-{}
+{
+	engine.reset ();
+	clear_stats ();
+	bend_state = Bend {false, 0, 0.0, 0, -1, -1};
+
+#ifdef BVIBRATR_TRACE
+	if (trace) trace->add_activate();
+#endif
+}
 
 void BVibratr::deactivate ()
-{}
+{
+	// Leave the modulation group
+	engine.set_modulation_bus (nullptr);
+}
 
 void BVibratr::run (uint32_t n_samples)
 {
+#ifdef BVIBRATR_PROFILE
+	Profiler& profiler = engine.get_profiler ();
+#endif
+	BVIBRATR_PROFILE_ZONE (PROFILE_RUN);
+
 	// Check if all ports are connected
 	if ((!midi_in) || (!audio_in_1) || (!audio_in_2) || (!audio_out_1) || (!audio_out_2)) return;
 	for (const float* c : controller_ports) if (!c) return;
 	if (!latency_port) return;
 
-	// Update controllers
-	*(latency_port) = buffer_offset;
-	for (int i = 0; i < BVIBRATR_NR_CONTROLLERS; ++i) 
-	{
-		const float value = controller_limits[i].validate(*controller_ports[i]);
-		controllers[i] = value;
-		switch (i)
-		{
-			case BVIBRATR_BYPASS:
-			case BVIBRATR_DRY_WET:
-				mix.set((1.0f - controllers[BVIBRATR_BYPASS]) * controllers[BVIBRATR_DRY_WET]);
-				break;
-
-			case BVIBRATR_DEPTH_IS_CC:
-				depth =	((value == 128) ? (0.01 /* cents */ * controllers[BVIBRATR_DEPTH]) : depth_cc);
-				break;
+#ifdef BVIBRATR_TRACE
+	if (trace) record_trace (n_samples);
+#endif
 
-			case BVIBRATR_DEPTH:
-				if (controllers[BVIBRATR_DEPTH_IS_CC] == 128) depth = 0.01 /* cents */ * value;
-				break;
+	// Optional notify port: Measure time, prepare forge
+	std::chrono::steady_clock::time_point start_time;
+	if (notify_port)
+	{
+		start_time = std::chrono::steady_clock::now();
+		const uint32_t capacity = notify_port->atom.size;
+		lv2_atom_forge_set_buffer (&forge, reinterpret_cast<uint8_t*>(notify_port), capacity);
+		lv2_atom_forge_sequence_head (&forge, &notify_frame, 0);
+	}
 
-			case BVIBRATR_OSC1_WAVEFORM:
-				osc1.set_waveform(static_cast<LFO<double>::Waveform>(value));
-				break;
+	// Optional MIDI output: Prepare forge
+	if (midi_out)
+	{
+		const uint32_t capacity = midi_out->atom.size;
+		lv2_atom_forge_set_buffer (&midi_forge, reinterpret_cast<uint8_t*>(midi_out), capacity);
+		lv2_atom_forge_sequence_head (&midi_forge, &midi_frame, 0);
+	}
 
-			case BVIBRATR_OSC2_WAVEFORM:
-				osc2.set_waveform(static_cast<LFO<double>::Waveform>(value));
-				break;
+	// Switch between audio and pitch bend output. Center the pitch of the
+	// receiver and drop the (outdated) content of the delay lines.
+	const bool pitch_bend = is_pitch_bend ();
+	if (pitch_bend != bend_state.active)
+	{
+		if (pitch_bend) bend_state = Bend {true, 0, 0.0, 0, -1, -1};
+		else
+		{
+			if (midi_out && (bend_state.channel >= 0)) send_bend (0, bend_state.channel, 8192);
+			bend_state.active = false;
+			engine.clear_audio ();
+		}
+	}
 
-			case BVIBRATR_OSC3_WAVEFORM:
-				osc3.set_waveform(static_cast<LFO<double>::Waveform>(value));
-				break;
+	// Update controllers
+	BVIBRATR_PROFILE_BEGIN (PROFILE_CONTROLLERS);
+	*(latency_port) = (pitch_bend ? 0 : engine.get_latency ());
+	update_controllers ();
 
-			default:
-				break;
-		}
+	// Precompute the attack and decay in the worker. Repeat a request if the
+	// worker couldn't respond and a free if it couldn't be scheduled.
+	if (trajectory_failed.load (std::memory_order_acquire))
+	{
+		trajectory_failed.store (false, std::memory_order_relaxed);
+		trajectory_pending = false;
+		trajectory_requested = false;
+	}
+	if (trajectory_replaced) free_trajectory ();
+	if	(schedule && !trajectory_pending && !trajectory_replaced &&
+		 !(trajectory_requested && BVibratrTrajectory::is_equivalent (engine.get_controllers (), trajectory_controllers))) request_trajectory ();
+
+	engine.set_cv_outputs (cv_modulation_port, cv_tremolo_port, cv_shift_port);
+
+	// External modulation only if selected. Hosts may connect unused CV
+	// inputs to silence.
+	const int source = (modulation_source_port ? static_cast<int>(*modulation_source_port) : BVIBRATR_MODULATION_SOURCE_INTERNAL);
+	if (source == BVIBRATR_MODULATION_SOURCE_CV_PITCH) engine.set_cv_inputs (cv_pitch_in_port, nullptr);
+	else if (source == BVIBRATR_MODULATION_SOURCE_CV) engine.set_cv_inputs (cv_pitch_in_port, (cv_pitch_in_port ? cv_tremolo_in_port : nullptr));
+	else engine.set_cv_inputs (nullptr, nullptr);
+	if (modulation_group_port)
+	{
+		const float offset = (modulation_offset_port ? std::max (0.0f, std::min (*modulation_offset_port, 100.0f)) : 0.0f);
+		const int group = static_cast<int>(*modulation_group_port);
+		engine.set_modulation_bus ((group >= 1) && (group <= MODULATIONBUS_GROUPS) ? &modulation_buses[group - 1] : nullptr);
+		engine.sync_modulation_bus (n_samples, 0.001 * offset * samplerate);
 	}
+	BVIBRATR_PROFILE_END (PROFILE_CONTROLLERS);
+
+	uint32_t events = 0;
+#ifdef BVIBRATR_CYCLE_STATS
+	const uint64_t run_start = CycleStats::now();
+	uint32_t note_ons = 0;
+	uint32_t ccs = 0;
+#endif
 
 	// Playback and MIDI
+	const float* const in[2] = {audio_in_1, audio_in_2};
+	float* const out[2] = {audio_out_1, audio_out_2};
 	uint32_t last_frame = 0;
     LV2_ATOM_SEQUENCE_FOREACH (midi_in, ev)
     {
         /* play frames until event */
         const uint32_t frame = ev->time.frames;
-        play (last_frame, frame);
+        if (pitch_bend) bend (last_frame, frame);
+        else engine.play (in, out, last_frame, frame);
         last_frame = frame;
 
-        if (ev->body.type == urids.midi_MidiEvent) on_midi(reinterpret_cast<const uint8_t*> (ev + 1));
+        if (ev->body.type == urids.midi_MidiEvent)
+		{
+			const uint8_t* const msg = reinterpret_cast<const uint8_t*> (ev + 1);
+#ifdef BVIBRATR_CYCLE_STATS
+			const uint8_t status = lv2_midi_message_type (msg);
+			if (status == LV2_MIDI_MSG_NOTE_ON) ++note_ons;
+			else if (status == LV2_MIDI_MSG_CONTROLLER) ++ccs;
+#endif
+			engine.on_midi(msg);
+
+			// MIDI thru
+			if (pitch_bend)
+			{
+				lv2_atom_forge_frame_time (&midi_forge, frame);
+				lv2_atom_forge_atom (&midi_forge, ev->body.size, ev->body.type);
+				lv2_atom_forge_write (&midi_forge, msg, ev->body.size);
+			}
+		}
+
+		++events;
     }
 
     /* play remaining frames */
-    play (last_frame, n_samples);
-}
-
-void BVibratr::on_midi_note_on (const uint8_t channel, const uint8_t note, const uint8_t velocity)
-{
-	if (static_cast<uint16_t>(controllers[BVIBRATR_MIDI_CHANNEL]) & (1 << channel))
+    if (pitch_bend)
 	{
-		if ((controllers[BVIBRATR_MIDI_NOTE] == note) || (controllers[BVIBRATR_MIDI_NOTE] == 128))
+		bend (last_frame, n_samples);
+
+		// Audio passes through
+		for (int i = 0; i < 2; ++i)
 		{
-			adsr.set_parameters	(controllers[BVIBRATR_DEPTH_ATTACK],
-								 controllers[BVIBRATR_DEPTH_DECAY],
-								 controllers[BVIBRATR_DEPTH_SUSTAIN],
-							 	 controllers[BVIBRATR_DEPTH_RELEASE]);
-
-			osc1.set_waveform(static_cast<LFO<double>::Waveform>(controllers[BVIBRATR_OSC1_WAVEFORM]));
-			osc1.set_frequency(controllers[BVIBRATR_OSC1_FREQ]);
-			osc2.set_waveform(static_cast<LFO<double>::Waveform>(controllers[BVIBRATR_OSC2_WAVEFORM]));
-			osc2.set_frequency(controllers[BVIBRATR_OSC2_FREQ]);
-			osc3.set_waveform(static_cast<LFO<double>::Waveform>(controllers[BVIBRATR_OSC3_WAVEFORM]));
-			osc3.set_frequency(controllers[BVIBRATR_OSC3_FREQ]);
-
-			adsr.start();
-			osc1.start();
-			osc2.start();
-			osc3.start();
-
-			this->note = note;
+			if (out[i] != in[i]) std::copy (in[i], in[i] + n_samples, out[i]);
 		}
 	}
-}
-
-void BVibratr::on_midi_note_off (const uint8_t channel, const uint8_t note, const uint8_t velocity)
-{
-	if (static_cast<uint16_t>(controllers[BVIBRATR_MIDI_CHANNEL]) & (1 << channel))
+    else
 	{
-		if (this->note == note)
-		{
-			adsr.release();
-			this->note = 0xFF;
-		}
+		engine.play (in, out, last_frame, n_samples);
+		engine.finish ();
 	}
-}
 
-void BVibratr::on_midi_cc (const uint8_t channel, const uint8_t cc, const uint8_t param)
-{
-	if ((static_cast<uint16_t>(controllers[BVIBRATR_MIDI_CHANNEL]) & (1 << channel)) or 
-	    (controllers[BVIBRATR_MIDI_CHANNEL] == 0.0f))
+#ifdef BVIBRATR_CYCLE_STATS
+	engine.get_cycle_stats().add_run (CycleStats::now() - run_start, n_samples, events, note_ons, ccs, engine.get_adsr_phase_nr());
+#endif
+
+	// Publish statistics every BVIBRATR_NOTIFY_INTERVAL blocks
+	if (notify_port)
 	{
-		switch (cc)
+		const double time = std::chrono::duration<double> (std::chrono::steady_clock::now() - start_time).count();
+		++stats.blocks;
+		stats.events += events;
+		stats.time += time;
+		stats.time_max = std::max (stats.time_max, time);
+		if (stats.blocks >= BVIBRATR_NOTIFY_INTERVAL)
 		{
-			case LV2_MIDI_CTL_ALL_NOTES_OFF:	
-				on_midi_note_off	(channel, 
-									 static_cast<uint8_t>(controllers[BVIBRATR_MIDI_NOTE]), 
-									 0);
-				break;
-
-			case LV2_MIDI_CTL_ALL_SOUNDS_OFF:	
-				on_midi_note_off	(channel, 
-									 static_cast<uint8_t>(controllers[BVIBRATR_MIDI_NOTE]), 
-									 0);
-				osc1.stop();
-				osc2.stop();
-				osc3.stop();
-				break;
-
-			default:
-				{
-					if ((controllers[BVIBRATR_DEPTH_IS_CC] != 128) && 
-						(cc == controllers[BVIBRATR_DEPTH_IS_CC]))
-					{
-						depth_cc = static_cast<double>(param) / 127.0;
-						depth = 0.01 /* cents */ * controller_limits[BVIBRATR_DEPTH].max * depth_cc;
-					}
-				}
+			notify_stats (n_samples ? n_samples - 1 : 0);
+			clear_stats ();
 		}
+		lv2_atom_forge_pop (&forge, &notify_frame);
 	}
 
+	if (midi_out) lv2_atom_forge_pop (&midi_forge, &midi_frame);
 }
 
-void BVibratr::on_midi (const uint8_t* const msg)
+bool BVibratr::is_pitch_bend () const
 {
-	const uint8_t typ = lv2_midi_message_type (msg);
-	const uint8_t status = typ & 0xf0;
-	const uint8_t channel = typ & 0x0f;
+	return	midi_out && vibrato_output_port && bend_rate_port && bend_range_port && bend_channel_port &&
+			(static_cast<int>(*vibrato_output_port) == BVIBRATR_VIBRATO_OUTPUT_PITCH_BEND);
+}
 
-	switch (status)
-	{
-		case LV2_MIDI_MSG_NOTE_ON:		on_midi_note_on(channel, msg[1], msg[2]);
-										break;
+void BVibratr::bend (const uint32_t from, const uint32_t to)
+{
+	const double rate = std::max (10.0f, std::min (*bend_rate_port, 1000.0f));
+	const uint32_t interval = std::max<uint32_t> (samplerate / rate, 1);
+	const double range = std::max (1.0f, std::min (*bend_range_port, 96.0f));
+	const int channel_nr = std::max (0, std::min (static_cast<int>(*bend_channel_port), 16));
 
-		case LV2_MIDI_MSG_NOTE_OFF:		on_midi_note_off(channel, msg[1], msg[2]);
-										break;
+	for (uint32_t i0 = from; i0 < to; )
+	{
+		// Mean pitch (as rendered by the delay lines) between two messages
+		// (may span several run() calls and MIDI events)
+		if (bend_state.countdown == 0) bend_state.countdown = interval;
+		const uint32_t n = std::min (bend_state.countdown, to - i0);
+		bend_state.sum += engine.advance_pitch (i0, i0 + n) * n;
+		bend_state.frames += n;
+		bend_state.countdown -= n;
+		i0 += n;
+		if (bend_state.countdown != 0) continue;
+
+		// Channel of the trigger note (MPE) or fixed channel
+		const int channel = (channel_nr == 0 ? engine.get_note_channel () : channel_nr - 1);
+		const double semitones = engine.get_mix () * bend_state.sum / bend_state.frames;
+		const int value = std::max (0, std::min (static_cast<int> (std::round (8192.0 + 8192.0 * semitones / range)), 16383));
+		bend_state.sum = 0.0;
+		bend_state.frames = 0;
+		if (channel < 0) continue;
+
+		// Release the last channel
+		if ((bend_state.channel >= 0) && (bend_state.channel != channel))
+		{
+			if (bend_state.value != 8192) send_bend (i0 - 1, bend_state.channel, 8192);
+			bend_state.value = -1;
+		}
 
-		case LV2_MIDI_MSG_CONTROLLER:	on_midi_cc(channel, msg[1], msg[2]);
-										break;
-		default: break;
+		// Send only changes
+		if ((channel != bend_state.channel) || (value != bend_state.value)) send_bend (i0 - 1, channel, value);
+		bend_state.channel = channel;
+		bend_state.value = value;
 	}
-
 }
 
-void BVibratr::on_osc1_restart(LFO<double>& adsr, void* obj)
+void BVibratr::send_bend (const uint32_t frame, const int channel, const int value)
 {
-	BVibratr* plugin = static_cast<BVibratr*>(obj);
-	plugin->osc1_mode = plugin->controllers[BVIBRATR_OSC1_MODE];
+	// Forge into the MIDI output buffer. The forge stops writing if the
+	// buffer is full.
+	const uint8_t msg[3] =	{
+								static_cast<uint8_t> (LV2_MIDI_MSG_BENDER | channel),
+								static_cast<uint8_t> (value & 0x7F),
+								static_cast<uint8_t> (value >> 7)
+							};
+	lv2_atom_forge_frame_time (&midi_forge, frame);
+	lv2_atom_forge_atom (&midi_forge, 3, urids.midi_MidiEvent);
+	lv2_atom_forge_write (&midi_forge, msg, 3);
 }
 
-void BVibratr::on_osc2_restart(LFO<double>& adsr, void* obj)
+void BVibratr::request_trajectory ()
 {
-	BVibratr* plugin = static_cast<BVibratr*>(obj);
-	plugin->osc2_mode = plugin->controllers[BVIBRATR_OSC2_MODE];
+	WorkMessage message = {WorkMessage::RENDER_TRAJECTORY, engine.get_controllers (), nullptr};
+	trajectory_requested = true;
+	trajectory_controllers = message.controllers;
+	trajectory_pending = (schedule->schedule_work (schedule->handle, sizeof (message), &message) == LV2_WORKER_SUCCESS);
 }
 
-void BVibratr::on_osc3_restart(LFO<double>& adsr, void* obj)
+LV2_Worker_Status BVibratr::work (LV2_Worker_Respond_Function respond, LV2_Worker_Respond_Handle handle, uint32_t size, const void* data)
 {
-	BVibratr* plugin = static_cast<BVibratr*>(obj);
-	plugin->osc3_mode = plugin->controllers[BVIBRATR_OSC3_MODE];
-}
+	if (size != sizeof (WorkMessage)) return LV2_WORKER_ERR_UNKNOWN;
+	WorkMessage message;
+	memcpy (&message, data, sizeof (message));
 
-void BVibratr::play (uint32_t start, uint32_t end)
-{
-	const double sample_time = 1.0 / rate;
-
-	// Oscillator settings
-	const double osc1_freq = controllers[BVIBRATR_OSC1_FREQ];
-	const double osc2_amp = controllers[BVIBRATR_OSC2_AMP];
-	const double osc2_freq = controllers[BVIBRATR_OSC2_FREQ];
-	const double osc3_amp = controllers[BVIBRATR_OSC3_AMP];
-	const double osc3_freq = controllers[BVIBRATR_OSC3_FREQ];
-
-	const double amp_f = 1.0 +	((controllers[BVIBRATR_OSC2_MODE] == BVIBRATR_OSC_MODE_ADD) ? osc2_amp : 0.0) +
-								((controllers[BVIBRATR_OSC3_MODE] == BVIBRATR_OSC_MODE_ADD) ? osc3_amp : 0.0);
-
-	for (uint32_t i = start; i < end; ++i)
+	switch (message.type)
 	{
-		double signal = 0.0;		// To be used for tremolo (amp)
-		double integral = 0.0;		// To be used for vibrato (shift)
-
-		// Set modes if adsr (and thus all lfos) is stopped
-		if (!adsr.is_active())
-		{
-			osc1_mode = controllers[BVIBRATR_OSC1_MODE];
-			osc2_mode = controllers[BVIBRATR_OSC2_MODE];
-			osc3_mode = controllers[BVIBRATR_OSC3_MODE];
-		}
-
-		// Only run oscillators if adsr is active
-		else 
-		{
-			// Modulators
-			double osc1_freq_m = 1.0;	// Frequency multiplier, range [0.0, 2.0]
-			double osc1_phase_d = 0.0;	// Phase delta, range [-1.0, 1.0]
-			double osc1_amp_m = 1.0;	// Amplification multiplier, range [0.0, 1.0]
-
-			double osc2_freq_m = 1.0;
-			double osc2_phase_d = 0.0;
-			double osc2_amp_m = 1.0;
-
-			// Run osc3
-			osc3.set_frequency(osc3_freq);
-			osc3.run(sample_time);
-
-			switch(osc3_mode)
+		case WorkMessage::RENDER_TRAJECTORY:
 			{
-				case BVIBRATR_OSC_MODE_ADD:	
-					signal += osc3_amp * osc3.get_value();
-					integral += osc3_amp * osc3.get_integral() * rate / osc3_freq;
-					break;
-
-				case BVIBRATR_OSC_MODE_FM1:
-					osc1_freq_m *= (1.0 - osc3_amp * osc3.get_value());
-					break;
+				// Respond nullptr on failure. The engine continues without
+				// a trajectory then.
+				BVibratrTrajectory* trajectory = nullptr;
+				try {trajectory = BVibratrEngine::render_trajectory (samplerate, message.controllers);}
+				catch (std::exception& exc) {fprintf (stderr, "BVibratr.lv2: Can't render trajectory. %s\n", exc.what ());}
+
+				// Drop the trajectory if it can't be passed to run() and let
+				// run() request it again
+				const LV2_Worker_Status status = respond (handle, sizeof (trajectory), &trajectory);
+				if (status != LV2_WORKER_SUCCESS)
+				{
+					delete trajectory;
+					trajectory_failed.store (true, std::memory_order_release);
+				}
+				return status;
+			}
 
-				case BVIBRATR_OSC_MODE_PM1:
-					osc1_phase_d += osc3_amp * osc3.get_value();
-					break;
+		case WorkMessage::FREE_TRAJECTORY:
+			delete message.trajectory;
+			return LV2_WORKER_SUCCESS;
 
-				case BVIBRATR_OSC_MODE_AM1:
-					osc1_amp_m *= (1.0 - 0.5 * osc3_amp * (1.0 + osc3.get_value()));
-					break;
+		default:
+			return LV2_WORKER_ERR_UNKNOWN;
+	}
+}
 
-				case BVIBRATR_OSC_MODE_FM2:
-					osc2_freq_m *= (1.0 - osc3_amp * osc3.get_value());
-					break;
+LV2_Worker_Status BVibratr::work_response (uint32_t size, const void* data)
+{
+	if (size != sizeof (BVibratrTrajectory*)) return LV2_WORKER_ERR_UNKNOWN;
+	const BVibratrTrajectory* trajectory;
+	memcpy (&trajectory, data, sizeof (trajectory));
+	trajectory_pending = false;
+
+	// Replace the trajectory and free the last one in the worker
+	trajectory_replaced = engine.set_trajectory (trajectory);
+	if (trajectory_replaced) free_trajectory ();
+	return LV2_WORKER_SUCCESS;
+}
 
-				case BVIBRATR_OSC_MODE_PM2:
-					osc2_phase_d += osc3_amp * osc3.get_value();
-					break;
+void BVibratr::free_trajectory ()
+{
+	// Keep the trajectory and try again in the next run() if the worker
+	// queue is full
+	const WorkMessage message = {WorkMessage::FREE_TRAJECTORY, {}, trajectory_replaced};
+	if (schedule->schedule_work (schedule->handle, sizeof (message), &message) == LV2_WORKER_SUCCESS) trajectory_replaced = nullptr;
+}
 
-				case BVIBRATR_OSC_MODE_AM2:
-					osc2_amp_m *= (1.0 - 0.5 * osc3_amp * (1.0 + osc3.get_value()));
-					break;
+#ifdef BVIBRATR_PROFILE
+void BVibratr::get_profile (ProfileSnapshot& snapshot) const
+{
+	engine.get_profiler().get (snapshot);
+}
 
-				default:
-					break;
-			}
+void BVibratr::reset_profile ()
+{
+	engine.get_profiler().reset ();
+}
+#endif
 
-			// Run osc2
-			osc2.set_frequency(osc2_freq_m * osc2_freq);
-			osc1.set_phase_shift(osc2_phase_d);
-			osc2.run(sample_time);
+#ifdef BVIBRATR_CHECKPOINTS
+BVibratrCheckpoint* BVibratr::save_checkpoint ()
+{
+	return engine.save_checkpoint ();
+}
 
-			switch(osc2_mode)
-			{
-				case BVIBRATR_OSC_MODE_ADD:	
-					signal += osc2_amp_m * osc2_amp * osc2.get_value();
-					integral += osc2_amp_m * osc2_amp * osc2.get_integral() * rate / osc2_freq;
-					break;
+void BVibratr::restore_checkpoint (const BVibratrCheckpoint& checkpoint)
+{
+	engine.restore_checkpoint (checkpoint);
+}
 
-				case BVIBRATR_OSC_MODE_FM1:
-					osc1_freq_m *= (1.0 - osc2_amp_m * osc2_amp * osc2.get_value());
-					break;
+void BVibratr::advance (uint32_t n_samples)
+{
+	if (!midi_in) return;
+	for (const float* c : controller_ports) if (!c) return;
 
-				case BVIBRATR_OSC_MODE_PM1:
-					osc1_phase_d += osc2_amp_m * osc2_amp * osc2.get_value();
-					break;
+	update_controllers ();
 
-				case BVIBRATR_OSC_MODE_AM1:
-					osc1_amp_m *= (1.0 - 0.5 * osc2_amp_m * osc2_amp * (1.0 + osc2.get_value()));
-					break;
+	// Modulation and MIDI
+	uint32_t last_frame = 0;
+	LV2_ATOM_SEQUENCE_FOREACH (midi_in, ev)
+	{
+		const uint32_t frame = ev->time.frames;
+		if (frame > last_frame) engine.advance (frame - last_frame);
+		last_frame = frame;
+		if (ev->body.type == urids.midi_MidiEvent) engine.on_midi (reinterpret_cast<const uint8_t*> (ev + 1));
+	}
+	if (n_samples > last_frame) engine.advance (n_samples - last_frame);
+}
 
-				default:
-					break;
-			}
+BVibratrModulationAt BVibratr::get_modulation_at (uint64_t t)
+{
+	return engine.get_modulation_at (t);
+}
+#endif
 
-			// Run osc1
-			if (osc1_mode == BVIBRATR_OSC_MODE_LFO)
-			{
-				osc1.set_frequency(osc1_freq_m * osc1_freq);
-				osc1.set_phase_shift(osc1_phase_d);
-				osc1.run(sample_time);
-				signal += osc1_amp_m * osc1.get_value();
-				integral += osc1_amp_m * osc1.get_integral() * rate / osc1_freq;
-			}
+#ifdef BVIBRATR_CYCLE_STATS
+void BVibratr::get_cycle_stats (CycleStatsSnapshot& snapshot) const
+{
+	engine.get_cycle_stats().get (snapshot);
+}
 
-			else /* BVIBRATR_OSC_MODE_USER */ 
-			{}
+void BVibratr::reset_cycle_stats ()
+{
+	engine.get_cycle_stats().reset ();
+}
+#endif
 
-			// Scale signal and integral to not exceed 1.0
-			signal /= amp_f;
-			integral /= amp_f;
+void BVibratr::update_controllers ()
+{
+	for (int i = 0; i < BVIBRATR_NR_CONTROLLERS; ++i) engine.set_controller (i, *controller_ports[i]);
+}
 
-			// Apply adsr
-			adsr.run(sample_time);
-			signal *= adsr.get_value();
-			integral *= adsr.get_value();
+#ifdef BVIBRATR_TRACE
+void BVibratr::record_trace (const uint32_t n_samples)
+{
+	// Raw port values, MIDI events and audio input as received by run()
+	std::array<float, BVIBRATR_NR_CONTROLLERS> values;
+	for (int i = 0; i < BVIBRATR_NR_CONTROLLERS; ++i) values[i] = *controller_ports[i];
+	if (trace->begin_run (n_samples, values.data()))
+	{
+		LV2_ATOM_SEQUENCE_FOREACH (midi_in, ev)
+		{
+			if (ev->body.type == urids.midi_MidiEvent) trace->add_midi (ev->time.frames, reinterpret_cast<const uint8_t*> (ev + 1), ev->body.size);
 		}
-
-		// Vibrato depth 
-		integral *= depth;
-		shift.set((SQRT_12_2 - 1.0) * integral);
-
-		// ... and tremolo
-		// Send signal * controller to fader to prevent clicks on square waves
-		const double tremolo  = controllers[BVIBRATR_TREMOLO] * signal;
-		amp.set(1.0 - tremolo);
-
-		// Proceed dry/wet mix
-		mix.proceed();
-		const float mix_f = mix.get();
-
-		// Audio output
-		buffer_1.push_front(audio_in_1[i]);
-		buffer_2.push_front(audio_in_2[i]);
-		const float dry_1 = buffer_1[buffer_offset];
-		const float dry_2 = buffer_2[buffer_offset];
-		const float wet_1 = amp.get() * buffer_1[buffer_offset + shift.get()];
-		const float wet_2 = amp.get() * buffer_2[buffer_offset + shift.get()];
-		audio_out_1[i] = (1.0f - mix_f) * dry_1 + mix_f * wet_1;
-		audio_out_2[i] = (1.0f - mix_f) * dry_2 + mix_f * wet_2;
 	}
+	trace->end_run (audio_in_1, audio_in_2);
+}
+#endif
+
+void BVibratr::clear_stats ()
+{
+	stats.blocks = 0;
+	stats.events = 0;
+	stats.time = 0.0;
+	stats.time_max = 0.0;
+	engine.clear_shift_range ();
+}
+
+void BVibratr::notify_stats (const uint32_t frame)
+{
+	// Forge into the notify port buffer. The forge stops writing if the
+	// buffer provided by the host is full.
+	float shift_min, shift_max;
+	engine.get_shift_range (shift_min, shift_max);
+	LV2_Atom_Forge_Frame frame_obj;
+	lv2_atom_forge_frame_time (&forge, frame);
+	lv2_atom_forge_object (&forge, &frame_obj, 0, urids.bvibratr_stats);
+	lv2_atom_forge_key (&forge, urids.bvibratr_shift);
+	lv2_atom_forge_float (&forge, engine.get_shift());
+	lv2_atom_forge_key (&forge, urids.bvibratr_shiftMin);
+	lv2_atom_forge_float (&forge, shift_min);
+	lv2_atom_forge_key (&forge, urids.bvibratr_shiftMax);
+	lv2_atom_forge_float (&forge, shift_max);
+	lv2_atom_forge_key (&forge, urids.bvibratr_tremolo);
+	lv2_atom_forge_float (&forge, engine.get_amp());
+	lv2_atom_forge_key (&forge, urids.bvibratr_adsrPhase);
+	lv2_atom_forge_int (&forge, engine.get_adsr_phase_nr());
+	lv2_atom_forge_key (&forge, urids.bvibratr_osc1Mode);
+	lv2_atom_forge_int (&forge, engine.get_osc_mode (1));
+	lv2_atom_forge_key (&forge, urids.bvibratr_osc2Mode);
+	lv2_atom_forge_int (&forge, engine.get_osc_mode (2));
+	lv2_atom_forge_key (&forge, urids.bvibratr_osc3Mode);
+	lv2_atom_forge_int (&forge, engine.get_osc_mode (3));
+	lv2_atom_forge_key (&forge, urids.bvibratr_processTime);
+	lv2_atom_forge_float (&forge, 1000000.0 * stats.time / stats.blocks);
+	lv2_atom_forge_key (&forge, urids.bvibratr_processTimeMax);
+	lv2_atom_forge_float (&forge, 1000000.0 * stats.time_max);
+	lv2_atom_forge_key (&forge, urids.bvibratr_events);
+	lv2_atom_forge_int (&forge, stats.events);
+	lv2_atom_forge_key (&forge, urids.bvibratr_blocks);
+	lv2_atom_forge_int (&forge, stats.blocks);
+	lv2_atom_forge_pop (&forge, &frame_obj);
 }
 
 /*LV2_State_Status BVibratr::state_save (LV2_State_Store_Function store, LV2_State_Handle handle, uint32_t flags, const LV2_Feature* const* features)
@@ -446,12 +616,6 @@ void BVibratr::play (uint32_t start, uint32_t end)
 	return LV2_STATE_SUCCESS;
 }*/
 
-/*LV2_Worker_Status BVibratr::work (LV2_Worker_Respond_Function respond, LV2_Worker_Respond_Handle handle, uint32_t size, const void* data)
-{}*/
-
-/*LV2_Worker_Status BVibratr::work_response (uint32_t size, const void* data)
-{}*/
-
 /*LV2_Worker_Status BVibratr::end_run ()
 {}*/
 
@@ -461,7 +625,7 @@ static LV2_Handle instantiate (const LV2_Descriptor* descriptor, double samplera
 {
 	// New instance
 	BVibratr* instance;
-	try {instance = new BVibratr (samplerate, bundle_path, features);}
+	try {instance = BVibratr::create (samplerate, bundle_path, features);}
 	catch (std::exception& exc)
 	{
 		fprintf (stderr, "Plugin instantiation failed. %s\n", exc.what ());
@@ -513,22 +677,22 @@ static void deactivate (LV2_Handle instance)
 	return inst->state_restore (retrieve, handle, flags, features);
 }*/
 
-/*static LV2_Worker_Status work (LV2_Handle instance, LV2_Worker_Respond_Function respond, LV2_Worker_Respond_Handle handle,
+static LV2_Worker_Status work (LV2_Handle instance, LV2_Worker_Respond_Function respond, LV2_Worker_Respond_Handle handle,
 	uint32_t size, const void* data)
 {
 	BVibratr* inst = static_cast<BVibratr*>(instance);
 	if (!inst) return LV2_WORKER_SUCCESS;
 
 	return inst->work (respond, handle, size, data);
-}*/
+}
 
-/*static LV2_Worker_Status work_response (LV2_Handle instance, uint32_t size,  const void* data)
+static LV2_Worker_Status work_response (LV2_Handle instance, uint32_t size,  const void* data)
 {
 	BVibratr* inst = static_cast<BVibratr*>(instance);
 	if (!inst) return LV2_WORKER_SUCCESS;
 
 	return inst->work_response (size, data);
-}*/
+}
 
 /*static LV2_Worker_Status end_run (LV2_Handle instance)
 {
@@ -541,8 +705,67 @@ static void deactivate (LV2_Handle instance)
 static void cleanup (LV2_Handle instance)
 {
 	BVibratr* inst = static_cast<BVibratr*>(instance);
-	if (inst) delete inst;
+	if (inst) BVibratr::destroy (inst);
+}
+
+#ifdef BVIBRATR_PROFILE
+static void get_profile (LV2_Handle instance, ProfileSnapshot* snapshot)
+{
+	BVibratr* inst = static_cast<BVibratr*>(instance);
+	if (inst && snapshot) inst->get_profile (*snapshot);
+}
+
+static void reset_profile (LV2_Handle instance)
+{
+	BVibratr* inst = static_cast<BVibratr*>(instance);
+	if (inst) inst->reset_profile ();
+}
+#endif
+
+#ifdef BVIBRATR_CYCLE_STATS
+static void get_cycle_stats (LV2_Handle instance, CycleStatsSnapshot* snapshot)
+{
+	BVibratr* inst = static_cast<BVibratr*>(instance);
+	if (inst && snapshot) inst->get_cycle_stats (*snapshot);
+}
+
+static void reset_cycle_stats (LV2_Handle instance)
+{
+	BVibratr* inst = static_cast<BVibratr*>(instance);
+	if (inst) inst->reset_cycle_stats ();
+}
+#endif
+
+#ifdef BVIBRATR_CHECKPOINTS
+static BVibratrCheckpoint* save_checkpoint (LV2_Handle instance)
+{
+	BVibratr* inst = static_cast<BVibratr*>(instance);
+	return (inst ? inst->save_checkpoint () : nullptr);
+}
+
+static void restore_checkpoint (LV2_Handle instance, const BVibratrCheckpoint* checkpoint)
+{
+	BVibratr* inst = static_cast<BVibratr*>(instance);
+	if (inst && checkpoint) inst->restore_checkpoint (*checkpoint);
+}
+
+static void free_checkpoint (BVibratrCheckpoint* checkpoint)
+{
+	delete checkpoint;
+}
+
+static void advance (LV2_Handle instance, uint32_t n_samples)
+{
+	BVibratr* inst = static_cast<BVibratr*>(instance);
+	if (inst) inst->advance (n_samples);
+}
+
+static void get_modulation_at (LV2_Handle instance, uint64_t t, BVibratrModulationAt* state)
+{
+	BVibratr* inst = static_cast<BVibratr*>(instance);
+	if (inst && state) *state = inst->get_modulation_at (t);
 }
+#endif
 
 static const void* extension_data (const char* uri)
 {
@@ -551,8 +774,26 @@ static const void* extension_data (const char* uri)
 	//if (!strcmp(uri, LV2_STATE__interface)) return &state;
 
 	// Worker
-	//static const LV2_Worker_Interface worker = {work, work_response, end_run};
-	//if (!strcmp(uri, LV2_WORKER__interface)) return &worker;
+	static const LV2_Worker_Interface worker = {work, work_response, NULL};
+	if (!strcmp(uri, LV2_WORKER__interface)) return &worker;
+
+#ifdef BVIBRATR_CYCLE_STATS
+	// Cycle statistics
+	static const BVibratrCycleStatsInterface cycle_stats = {get_cycle_stats, reset_cycle_stats};
+	if (!strcmp(uri, BVIBRATR_CYCLE_STATS_URI)) return &cycle_stats;
+#endif
+
+#ifdef BVIBRATR_PROFILE
+	// Profiling zones
+	static const BVibratrProfileInterface profile = {get_profile, reset_profile};
+	if (!strcmp(uri, BVIBRATR_PROFILE_URI)) return &profile;
+#endif
+
+#ifdef BVIBRATR_CHECKPOINTS
+	// Checkpoints for offline rendering
+	static const BVibratrCheckpointInterface checkpoint = {save_checkpoint, restore_checkpoint, free_checkpoint, advance, get_modulation_at};
+	if (!strcmp(uri, BVIBRATR_CHECKPOINT_URI)) return &checkpoint;
+#endif
 
 	return NULL;
 }
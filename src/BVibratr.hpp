@@ -2,74 +2,228 @@
 #define BVIBRATR_HPP_
 
 #include <array>
-#include "ADSR.hpp"
-#include "LFO.hpp"
-#include "LinearFader.hpp"
-#include "RingBuffer.hpp"
+#include <atomic>
+#include "BVibratrEngine.hpp"
 
 #include <cstdint>
 #include <lv2/core/lv2.h>
 #include <lv2/atom/atom.h>
+#include <lv2/atom/forge.h>
+#include <lv2/worker/worker.h>
 
 #define BVIBRATR_URI "https://www.jahnichen.de/plugins/lv2/BVibratr"
 //#define LV2PLUGIN_GUI_URI LV2PLUGIN_URI "#gui"
+#define BVIBRATR_NOTIFY_INTERVAL 64	// Number of run() calls between two statistics messages
+
+#ifdef BVIBRATR_HUGEPAGES
+#define BVIBRATR_USE_HUGEPAGES true
+#else
+#define BVIBRATR_USE_HUGEPAGES false
+#endif
 
-#include "Ports.hpp"
 #include "Urids.hpp"
 
+#ifdef BVIBRATR_TRACE
+#include <memory>
+#include "TraceRecorder.hpp"
+#endif
+
+#ifdef BVIBRATR_CYCLE_STATS
+#define BVIBRATR_CYCLE_STATS_URI BVIBRATR_URI "#cycleStats"
+
+/**
+Extension interface for non-realtime readers of the cycle statistics.
+Provided by extension_data (BVIBRATR_CYCLE_STATS_URI) if compiled with
+BVIBRATR_CYCLE_STATS.
+*/
+struct BVibratrCycleStatsInterface
+{
+	void (*get) (LV2_Handle instance, CycleStatsSnapshot* snapshot);
+	void (*reset) (LV2_Handle instance);
+};
+#endif
+
+#ifdef BVIBRATR_PROFILE
+#define BVIBRATR_PROFILE_URI BVIBRATR_URI "#profile"
 
+/**
+Extension interface for non-realtime readers of the profiling zones.
+Provided by extension_data (BVIBRATR_PROFILE_URI) if compiled with
+BVIBRATR_PROFILE.
+*/
+struct BVibratrProfileInterface
+{
+	void (*get) (LV2_Handle instance, ProfileSnapshot* snapshot);
+	void (*reset) (LV2_Handle instance);
+};
+#endif
+
+#ifdef BVIBRATR_CHECKPOINTS
+#define BVIBRATR_CHECKPOINT_URI BVIBRATR_URI "#checkpoint"
+
+/**
+Extension interface for offline renderers to split the processing of a
+stream. Provided by extension_data (BVIBRATR_CHECKPOINT_URI) if compiled
+with BVIBRATR_CHECKPOINTS. Not realtime safe. See BVibratrCheckpoint
+(BVibratrEngine.hpp).
+save() returns a new checkpoint, to be deleted by free().
+advance() processes the controllers, the MIDI input and the modulation like
+run(), but neither reads nor writes audio.
+get_modulation_at() gets the modulation state t frames after the current
+position without further input (see BVibratrEngine::get_modulation_at()).
+*/
+struct BVibratrCheckpointInterface
+{
+	BVibratrCheckpoint* (*save) (LV2_Handle instance);
+	void (*restore) (LV2_Handle instance, const BVibratrCheckpoint* checkpoint);
+	void (*free) (BVibratrCheckpoint* checkpoint);
+	void (*advance) (LV2_Handle instance, uint32_t n_samples);
+	void (*get_modulation_at) (LV2_Handle instance, uint64_t t, BVibratrModulationAt* state);
+};
+#endif
+
+
+/**
+BVibratr plugin instance. A thin LV2 adapter over BVibratrEngine: Reads the
+ports, passes the controllers and MIDI messages to the engine and reports the
+latency and the statistics. Optionally sends the vibrato as pitch bend
+messages instead of processing the audio. If the host provides a worker, the
+attack and decay are rendered in advance (see BVibratrTrajectory) each time
+the settings change. All instance memory (the instance itself and the
+delay lines of the engine) is taken from a single arena. Use create() and
+destroy() instead of new and delete.
+*/
 class BVibratr
 {
 public:
-	BVibratr (double samplerate, const char* bundlePath, const LV2_Feature* const* features);
-	~BVibratr ();
+	static BVibratr* create (double samplerate, const char* bundlePath, const LV2_Feature* const* features);
+	static void destroy (BVibratr* instance);
 
 	void connect_port (uint32_t port, void *data);
 	void activate ();
 	void run (uint32_t n_samples);
 	void deactivate ();
+	LV2_Worker_Status work (LV2_Worker_Respond_Function respond, LV2_Worker_Respond_Handle handle, uint32_t size, const void* data);
+	LV2_Worker_Status work_response (uint32_t size, const void* data);
+
+#ifdef BVIBRATR_CYCLE_STATS
+	void get_cycle_stats (CycleStatsSnapshot& snapshot) const;
+	void reset_cycle_stats ();
+#endif
+
+#ifdef BVIBRATR_PROFILE
+	void get_profile (ProfileSnapshot& snapshot) const;
+	void reset_profile ();
+#endif
+
+#ifdef BVIBRATR_CHECKPOINTS
+	BVibratrCheckpoint* save_checkpoint ();
+	void restore_checkpoint (const BVibratrCheckpoint& checkpoint);
+	void advance (uint32_t n_samples);
+	BVibratrModulationAt get_modulation_at (uint64_t t);
+#endif
 
 private:
-	void on_midi_note_on (const uint8_t channel, const uint8_t note, const uint8_t velocity);
-	void on_midi_note_off (const uint8_t channel, const uint8_t note, const uint8_t velocity);
-	void on_midi_cc (const uint8_t channel, const uint8_t cc, const uint8_t param);
-	void on_midi (const uint8_t* const msg);
-	static void on_osc1_restart(LFO<double>& adsr, void* obj);
-	static void on_osc2_restart(LFO<double>& adsr, void* obj);
-	static void on_osc3_restart(LFO<double>& adsr, void* obj);
-	void play (uint32_t start, uint32_t end);
+	BVibratr (double samplerate, const char* bundlePath, const LV2_Feature* const* features, Arena& memory);
+	~BVibratr ();
+
+	static size_t arena_size (double samplerate);
+
+	void update_controllers ();
+	void clear_stats ();
+	void notify_stats (const uint32_t frame);
+	bool is_pitch_bend () const;
+	void bend (const uint32_t from, const uint32_t to);
+	void send_bend (const uint32_t frame, const int channel, const int value);
+	void request_trajectory ();
+	void free_trajectory ();
+#ifdef BVIBRATR_TRACE
+	void record_trace (const uint32_t n_samples);
+#endif
+
+	// Memory of this instance. Declared before the engine which takes its
+	// delay lines from the arena.
+	Arena arena;
 
-	double rate;
+	// DSP
+	BVibratrEngine engine;
+	double samplerate;
 
 	// Ports
-	LV2_Atom_Sequence* midi_in;
+	alignas(64) LV2_Atom_Sequence* midi_in;
 	float* audio_in_1;
 	float* audio_in_2;
 	float* audio_out_1;
 	float* audio_out_2;
 	std::array<const float*, BVIBRATR_NR_CONTROLLERS> controller_ports;
 	float* latency_port;
+	LV2_Atom_Sequence* notify_port;			// Optional
+	LV2_Atom_Sequence* midi_out;			// Optional
+	const float* vibrato_output_port;		// Optional
+	const float* bend_rate_port;			// Optional
+	const float* bend_range_port;			// Optional
+	const float* bend_channel_port;			// Optional
+	float* cv_modulation_port;				// Optional
+	float* cv_tremolo_port;					// Optional
+	float* cv_shift_port;					// Optional
+	const float* cv_pitch_in_port;			// Optional
+	const float* cv_tremolo_in_port;		// Optional
+	const float* modulation_group_port;		// Optional
+	const float* modulation_offset_port;	// Optional
+	const float* modulation_source_port;	// Optional
+
+	BVibratrModulationBus* modulation_buses;	// All groups, see get_modulation_buses()
+
+	// Statistics for the notify port since the last message
+	struct Stats
+	{
+		uint32_t blocks;
+		uint32_t events;
+		double time;						// Seconds
+		double time_max;					// Seconds
+	} stats;
+
+	// Pitch bend output (BVIBRATR_VIBRATO_OUTPUT_PITCH_BEND)
+	struct Bend
+	{
+		bool active;						// Pitch bend output in the last run()
+		uint32_t countdown;					// Frames until the next message
+		double sum;							// Sum of pitch (semitones) x frames since the last message
+		uint32_t frames;					// Frames since the last message
+		int channel;						// Channel of the last message or -1
+		int value;							// Value of the last message or -1
+	} bend_state;
+
+	LV2_Atom_Forge forge;
+	LV2_Atom_Forge_Frame notify_frame;
+	LV2_Atom_Forge midi_forge;
+	LV2_Atom_Forge_Frame midi_frame;
+
+	// Messages to the worker
+	struct WorkMessage
+	{
+		enum Type {RENDER_TRAJECTORY, FREE_TRAJECTORY} type;
+		BVibratrTrajectory::Controllers controllers;	// RENDER_TRAJECTORY
+		const BVibratrTrajectory* trajectory;			// FREE_TRAJECTORY
+	};
+
+	// Trajectory rendering, only one request at once
+	bool trajectory_requested;				// Requested at least once
+	bool trajectory_pending;				// Waiting for the response
+	std::atomic<bool> trajectory_failed;	// The worker couldn't respond, request again
+	BVibratrTrajectory::Controllers trajectory_controllers;	// Controllers of the last request
+	const BVibratrTrajectory* trajectory_replaced;	// Not freed yet, no new request until then
 
 	// Optional map feature
 	LV2_URID_Map* map;
 	BVibratrURIDs urids;
 
-	// Controllers
-	std::array<float, BVIBRATR_NR_CONTROLLERS> controllers;
-
-	// Internals
-	ADSR<double> adsr;
-	LFO<double> osc1, osc2, osc3;
-	uint8_t note;							// Last NOTE_ON note (or >= 0x80 for none)
-	double depth_cc;
-	RingBuffer<float> buffer_1;
-	RingBuffer<float> buffer_2;
-	size_t buffer_offset;
-	int osc1_mode, osc2_mode, osc3_mode;	// TODO Schedule change
-	double depth;
-	LinearFader<double> shift;				// Temporal shift (vibrato)
-	LinearFader<float> amp;					// Volume change (tremolo)
-	LinearFader<float> mix;					// Mix for change in dry/wet and bypass
+	// Optional worker feature
+	LV2_Worker_Schedule* schedule;
+
+#ifdef BVIBRATR_TRACE
+	std::unique_ptr<TraceRecorder> trace;	// Only if requested by the environment
+#endif
 };
 
 #endif /* BVIBRATR_HPP_ */
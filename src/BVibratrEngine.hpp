@@ -0,0 +1,1683 @@
+#ifndef BVIBRATRENGINE_HPP_
+#define BVIBRATRENGINE_HPP_
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include "ADSR.hpp"
+#include "LFO.hpp"
+#include "LinearFader.hpp"
+#include "DelayLine.hpp"
+#include "Arena.hpp"
+#include "Kernels.hpp"
+#include "ModulationBus.hpp"
+#include "BVibratrTrajectory.hpp"
+#include "Ports.hpp"
+#include "Limits.hpp"
+#include "Profiler.hpp"
+
+#ifdef BVIBRATR_CYCLE_STATS
+#include "CycleStats.hpp"
+#endif
+
+#define BVIBRATR_CHUNK_SIZE 256		// Max. number of samples processed by the kernels at once, also the audio quantum
+
+#if BVIBRATR_CHUNK_SIZE > MODULATIONBUS_MAX_WRITE
+#error "Chunks are written to the modulation bus as a whole"
+#endif
+
+#ifdef BVIBRATR_HALF_DELAY
+#define BVIBRATR_DELAY_SAMPLE uint16_t	// Half precision (IEEE 754 binary16) delay lines
+#define BVIBRATR_DELAY_WRITE delay_write_half
+#define BVIBRATR_DELAY_READ_FIXED delay_read_fixed_half
+#define BVIBRATR_DELAY_READ delay_read_half
+#else
+#define BVIBRATR_DELAY_SAMPLE float
+#define BVIBRATR_DELAY_WRITE delay_write
+#define BVIBRATR_DELAY_READ_FIXED delay_read_fixed
+#define BVIBRATR_DELAY_READ delay_read
+#endif
+
+#define SQRT_12_2 (pow (2.0, 1.0 / 12.0))
+
+/**
+Typed parameters of the engine. Same as the controller ports of the plugin,
+initialized with the defaults from the .ttl file.
+*/
+struct BVibratrParameters
+{
+	bool bypass = false;
+	float dry_wet = 1.0f;						// 0.0 (dry) to 1.0 (wet)
+	uint16_t trigger_channels = 1;				// Bit field, bit 0 = MIDI channel 1
+	uint8_t trigger_note = 60;					// 0 to 127, 128 = any note
+	uint8_t depth_is_cc = 128;					// MIDI CC to control the depth, 128 = none
+	float depth = 20.0f;						// Cents
+	float depth_attack = 1.0f;					// Seconds
+	float depth_decay = 1.0f;					// Seconds
+	float depth_sustain = 0.8f;					// 0.0 to 1.0
+	float depth_release = 2.0f;					// Seconds
+	float osc1_frequency = 6.0f;				// Hz
+	int osc1_mode = BVIBRATR_OSC_MODE_LFO;		// BVibratrOscModes, LFO or USER
+	LFO<double>::Waveform osc1_waveform = LFO<double>::SINE;
+	float osc2_amp = 0.5f;
+	float osc2_frequency = 1.8f;				// Hz
+	int osc2_mode = BVIBRATR_OSC_MODE_PASS;		// BVibratrOscModes, PASS to AM1
+	LFO<double>::Waveform osc2_waveform = LFO<double>::SINE;
+	float osc3_amp = 0.2f;
+	float osc3_frequency = 1.0f;				// Hz
+	int osc3_mode = BVIBRATR_OSC_MODE_PASS;		// BVibratrOscModes, PASS to AM2
+	LFO<double>::Waveform osc3_waveform = LFO<double>::SINE;
+	float tremolo = 0.0f;						// 0.0 to 0.5
+};
+
+/**
+Timed MIDI message for BVibratrEngine::process().
+*/
+struct BVibratrEvent
+{
+	uint32_t frame;								// Position within the block
+	uint8_t msg[3];								// Note on, note off or controller, unused bytes 0
+};
+
+/**
+Modulation state at a time offset, see BVibratrEngine::get_modulation_at().
+*/
+struct BVibratrModulationAt
+{
+	int32_t adsr_phase_nr;						// 0 = idle, 1 = attack, 2 = decay, 3 = sustain, 4 = release
+	double envelope;							// ADSR value
+	double osc_phase[3];						// Phases of osc1 to osc3 (without phase shift), [0.0, 1.0)
+	int osc_mode[3];							// Active modes (BVibratrOscModes) of osc1 to osc3
+	bool exact;									// False if approximated (FM or PM routed to osc1 or osc2)
+};
+
+/**
+State of the modulator of a modulation group, passed from each engine
+rendering a block of the group to the next (see ModulationBus).
+*/
+struct BVibratrModulatorState
+{
+	const void* owner = nullptr;				// Engine which saved the state
+	BVibratrOscillatorState oscillators;
+	LinearFader<double> shift {0.0, (SQRT_12_2 - 1.0)};
+	LinearFader<float> amp {1.0f, 0.001f};
+};
+
+typedef ModulationBus<BVibratrModulatorState> BVibratrModulationBus;
+
+#ifdef BVIBRATR_CHECKPOINTS
+/**
+Modulation state of an engine: Everything except the parameters and the
+delay lines. The delay lines only contain the audio input of the last
+frames. Thus an engine continues exactly like the saved one after restoring
+a checkpoint and processing the audio input preceding the checkpoint
+position for at least 2 * latency + 1 frames.
+*/
+struct BVibratrCheckpoint
+{
+	double depth;
+	double depth_cc;
+	LinearFader<double> shift;
+	LinearFader<float> amp;
+	LinearFader<float> mix;
+	int osc1_mode, osc2_mode, osc3_mode;
+	uint8_t note;
+	uint8_t note_channel;
+	ADSR<double> adsr;
+	LFO<double> osc1, osc2, osc3;
+};
+#endif
+
+/**
+Host-agnostic B.Vibratr DSP engine: Stereo audio in and out, MIDI messages
+and parameters. Doesn't depend on LV2. The plugin is a thin adapter over
+this class. Realtime safe except construction and the checkpoint methods.
+
+Usage:
+	Arena memory (BVibratrEngine::arena_size (samplerate));
+	BVibratrEngine engine (samplerate, memory);
+	engine.set_parameters (parameters);
+	engine.process (in, out, n, events, n_events);
+*/
+class BVibratrEngine
+{
+public:
+	/**
+	Constructs the engine and takes the delay lines from an arena.
+	@param samplerate	Sample rate in Hz.
+	@param memory		Arena with at least arena_size (samplerate) bytes
+						left. Must outlive the engine.
+	@throws std::bad_alloc if the arena is exhausted.
+	*/
+	BVibratrEngine (const double samplerate, Arena& memory);
+
+	/**
+	Leaves the modulation group (if any).
+	*/
+	~BVibratrEngine ();
+
+	BVibratrEngine (const BVibratrEngine& that) = delete;
+	BVibratrEngine& operator= (const BVibratrEngine& that) = delete;
+
+	/**
+	Gets the size of the arena memory used by an engine.
+	@param samplerate	Sample rate in Hz.
+	@return				Size in bytes.
+	*/
+	static size_t arena_size (const double samplerate);
+
+	/**
+	Gets the latency (the delay of the dry signal).
+	@param samplerate	Sample rate in Hz.
+	@return				Latency in frames.
+	*/
+	static size_t get_latency (const double samplerate);
+
+	/**
+	Resets the modulation and clears the delay lines.
+	*/
+	void reset ();
+
+	/**
+	Sets a single parameter by its controller number. The value is limited
+	to the range of the controller.
+	@param nr		Controller number (BVibratrControllers).
+	@param value	Value.
+	*/
+	void set_controller (const int nr, const float value);
+
+	/**
+	Sets all parameters. Same as calling set_controller() for each
+	controller.
+	@param parameters	Parameters.
+	*/
+	void set_parameters (const BVibratrParameters& parameters);
+
+	/**
+	Processes a block of audio with MIDI messages. in and out may refer to
+	the same buffers.
+	@param in		Two input channels, n frames each.
+	@param out		Two output channels, n frames each.
+	@param n		Number of frames.
+	@param events	MIDI messages, sorted by frame. Messages at or after
+					the end of the block are applied at its end.
+	@param n_events	Number of MIDI messages.
+	*/
+	void process	(const float* const* in, float* const* out, const uint32_t n,
+					 const BVibratrEvent* events = nullptr, const uint32_t n_events = 0);
+
+	/**
+	Processes the frames start to end - 1 of a block without MIDI messages.
+	Use together with on_midi() to process a block in segments without
+	copying the messages. The modulation is computed immediately, but the
+	audio is processed in quanta of BVIBRATR_CHUNK_SIZE frames from the
+	start of the block (each as soon as it is complete). Thus, short
+	segments between dense MIDI messages don't split the audio processing.
+	Call finish() at the end of the block. The buffers must stay valid
+	until then.
+	@param in		Two input channels.
+	@param out		Two output channels.
+	@param start	First frame, the end of the last play() call of the
+					block (or 0).
+	@param end		Frame after the last frame.
+	*/
+	void play (const float* const* in, float* const* out, const uint32_t start, const uint32_t end);
+
+	/**
+	Processes the audio of the frames played but not processed yet (the
+	last quantum of a block). Call at the end of each block.
+	*/
+	void finish ();
+
+	/**
+	Applies a MIDI message at the current position.
+	@param msg	MIDI message (at least 3 bytes for note on, note off and
+				controller messages).
+	*/
+	void on_midi (const uint8_t* const msg);
+
+	/**
+	Proceeds the modulation by n frames without processing audio.
+	@param n	Number of frames.
+	*/
+	void advance (const uint32_t n);
+
+	/**
+	Proceeds the modulation for the frames start to end - 1 of a block
+	without processing audio and gets the mean pitch change of the vibrato
+	within these frames as rendered by the delay lines (from the slope of
+	the temporal shift). E.g., to send the vibrato as pitch bend instead.
+	Writes the CV outputs like play().
+	@param start	First frame.
+	@param end		Frame after the last frame, > start.
+	@return			Pitch change in semitones.
+	*/
+	double advance_pitch (const uint32_t start, const uint32_t end);
+
+	/**
+	Sets the (optional) CV outputs for the next blocks. play() and
+	advance_pitch() copy the modulation of each processed frame to the
+	respective frame of the connected outputs.
+	@param signal	Modulation signal (oscillators x envelope, range [-1.0,
+					1.0]) or nullptr.
+	@param amp		Tremolo gain or nullptr.
+	@param shift	Temporal shift of the delay lines in frames or nullptr.
+	*/
+	void set_cv_outputs (float* signal, float* amp, float* shift);
+
+	/**
+	Sets the (optional) external modulation for the next blocks. If set,
+	play() and advance_pitch() skip the oscillators and the ADSR and read
+	the modulation of each processed frame from the respective frame of the
+	inputs instead. The pitch signal is integrated to the temporal shift.
+	advance() always uses the oscillators.
+	@param pitch	Pitch signal, range [-1.0, 1.0] (1.0 = + depth) or
+					nullptr for none.
+	@param tremolo	Tremolo signal, range [-1.0, 1.0] (scaled by the
+					tremolo controller), or nullptr to use the pitch signal.
+	*/
+	void set_cv_inputs (const float* pitch, const float* tremolo);
+
+	/**
+	Joins a modulation group (see ModulationBus) or leaves the last group.
+	Publishes a block of the last group still rendered. Engines in a group
+	don't use the trajectory. Realtime safe.
+	@param bus	Bus of the group (see get_modulation_bus()) or nullptr to
+				leave.
+	*/
+	void set_modulation_bus (BVibratrModulationBus* bus);
+
+	/**
+	Prepares the next block (one per cycle) in a modulation group. The
+	first engine of the group in this cycle renders the block: It continues
+	the modulator state of the last rendering engine and publishes the
+	modulation of play() and advance_pitch() at the end of the block. The
+	other engines (with the same sample rate as the first engine of the
+	group) read the block in play() and advance_pitch() instead of running
+	the oscillators and the ADSR. All engines apply the modulation delayed
+	by offset frames. An engine which finds the block still being rendered
+	by another engine (or its frames not available) doesn't wait, but runs
+	its own oscillators and ADSR instead. Realtime safe. Call before play()
+	and advance_pitch() for each block.
+	@param n		Number of frames of the block.
+	@param offset	Delay of the modulation in frames (phase offset),
+					limited to MODULATIONBUS_SIZE / 2.
+	*/
+	void sync_modulation_bus (const uint32_t n, const uint32_t offset);
+
+	/**
+	Renders the modulation of the attack and decay phases after a note on
+	with the given controllers (see BVibratrTrajectory). Not realtime safe,
+	e.g., for a worker thread.
+	@param samplerate	Sample rate in Hz.
+	@param controllers	Controllers.
+	@return				New trajectory, to be deleted by the caller.
+	@throws std::bad_alloc.
+	*/
+	static BVibratrTrajectory* render_trajectory (const double samplerate, const BVibratrTrajectory::Controllers& controllers);
+
+	/**
+	Sets the trajectory for the next notes. A triggering note on uses the
+	trajectory instead of the oscillators and the ADSR if it matches the
+	sample rate, the controllers and the oscillator modes. Realtime safe.
+	@param trajectory	Trajectory or nullptr. Must not be deleted until
+						replaced.
+	@return				Last trajectory (not used anymore) or nullptr.
+	*/
+	const BVibratrTrajectory* set_trajectory (const BVibratrTrajectory* trajectory);
+
+	/**
+	Continues with the oscillators and the ADSR if the trajectory is in
+	use. Restores the last saved oscillator state of the trajectory and
+	proceeds the oscillators to the current position (up to
+	BVIBRATR_TRAJECTORY_STATE_INTERVAL frames). Called automatically on
+	note off and on changes of relevant controllers.
+	*/
+	void leave_trajectory ();
+
+	/**
+	Clears the delay lines, e.g., if the audio processing was paused
+	(advance() only). Doesn't change the modulation. Realtime safe, but
+	overwrites the whole delay lines.
+	*/
+	void clear_audio ();
+
+	/**
+	@return	Latency in frames.
+	*/
+	uint32_t get_latency () const;
+
+	/**
+	@return	Controllers.
+	*/
+	const BVibratrTrajectory::Controllers& get_controllers () const;
+
+	/**
+	@return	Current temporal shift in frames.
+	*/
+	float get_shift () const;
+
+	/**
+	@return	Current tremolo gain.
+	*/
+	float get_amp () const;
+
+	/**
+	@return	Current wet portion of the output (dry/wet and bypass).
+	*/
+	float get_mix () const;
+
+	/**
+	@return	ADSR phase: 0 = idle, 1 = attack, 2 = decay, 3 = sustain, 4 =
+			release.
+	*/
+	int32_t get_adsr_phase_nr () const;
+
+	/**
+	@return	MIDI channel (0 to 15) of the last note which triggered the
+			vibrato or -1 if none.
+	*/
+	int get_note_channel () const;
+
+	/**
+	@param nr	Oscillator 1, 2 or 3.
+	@return		Active mode (BVibratrOscModes) of the oscillator.
+	*/
+	int get_osc_mode (const int nr) const;
+
+	/**
+	Enables or disables tracking of the min. and max. temporal shift.
+	@param on	True to track.
+	*/
+	void track_shift_range (const bool on);
+
+	/**
+	Gets the min. and max. temporal shift (in frames) since the last
+	clear_shift_range().
+	@param min	Target for the min. shift.
+	@param max	Target for the max. shift.
+	*/
+	void get_shift_range (float& min, float& max) const;
+
+	void clear_shift_range ();
+
+	/**
+	Gets the modulation state after further t frames without MIDI messages
+	and parameter changes in O(1), e.g., for seeking or previews. Doesn't
+	change the modulation, but leaves the trajectory. The ADSR and the oscillators are proceeded in one
+	step each and thus only differ from frame by frame processing by
+	rounding. FM and PM routed to osc1 or osc2 can't be solved in closed
+	form. Their frequency modulation is ignored (and the mean frequency
+	used) and the result is marked as not exact. Use a BVibratrTimeline to
+	limit the error.
+	@param t	Time offset in frames.
+	@return		Modulation state.
+	*/
+	BVibratrModulationAt get_modulation_at (const uint64_t t);
+
+#ifdef BVIBRATR_CYCLE_STATS
+	CycleStats& get_cycle_stats ();
+	const CycleStats& get_cycle_stats () const;
+#endif
+
+#ifdef BVIBRATR_PROFILE
+	Profiler& get_profiler ();
+	const Profiler& get_profiler () const;
+#endif
+
+#ifdef BVIBRATR_CHECKPOINTS
+	/**
+	Saves the modulation state. Leaves the trajectory. Not realtime safe.
+	@return	New checkpoint, to be deleted by the caller.
+	*/
+	BVibratrCheckpoint* save_checkpoint ();
+
+	/**
+	Restores the modulation state of a checkpoint.
+	@param checkpoint	Checkpoint.
+	*/
+	void restore_checkpoint (const BVibratrCheckpoint& checkpoint);
+
+	/**
+	Gets the modulation state t frames after a checkpoint with the
+	parameters of this engine. See get_modulation_at (t).
+	@param checkpoint	Checkpoint.
+	@param t			Time offset in frames.
+	@return				Modulation state.
+	*/
+	BVibratrModulationAt get_modulation_at (const BVibratrCheckpoint& checkpoint, const uint64_t t) const;
+#endif
+
+private:
+	/**
+	Constructs the engine. Without an arena for the modulation only (e.g.,
+	to render a trajectory): No delay lines, don't call reset(), process()
+	or play() then.
+	@param samplerate	Sample rate in Hz.
+	@param memory		Pointer to the arena or nullptr.
+	@throws std::bad_alloc if the arena is exhausted.
+	*/
+	BVibratrEngine (const double samplerate, Arena* memory);
+
+	static size_t get_delay_line_size (const double samplerate);
+	static DelayLine<BVIBRATR_DELAY_SAMPLE> make_delay_line (const double samplerate, Arena* memory);
+
+	bool on_midi_note_on (const uint8_t channel, const uint8_t note, const uint8_t velocity);
+	void on_midi_note_off (const uint8_t channel, const uint8_t note, const uint8_t velocity);
+	void on_midi_cc (const uint8_t channel, const uint8_t cc, const uint8_t param);
+	void start_modulation ();
+	static void on_osc1_restart(LFO<double>& adsr, void* obj);
+	static void on_osc2_restart(LFO<double>& adsr, void* obj);
+	static void on_osc3_restart(LFO<double>& adsr, void* obj);
+	static void on_predicted_restart (LFO<double>& lfo, void* restarted);
+	void modulate_segment (const uint32_t i0, const uint32_t o, const uint32_t n);
+	void render_quantum ();
+	void modulate (const uint32_t o, const uint32_t n);
+	double get_amp_factor () const;
+	void oscillate (const double sample_time, const double amp_f, double& signal, double& integral);
+	void save_oscillators (BVibratrOscillatorState& state) const;
+	void restore_oscillators (const BVibratrOscillatorState& state);
+	void modulate_external (const uint32_t i0, const uint32_t o, const uint32_t n);
+	bool read_modulation_bus (const uint32_t o, const uint32_t n);
+	void render_modulation_bus (const uint32_t o, const uint32_t n);
+	void publish_modulation_bus ();
+	void write_cv (const uint32_t i0, const uint32_t o, const uint32_t n);
+	BVibratrModulationAt predict	(const ADSR<double>& adsr, const LFO<double>& osc1, const LFO<double>& osc2, const LFO<double>& osc3,
+									 const int osc1_mode, const int osc2_mode, const int osc3_mode, const uint64_t t) const;
+
+	// Hot data first: Accessed for each sample
+
+	// Controllers
+	alignas(64) std::array<float, BVIBRATR_NR_CONTROLLERS> controllers;
+
+	// Internals
+	double rate;
+	double depth;
+	double depth_cc;
+	size_t buffer_offset;					// Also the max. temporal shift
+	LinearFader<double> shift;				// Temporal shift (vibrato)
+	LinearFader<float> amp;					// Volume change (tremolo)
+	LinearFader<float> mix;					// Mix for change in dry/wet and bypass
+	int osc1_mode, osc2_mode, osc3_mode;	// TODO Schedule change
+	uint8_t note;							// Last NOTE_ON note (or >= 0x80 for none)
+	uint8_t note_channel;					// Channel of the last NOTE_ON (or >= 0x80 for none)
+	const Kernels* kernels;
+	DelayLine<BVIBRATR_DELAY_SAMPLE> buffer_1;
+	DelayLine<BVIBRATR_DELAY_SAMPLE> buffer_2;
+	bool buffers_used;						// Delay lines contain data since the last reset()
+	ADSR<double> adsr;
+	LFO<double> osc1, osc2, osc3;
+
+	// Precomputed attack and decay
+	const BVibratrTrajectory* trajectory;
+	bool trajectory_active;					// Modulation read from the trajectory
+	uint32_t trajectory_frame;				// Next frame to read
+
+	// Block processing
+	alignas(64) std::array<float, BVIBRATR_CHUNK_SIZE> delay_buffer;	// Modulation output: buffer_offset + shift (truncated)
+	alignas(64) std::array<float, BVIBRATR_CHUNK_SIZE> amp_buffer;	// Modulation output: amp
+	alignas(64) std::array<float, BVIBRATR_CHUNK_SIZE> mix_buffer;	// Modulation output: mix
+	alignas(64) std::array<float, BVIBRATR_CHUNK_SIZE> signal_buffer;	// Modulation output: signal (CV only)
+	alignas(64) std::array<float, BVIBRATR_CHUNK_SIZE> shift_buffer;	// Modulation output: shift (CV only)
+	alignas(64) std::array<float, BVIBRATR_CHUNK_SIZE> dry_buffer;
+	alignas(64) std::array<float, BVIBRATR_CHUNK_SIZE> wet_buffer;
+
+	// Audio quantum: The modulation of the frames quantum_start to
+	// quantum_end - 1 of the block is in the buffers, the audio is pending
+	const float* quantum_in[2];
+	float* quantum_out[2];
+	uint32_t quantum_start;
+	uint32_t quantum_end;
+
+	// Optional CV inputs and outputs
+	const float* cv_pitch;
+	const float* cv_tremolo;
+	float* cv_signal;
+	float* cv_amp;
+	float* cv_shift;
+
+	// Optional modulation group
+	BVibratrModulationBus* bus;
+	bool bus_follow;						// Read the modulation from the bus in this block
+	bool bus_render;						// Render and publish the block of this cycle
+	uint64_t bus_cycle;						// Last consumed cycle of the group
+	int64_t bus_position;					// Next frame to read (without offset)
+	uint32_t bus_offset;					// Frames
+	uint32_t bus_remaining;					// Frames to render until publishing
+
+	// Cold data
+
+	// Shift range for monitoring
+	bool shift_tracked;
+	float shift_min;						// Frames
+	float shift_max;						// Frames
+
+#ifdef BVIBRATR_CYCLE_STATS
+	CycleStats cycle_stats;
+#endif
+
+#ifdef BVIBRATR_PROFILE
+	Profiler profiler;
+#endif
+
+	// Memory of the delay lines
+	Arena* arena;
+};
+
+inline BVibratrEngine::BVibratrEngine (const double samplerate, Arena& memory) : BVibratrEngine (samplerate, &memory) {}
+
+inline BVibratrEngine::BVibratrEngine (const double samplerate, Arena* memory) :
+	rate (samplerate),
+	depth(0.0),
+	depth_cc (1.0),
+	buffer_offset(get_latency (samplerate)),
+	shift(0.0, (SQRT_12_2 - 1.0)),	// Limit temporal shift to 1 semitone
+	amp(1.0f, 0.001f),
+	mix(0.0f, 0.001f),
+	osc1_mode(0),
+	osc2_mode(0),
+	osc3_mode(0),
+	note(0xFF),
+	note_channel(0xFF),
+	kernels(&get_kernels()),
+	buffer_1(make_delay_line (samplerate, memory)),
+	buffer_2(make_delay_line (samplerate, memory)),
+	buffers_used(false),
+	adsr(0, 0, 1, 0, ADSR<double>::INVSQR),
+	osc1(),
+	osc2(),
+	osc3(),
+	trajectory (nullptr),
+	trajectory_active (false),
+	trajectory_frame (0),
+	quantum_in {nullptr, nullptr},
+	quantum_out {nullptr, nullptr},
+	quantum_start (0),
+	quantum_end (0),
+	cv_pitch (nullptr),
+	cv_tremolo (nullptr),
+	cv_signal (nullptr),
+	cv_amp (nullptr),
+	cv_shift (nullptr),
+	bus (nullptr),
+	bus_follow (false),
+	bus_render (false),
+	bus_cycle (0),
+	bus_position (0),
+	bus_offset (0),
+	bus_remaining (0),
+	shift_tracked (false),
+	shift_min (0.0f),
+	shift_max (0.0f),
+	arena (memory)
+{
+	controllers.fill(0.0f);
+
+	// Buffers don't need to be initialized. The arena provides zero pages.
+
+	osc1.setCallbackFunction(LFO<double>::PHASE_RESTART, &on_osc1_restart, this);
+	osc2.setCallbackFunction(LFO<double>::PHASE_RESTART, &on_osc2_restart, this);
+	osc3.setCallbackFunction(LFO<double>::PHASE_RESTART, &on_osc3_restart, this);
+}
+
+inline BVibratrEngine::~BVibratrEngine () {set_modulation_bus (nullptr);}
+
+inline size_t BVibratrEngine::get_latency (const double samplerate)
+{
+	return	(SQRT_12_2 - 1.0) *	// Up to 1 semitone
+			samplerate;			// Up to 1 second phase length
+}
+
+inline size_t BVibratrEngine::get_delay_line_size (const double samplerate)
+{
+	// The delay reaches from buffer_offset - max. shift (0) to buffer_offset
+	// + max. shift. And a whole chunk is written before reading.
+	const size_t need = 2 * get_latency (samplerate) + 1 + BVIBRATR_CHUNK_SIZE;
+	size_t size = 1;
+	while (size < need) size <<= 1;
+	return size;
+}
+
+inline DelayLine<BVIBRATR_DELAY_SAMPLE> BVibratrEngine::make_delay_line (const double samplerate, Arena* memory)
+{
+	if (!memory) return DelayLine<BVIBRATR_DELAY_SAMPLE> ();
+	const size_t size = get_delay_line_size (samplerate);
+	return DelayLine<BVIBRATR_DELAY_SAMPLE> (memory->allocate<BVIBRATR_DELAY_SAMPLE> (size), size);
+}
+
+inline size_t BVibratrEngine::arena_size (const double samplerate)
+{
+	return 2 * Arena::required<BVIBRATR_DELAY_SAMPLE> (get_delay_line_size (samplerate));
+}
+
+inline void BVibratrEngine::reset ()
+{
+	// Reset modulation
+	adsr.stop();
+	osc1.stop();
+	osc2.stop();
+	osc3.stop();
+	trajectory_active = false;
+	quantum_start = 0;
+	quantum_end = 0;
+	note = 0xFF;
+	note_channel = 0xFF;
+	shift = LinearFader<double>(0.0, (SQRT_12_2 - 1.0));
+	amp = LinearFader<float>(1.0f, 0.001f);
+	mix = LinearFader<float>(0.0f, 0.001f);
+
+	// Clear delay lines only if used. Let the OS provide new zero pages
+	// instead of overwriting the whole buffers.
+	if (buffers_used)
+	{
+		arena->zero (buffer_1.data(), buffer_1.size() * sizeof (BVIBRATR_DELAY_SAMPLE));
+		arena->zero (buffer_2.data(), buffer_2.size() * sizeof (BVIBRATR_DELAY_SAMPLE));
+		buffers_used = false;
+	}
+
+	clear_shift_range ();
+}
+
+inline void BVibratrEngine::clear_audio ()
+{
+	// Overwrite instead of arena->zero(): No system calls and no page faults
+	// on the next write
+	if (buffers_used)
+	{
+		std::fill (buffer_1.data(), buffer_1.data() + buffer_1.size(), BVIBRATR_DELAY_SAMPLE (0));
+		std::fill (buffer_2.data(), buffer_2.data() + buffer_2.size(), BVIBRATR_DELAY_SAMPLE (0));
+		buffers_used = false;
+	}
+}
+
+inline void BVibratrEngine::set_controller (const int nr, const float value)
+{
+	if ((nr < 0) || (nr >= BVIBRATR_NR_CONTROLLERS)) return;
+
+	const float v = controller_limits[nr].validate(value);
+
+	// The live oscillators have to catch up with the trajectory before
+	// they are changed
+	if (trajectory_active && (v != controllers[nr]) && BVibratrTrajectory::is_relevant (nr)) leave_trajectory ();
+
+	controllers[nr] = v;
+	switch (nr)
+	{
+		case BVIBRATR_BYPASS:
+		case BVIBRATR_DRY_WET:
+			mix.set((1.0f - controllers[BVIBRATR_BYPASS]) * controllers[BVIBRATR_DRY_WET]);
+			break;
+
+		case BVIBRATR_DEPTH_IS_CC:
+			depth =	((v == 128) ? (0.01 /* cents */ * controllers[BVIBRATR_DEPTH]) : depth_cc);
+			break;
+
+		case BVIBRATR_DEPTH:
+			if (controllers[BVIBRATR_DEPTH_IS_CC] == 128) depth = 0.01 /* cents */ * v;
+			break;
+
+		case BVIBRATR_OSC1_WAVEFORM:
+			osc1.set_waveform(static_cast<LFO<double>::Waveform>(v));
+			break;
+
+		case BVIBRATR_OSC2_WAVEFORM:
+			osc2.set_waveform(static_cast<LFO<double>::Waveform>(v));
+			break;
+
+		case BVIBRATR_OSC3_WAVEFORM:
+			osc3.set_waveform(static_cast<LFO<double>::Waveform>(v));
+			break;
+
+		default:
+			break;
+	}
+}
+
+inline void BVibratrEngine::set_parameters (const BVibratrParameters& parameters)
+{
+	// In the order of the controllers
+	const std::array<float, BVIBRATR_NR_CONTROLLERS> values =
+	{{
+		(parameters.bypass ? 1.0f : 0.0f),
+		parameters.dry_wet,
+		static_cast<float>(parameters.trigger_channels),
+		static_cast<float>(parameters.trigger_note),
+		static_cast<float>(parameters.depth_is_cc),
+		parameters.depth,
+		parameters.depth_attack,
+		parameters.depth_decay,
+		parameters.depth_sustain,
+		parameters.depth_release,
+		parameters.osc1_frequency,
+		static_cast<float>(parameters.osc1_mode),
+		static_cast<float>(parameters.osc1_waveform),
+		parameters.osc2_amp,
+		parameters.osc2_frequency,
+		static_cast<float>(parameters.osc2_mode),
+		static_cast<float>(parameters.osc2_waveform),
+		parameters.osc3_amp,
+		parameters.osc3_frequency,
+		static_cast<float>(parameters.osc3_mode),
+		static_cast<float>(parameters.osc3_waveform),
+		parameters.tremolo
+	}};
+
+	for (int i = 0; i < BVIBRATR_NR_CONTROLLERS; ++i) set_controller (i, values[i]);
+}
+
+inline void BVibratrEngine::process (const float* const* in, float* const* out, const uint32_t n, const BVibratrEvent* events, const uint32_t n_events)
+{
+	uint32_t last_frame = 0;
+	for (uint32_t i = 0; i < n_events; ++i)
+	{
+		const uint32_t frame = std::min (events[i].frame, n);
+		play (in, out, last_frame, frame);
+		last_frame = std::max (last_frame, frame);
+		on_midi (events[i].msg);
+	}
+	play (in, out, last_frame, n);
+	finish ();
+}
+
+inline void BVibratrEngine::play (const float* const* in, float* const* out, const uint32_t start, const uint32_t end)
+{
+#ifdef BVIBRATR_CYCLE_STATS
+	const uint64_t play_start = CycleStats::now();
+#endif
+
+	// Not adjacent to the pending frames (e.g., a new block without
+	// finish())
+	if (start != quantum_end)
+	{
+		finish ();
+		quantum_start = start;
+		quantum_end = start;
+	}
+
+	quantum_in[0] = in[0];
+	quantum_in[1] = in[1];
+	quantum_out[0] = out[0];
+	quantum_out[1] = out[1];
+
+	// Modulation up to the end of the quantum, then the audio of the whole
+	// quantum
+	for (uint32_t i0 = start; i0 < end; )
+	{
+		const uint32_t n = std::min<uint32_t> (end - i0, quantum_start + BVIBRATR_CHUNK_SIZE - i0);
+		modulate_segment (i0, i0 - quantum_start, n);
+		i0 += n;
+		quantum_end = i0;
+		if (quantum_end - quantum_start == BVIBRATR_CHUNK_SIZE) render_quantum ();
+	}
+
+#ifdef BVIBRATR_CYCLE_STATS
+	if (end > start) cycle_stats.add_play (CycleStats::now() - play_start, end - start, get_adsr_phase_nr());
+#endif
+}
+
+inline void BVibratrEngine::finish ()
+{
+	if (quantum_end > quantum_start) render_quantum ();
+	quantum_start = 0;
+	quantum_end = 0;
+}
+
+inline void BVibratrEngine::modulate_segment (const uint32_t i0, const uint32_t o, const uint32_t n)
+{
+	// Own modulator if the frames of the group are not available
+	if (!bus_follow || !read_modulation_bus (o, n))
+	{
+		if (cv_pitch || cv_tremolo) modulate_external (i0, o, n);
+		else modulate (o, n);
+	}
+	if (bus_render) render_modulation_bus (o, n);
+	write_cv (i0, o, n);
+}
+
+inline void BVibratrEngine::render_quantum ()
+{
+	const uint32_t i0 = quantum_start;
+	const uint32_t n = quantum_end - quantum_start;
+
+	// Audio input. Write both channels before output as in and out
+	// buffers may be shared. Writing a whole chunk before reading is
+	// safe as long as the delay lines are larger than the max. delay
+	// plus BVIBRATR_CHUNK_SIZE.
+	const size_t mask_1 = buffer_1.mask();
+	const size_t mask_2 = buffer_2.mask();
+	const size_t pos_1 = buffer_1.front_index();
+	const size_t pos_2 = buffer_2.front_index();
+	BVIBRATR_PROFILE_BEGIN (PROFILE_DELAY_WRITE);
+	kernels->BVIBRATR_DELAY_WRITE (buffer_1.data(), mask_1, pos_1, quantum_in[0] + i0, n);
+	kernels->BVIBRATR_DELAY_WRITE (buffer_2.data(), mask_2, pos_2, quantum_in[1] + i0, n);
+	BVIBRATR_PROFILE_END (PROFILE_DELAY_WRITE);
+	buffer_1.move (n);
+	buffer_2.move (n);
+	buffers_used = true;
+
+	// Audio output
+	BVIBRATR_PROFILE_BEGIN (PROFILE_DELAY_READ);
+	kernels->BVIBRATR_DELAY_READ_FIXED (buffer_1.data(), mask_1, pos_1, buffer_offset, dry_buffer.data(), n);
+	kernels->BVIBRATR_DELAY_READ (buffer_1.data(), mask_1, pos_1, delay_buffer.data(), wet_buffer.data(), n);
+	BVIBRATR_PROFILE_END (PROFILE_DELAY_READ);
+	BVIBRATR_PROFILE_BEGIN (PROFILE_MIX);
+	kernels->mix (dry_buffer.data(), wet_buffer.data(), amp_buffer.data(), mix_buffer.data(), quantum_out[0] + i0, n);
+	BVIBRATR_PROFILE_END (PROFILE_MIX);
+	BVIBRATR_PROFILE_BEGIN (PROFILE_DELAY_READ);
+	kernels->BVIBRATR_DELAY_READ_FIXED (buffer_2.data(), mask_2, pos_2, buffer_offset, dry_buffer.data(), n);
+	kernels->BVIBRATR_DELAY_READ (buffer_2.data(), mask_2, pos_2, delay_buffer.data(), wet_buffer.data(), n);
+	BVIBRATR_PROFILE_END (PROFILE_DELAY_READ);
+	BVIBRATR_PROFILE_BEGIN (PROFILE_MIX);
+	kernels->mix (dry_buffer.data(), wet_buffer.data(), amp_buffer.data(), mix_buffer.data(), quantum_out[1] + i0, n);
+	BVIBRATR_PROFILE_END (PROFILE_MIX);
+
+	// Shift range for monitoring
+	if (shift_tracked)
+	{
+		const auto range = std::minmax_element (delay_buffer.begin(), delay_buffer.begin() + n);
+		shift_min = std::min<float> (shift_min, *range.first - static_cast<float>(buffer_offset));
+		shift_max = std::max<float> (shift_max, *range.second - static_cast<float>(buffer_offset));
+	}
+
+	quantum_start = quantum_end;
+}
+
+inline void BVibratrEngine::advance (const uint32_t n)
+{
+	finish ();
+	for (uint32_t i0 = 0; i0 < n; i0 += BVIBRATR_CHUNK_SIZE) modulate (0, std::min<uint32_t> (n - i0, BVIBRATR_CHUNK_SIZE));
+}
+
+inline double BVibratrEngine::advance_pitch (const uint32_t start, const uint32_t end)
+{
+	// The delay lines are read at the position buffer_offset + shift behind
+	// the write position. Thus, the read position proceeds by 1 - d(shift)
+	// per frame.
+	finish ();
+	const double shift_start = shift.get();
+	for (uint32_t i0 = start; i0 < end; i0 += BVIBRATR_CHUNK_SIZE) modulate_segment (i0, 0, std::min<uint32_t> (end - i0, BVIBRATR_CHUNK_SIZE));
+	const double ratio = 1.0 - (shift.get() - shift_start) / std::max<uint32_t> (end - start, 1);
+	return 12.0 * std::log2 (ratio);
+}
+
+inline bool BVibratrEngine::on_midi_note_on (const uint8_t channel, const uint8_t note, const uint8_t velocity)
+{
+	if (static_cast<uint16_t>(controllers[BVIBRATR_MIDI_CHANNEL]) & (1 << channel))
+	{
+		if ((controllers[BVIBRATR_MIDI_NOTE] == note) || (controllers[BVIBRATR_MIDI_NOTE] == 128))
+		{
+			start_modulation();
+
+			// Read the attack and decay from the trajectory if it was
+			// rendered with the same settings. The oscillators and the
+			// ADSR just started and thus have the state of its start.
+			trajectory_active =	!bus && trajectory && trajectory->matches (rate, controllers) &&
+								(osc1_mode == controllers[BVIBRATR_OSC1_MODE]) &&
+								(osc2_mode == controllers[BVIBRATR_OSC2_MODE]) &&
+								(osc3_mode == controllers[BVIBRATR_OSC3_MODE]);
+			trajectory_frame = 0;
+
+			this->note = note;
+			return true;
+		}
+	}
+	return false;
+}
+
+inline void BVibratrEngine::start_modulation ()
+{
+	adsr.set_parameters	(controllers[BVIBRATR_DEPTH_ATTACK],
+						 controllers[BVIBRATR_DEPTH_DECAY],
+						 controllers[BVIBRATR_DEPTH_SUSTAIN],
+						 controllers[BVIBRATR_DEPTH_RELEASE]);
+
+	osc1.set_waveform(static_cast<LFO<double>::Waveform>(controllers[BVIBRATR_OSC1_WAVEFORM]));
+	osc1.set_frequency(controllers[BVIBRATR_OSC1_FREQ]);
+	osc2.set_waveform(static_cast<LFO<double>::Waveform>(controllers[BVIBRATR_OSC2_WAVEFORM]));
+	osc2.set_frequency(controllers[BVIBRATR_OSC2_FREQ]);
+	osc3.set_waveform(static_cast<LFO<double>::Waveform>(controllers[BVIBRATR_OSC3_WAVEFORM]));
+	osc3.set_frequency(controllers[BVIBRATR_OSC3_FREQ]);
+
+	adsr.start();
+	osc1.start();
+	osc2.start();
+	osc3.start();
+}
+
+inline void BVibratrEngine::on_midi_note_off (const uint8_t channel, const uint8_t note, const uint8_t velocity)
+{
+	if (static_cast<uint16_t>(controllers[BVIBRATR_MIDI_CHANNEL]) & (1 << channel))
+	{
+		if (this->note == note)
+		{
+			leave_trajectory();
+			adsr.release();
+			this->note = 0xFF;
+		}
+	}
+}
+
+inline void BVibratrEngine::on_midi_cc (const uint8_t channel, const uint8_t cc, const uint8_t param)
+{
+	if ((static_cast<uint16_t>(controllers[BVIBRATR_MIDI_CHANNEL]) & (1 << channel)) or
+	    (controllers[BVIBRATR_MIDI_CHANNEL] == 0.0f))
+	{
+		switch (cc)
+		{
+			case 0x7B:	// All notes off
+				on_midi_note_off	(channel,
+									 static_cast<uint8_t>(controllers[BVIBRATR_MIDI_NOTE]),
+									 0);
+				break;
+
+			case 0x78:	// All sounds off
+				on_midi_note_off	(channel,
+									 static_cast<uint8_t>(controllers[BVIBRATR_MIDI_NOTE]),
+									 0);
+				leave_trajectory();
+				osc1.stop();
+				osc2.stop();
+				osc3.stop();
+				break;
+
+			default:
+				{
+					if ((controllers[BVIBRATR_DEPTH_IS_CC] != 128) &&
+						(cc == controllers[BVIBRATR_DEPTH_IS_CC]))
+					{
+						depth_cc = static_cast<double>(param) / 127.0;
+						depth = 0.01 /* cents */ * controller_limits[BVIBRATR_DEPTH].max * depth_cc;
+					}
+				}
+		}
+	}
+
+}
+
+inline void BVibratrEngine::on_midi (const uint8_t* const msg)
+{
+	BVIBRATR_PROFILE_ZONE (PROFILE_MIDI);
+
+	// Message type as provided by lv2_midi_message_type(): Status without
+	// channel for channel messages, status for system messages, 0 for data
+	const uint8_t typ = ((msg[0] & 0x80) ? ((msg[0] < 0xF0) ? (msg[0] & 0xF0) : msg[0]) : 0);
+	const uint8_t status = typ & 0xf0;
+	const uint8_t channel = typ & 0x0f;
+
+	switch (status)
+	{
+		case 0x90:	// Keep the channel of the message for MPE
+					if (on_midi_note_on(channel, msg[1], msg[2])) note_channel = msg[0] & 0x0F;
+					break;
+
+		case 0x80:	on_midi_note_off(channel, msg[1], msg[2]);
+					break;
+
+		case 0xB0:	on_midi_cc(channel, msg[1], msg[2]);
+					break;
+		default: break;
+	}
+
+}
+
+inline void BVibratrEngine::on_osc1_restart(LFO<double>& adsr, void* obj)
+{
+	BVibratrEngine* engine = static_cast<BVibratrEngine*>(obj);
+	engine->osc1_mode = engine->controllers[BVIBRATR_OSC1_MODE];
+}
+
+inline void BVibratrEngine::on_osc2_restart(LFO<double>& adsr, void* obj)
+{
+	BVibratrEngine* engine = static_cast<BVibratrEngine*>(obj);
+	engine->osc2_mode = engine->controllers[BVIBRATR_OSC2_MODE];
+}
+
+inline void BVibratrEngine::on_osc3_restart(LFO<double>& adsr, void* obj)
+{
+	BVibratrEngine* engine = static_cast<BVibratrEngine*>(obj);
+	engine->osc3_mode = engine->controllers[BVIBRATR_OSC3_MODE];
+}
+
+inline void BVibratrEngine::modulate (const uint32_t o, const uint32_t n)
+{
+	BVIBRATR_PROFILE_ZONE (PROFILE_MODULATION);
+	const double sample_time = 1.0 / rate;
+
+	const double amp_f = get_amp_factor ();
+
+	for (uint32_t i = o; i < o + n; ++i)
+	{
+		double signal = 0.0;		// To be used for tremolo (amp)
+		double integral = 0.0;		// To be used for vibrato (shift)
+
+		// Set modes if adsr (and thus all lfos) is stopped
+		if (!adsr.is_active())
+		{
+			osc1_mode = controllers[BVIBRATR_OSC1_MODE];
+			osc2_mode = controllers[BVIBRATR_OSC2_MODE];
+			osc3_mode = controllers[BVIBRATR_OSC3_MODE];
+		}
+
+		// Attack and decay from the trajectory
+		else if (trajectory_active && (trajectory_frame < trajectory->size()))
+		{
+			trajectory->get (trajectory_frame, signal, integral);
+			++trajectory_frame;
+		}
+
+		// Only run oscillators if adsr is active
+		else
+		{
+			// Continue live at the end of the trajectory
+			if (trajectory_active) leave_trajectory();
+			oscillate (sample_time, amp_f, signal, integral);
+		}
+
+		// Vibrato depth
+		integral *= depth;
+		const double max_shift = buffer_offset;
+		shift.set(std::max(-max_shift, std::min((SQRT_12_2 - 1.0) * integral, max_shift)));
+
+		// ... and tremolo
+		// Send signal * controller to fader to prevent clicks on square waves
+		const double tremolo  = controllers[BVIBRATR_TREMOLO] * signal;
+		amp.set(1.0 - tremolo);
+
+		// Proceed dry/wet mix
+		mix.proceed();
+
+		// Store for block processing
+		delay_buffer[i] = static_cast<long> (buffer_offset + shift.get());
+		amp_buffer[i] = amp.get();
+		mix_buffer[i] = mix.get();
+		signal_buffer[i] = signal;
+		shift_buffer[i] = shift.get();
+	}
+}
+
+inline double BVibratrEngine::get_amp_factor () const
+{
+	// Sum of the amplitudes of the added oscillators
+	return	1.0 +	((controllers[BVIBRATR_OSC2_MODE] == BVIBRATR_OSC_MODE_ADD) ? controllers[BVIBRATR_OSC2_AMP] : 0.0) +
+					((controllers[BVIBRATR_OSC3_MODE] == BVIBRATR_OSC_MODE_ADD) ? controllers[BVIBRATR_OSC3_AMP] : 0.0);
+}
+
+inline void BVibratrEngine::oscillate (const double sample_time, const double amp_f, double& signal, double& integral)
+{
+	// Oscillator settings
+	const double osc1_freq = controllers[BVIBRATR_OSC1_FREQ];
+	const double osc2_amp = controllers[BVIBRATR_OSC2_AMP];
+	const double osc2_freq = controllers[BVIBRATR_OSC2_FREQ];
+	const double osc3_amp = controllers[BVIBRATR_OSC3_AMP];
+	const double osc3_freq = controllers[BVIBRATR_OSC3_FREQ];
+
+	BVIBRATR_PROFILE_BEGIN (PROFILE_OSCILLATORS);
+
+	// Modulators
+	double osc1_freq_m = 1.0;	// Frequency multiplier, range [0.0, 2.0]
+	double osc1_phase_d = 0.0;	// Phase delta, range [-1.0, 1.0]
+	double osc1_amp_m = 1.0;	// Amplification multiplier, range [0.0, 1.0]
+
+	double osc2_freq_m = 1.0;
+	double osc2_phase_d = 0.0;
+	double osc2_amp_m = 1.0;
+
+	// Run osc3
+	osc3.set_frequency(osc3_freq);
+	osc3.run(sample_time);
+
+	switch(osc3_mode)
+	{
+		case BVIBRATR_OSC_MODE_ADD:
+			signal += osc3_amp * osc3.get_value();
+			integral += osc3_amp * osc3.get_integral() * rate / osc3_freq;
+			break;
+
+		case BVIBRATR_OSC_MODE_FM1:
+			osc1_freq_m *= (1.0 - osc3_amp * osc3.get_value());
+			break;
+
+		case BVIBRATR_OSC_MODE_PM1:
+			osc1_phase_d += osc3_amp * osc3.get_value();
+			break;
+
+		case BVIBRATR_OSC_MODE_AM1:
+			osc1_amp_m *= (1.0 - 0.5 * osc3_amp * (1.0 + osc3.get_value()));
+			break;
+
+		case BVIBRATR_OSC_MODE_FM2:
+			osc2_freq_m *= (1.0 - osc3_amp * osc3.get_value());
+			break;
+
+		case BVIBRATR_OSC_MODE_PM2:
+			osc2_phase_d += osc3_amp * osc3.get_value();
+			break;
+
+		case BVIBRATR_OSC_MODE_AM2:
+			osc2_amp_m *= (1.0 - 0.5 * osc3_amp * (1.0 + osc3.get_value()));
+			break;
+
+		default:
+			break;
+	}
+
+	// Run osc2
+	osc2.set_frequency(osc2_freq_m * osc2_freq);
+	osc1.set_phase_shift(osc2_phase_d);
+	osc2.run(sample_time);
+
+	switch(osc2_mode)
+	{
+		case BVIBRATR_OSC_MODE_ADD:
+			signal += osc2_amp_m * osc2_amp * osc2.get_value();
+			integral += osc2_amp_m * osc2_amp * osc2.get_integral() * rate / osc2_freq;
+			break;
+
+		case BVIBRATR_OSC_MODE_FM1:
+			osc1_freq_m *= (1.0 - osc2_amp_m * osc2_amp * osc2.get_value());
+			break;
+
+		case BVIBRATR_OSC_MODE_PM1:
+			osc1_phase_d += osc2_amp_m * osc2_amp * osc2.get_value();
+			break;
+
+		case BVIBRATR_OSC_MODE_AM1:
+			osc1_amp_m *= (1.0 - 0.5 * osc2_amp_m * osc2_amp * (1.0 + osc2.get_value()));
+			break;
+
+		default:
+			break;
+	}
+
+	// Run osc1
+	if (osc1_mode == BVIBRATR_OSC_MODE_LFO)
+	{
+		osc1.set_frequency(osc1_freq_m * osc1_freq);
+		osc1.set_phase_shift(osc1_phase_d);
+		osc1.run(sample_time);
+		signal += osc1_amp_m * osc1.get_value();
+		integral += osc1_amp_m * osc1.get_integral() * rate / osc1_freq;
+	}
+
+	else /* BVIBRATR_OSC_MODE_USER */
+	{}
+
+	// Scale signal and integral to not exceed 1.0
+	signal /= amp_f;
+	integral /= amp_f;
+	BVIBRATR_PROFILE_END (PROFILE_OSCILLATORS);
+
+	// Apply adsr
+	BVIBRATR_PROFILE_BEGIN (PROFILE_ADSR);
+	adsr.run(sample_time);
+	signal *= adsr.get_value();
+	integral *= adsr.get_value();
+	BVIBRATR_PROFILE_END (PROFILE_ADSR);
+}
+
+inline void BVibratrEngine::set_cv_outputs (float* signal, float* amp, float* shift)
+{
+	cv_signal = signal;
+	cv_amp = amp;
+	cv_shift = shift;
+}
+
+inline void BVibratrEngine::set_cv_inputs (const float* pitch, const float* tremolo)
+{
+	cv_pitch = pitch;
+	cv_tremolo = tremolo;
+}
+
+inline void BVibratrEngine::modulate_external (const uint32_t i0, const uint32_t o, const uint32_t n)
+{
+	BVIBRATR_PROFILE_ZONE (PROFILE_MODULATION);
+
+	// Pitch signal to shift. The delay lines are read with a rate of 1 -
+	// d(shift) per frame, thus a positive signal has to decrease the shift.
+	// The slope is limited to (SQRT_12_2 - 1.0) * depth, thus the shift
+	// fader can be set directly.
+	double sh = shift.get();
+	kernels->modulate_external	((cv_pitch ? cv_pitch + i0 : nullptr), (cv_tremolo ? cv_tremolo + i0 : nullptr),
+								 -(SQRT_12_2 - 1.0) * depth, controllers[BVIBRATR_TREMOLO], buffer_offset, buffer_offset, sh,
+								 signal_buffer.data() + o, shift_buffer.data() + o, delay_buffer.data() + o, amp_buffer.data() + o, n);
+	shift = LinearFader<double>(sh, (SQRT_12_2 - 1.0));
+	if (n) amp = LinearFader<float>(amp_buffer[o + n - 1], 0.001f);
+
+	// Proceed dry/wet mix
+	for (uint32_t i = o; i < o + n; ++i)
+	{
+		mix.proceed();
+		mix_buffer[i] = mix.get();
+	}
+}
+
+inline void BVibratrEngine::set_modulation_bus (BVibratrModulationBus* bus)
+{
+	if (bus == this->bus) return;
+	if (this->bus)
+	{
+		if (bus_render) publish_modulation_bus ();
+		this->bus->leave ();
+	}
+
+	this->bus = bus;
+	bus_follow = false;
+	bus_render = false;
+	if (bus)
+	{
+		leave_trajectory ();
+		bus_cycle = bus->join (rate);
+	}
+}
+
+inline void BVibratrEngine::sync_modulation_bus (const uint32_t n, const uint32_t offset)
+{
+	// Publish the rest of an incomplete block
+	if (bus_render) publish_modulation_bus ();
+
+	bus_follow = false;
+	if (!bus || (bus->get_samplerate () != rate)) return;
+
+	bus_offset = std::min<uint32_t> (offset, MODULATIONBUS_SIZE / 2);
+	int64_t end = 0;
+	switch (bus->begin (bus_cycle, end))
+	{
+		case BVibratrModulationBus::READ:
+			bus_follow = true;
+			bus_position = end - n;
+			break;
+
+		case BVibratrModulationBus::RENDER:
+			// Continue the modulator of the last rendering engine
+			if (bus->has_state () && (bus->get_state ().owner != this))
+			{
+				const BVibratrModulatorState& state = bus->get_state ();
+				restore_oscillators (state.oscillators);
+				shift = state.shift;
+				amp = state.amp;
+			}
+			bus_render = true;
+			bus_position = end;
+			bus_remaining = n;
+			if (n == 0) publish_modulation_bus ();
+			break;
+
+		// Another engine is still rendering this block: Don't wait. Read
+		// the delayed frames if already published. Otherwise render the
+		// block with the own modulator from the same state (if available,
+		// without the offset).
+		default:
+			if (bus_offset >= n)
+			{
+				bus_follow = true;
+				bus_position = end;
+				break;
+			}
+
+			BVibratrModulatorState state;
+			if (bus->copy_state (bus_cycle, state) && (state.owner != this))
+			{
+				restore_oscillators (state.oscillators);
+				shift = state.shift;
+				amp = state.amp;
+			}
+	}
+}
+
+inline bool BVibratrEngine::read_modulation_bus (const uint32_t o, const uint32_t n)
+{
+	BVIBRATR_PROFILE_ZONE (PROFILE_MODULATION);
+
+	const int64_t position = bus_position - bus_offset;
+	bus_position += n;
+	if (!bus->read (position, n, shift_buffer.data() + o, amp_buffer.data() + o, signal_buffer.data() + o, delay_buffer.data() + o)) return false;
+
+	// Delay as applied by the rendering engine (same latency)
+	for (uint32_t i = o; i < o + n; ++i)
+	{
+		delay_buffer[i] += buffer_offset;
+		mix.proceed();
+		mix_buffer[i] = mix.get();
+	}
+
+	if (n)
+	{
+		shift = LinearFader<double>(shift_buffer[o + n - 1], (SQRT_12_2 - 1.0));
+		amp = LinearFader<float>(amp_buffer[o + n - 1], 0.001f);
+	}
+	return true;
+}
+
+inline void BVibratrEngine::render_modulation_bus (const uint32_t o, const uint32_t n)
+{
+	// Publish the delay relative to the latency (the integer part of the
+	// unrounded shift). Followers add their (same) latency.
+	for (uint32_t i = o; i < o + n; ++i) delay_buffer[i] -= buffer_offset;
+	bus->write (shift_buffer.data() + o, amp_buffer.data() + o, signal_buffer.data() + o, delay_buffer.data() + o, n);
+
+	// Apply the modulation delayed like the other engines of the group.
+	// Keep the faders for the modulator. The frames are always available:
+	// Written before and within the history.
+	if (bus_offset) bus->read (bus_position - bus_offset, n, shift_buffer.data() + o, amp_buffer.data() + o, signal_buffer.data() + o, delay_buffer.data() + o);
+	for (uint32_t i = o; i < o + n; ++i) delay_buffer[i] += buffer_offset;
+	bus_position += n;
+
+	bus_remaining -= std::min (bus_remaining, n);
+	if (bus_remaining == 0) publish_modulation_bus ();
+}
+
+inline void BVibratrEngine::publish_modulation_bus ()
+{
+	BVibratrModulatorState& state = bus->get_next_state ();
+	state.owner = this;
+	save_oscillators (state.oscillators);
+	state.shift = shift;
+	state.amp = amp;
+	bus->publish ();
+	bus_render = false;
+}
+
+inline void BVibratrEngine::write_cv (const uint32_t i0, const uint32_t o, const uint32_t n)
+{
+	if (cv_signal) std::copy (signal_buffer.begin() + o, signal_buffer.begin() + o + n, cv_signal + i0);
+	if (cv_amp) std::copy (amp_buffer.begin() + o, amp_buffer.begin() + o + n, cv_amp + i0);
+	if (cv_shift) std::copy (shift_buffer.begin() + o, shift_buffer.begin() + o + n, cv_shift + i0);
+}
+
+inline BVibratrTrajectory* BVibratrEngine::render_trajectory (const double samplerate, const BVibratrTrajectory::Controllers& controllers)
+{
+	// Run the oscillators and the ADSR of a temporary engine (without
+	// delay lines) like modulate() after a note on
+	BVibratrEngine engine (samplerate, nullptr);
+	for (int i = 0; i < BVIBRATR_NR_CONTROLLERS; ++i) engine.set_controller (i, controllers[i]);
+	engine.osc1_mode = engine.controllers[BVIBRATR_OSC1_MODE];
+	engine.osc2_mode = engine.controllers[BVIBRATR_OSC2_MODE];
+	engine.osc3_mode = engine.controllers[BVIBRATR_OSC3_MODE];
+	engine.start_modulation ();
+
+	const double sample_time = 1.0 / samplerate;
+	const double amp_f = engine.get_amp_factor ();
+	const double length = (engine.controllers[BVIBRATR_DEPTH_ATTACK] + engine.controllers[BVIBRATR_DEPTH_DECAY]) * samplerate;
+	const uint32_t frames = std::ceil (length);
+
+	BVibratrTrajectory* trajectory = new BVibratrTrajectory (samplerate, engine.controllers, frames);
+	BVibratrOscillatorState state;
+	for (uint32_t f = 0; f < frames; ++f)
+	{
+		if (f % BVIBRATR_TRAJECTORY_STATE_INTERVAL == 0)
+		{
+			engine.save_oscillators (state);
+			trajectory->add_state (state);
+		}
+
+		double signal = 0.0;
+		double integral = 0.0;
+		engine.oscillate (sample_time, amp_f, signal, integral);
+		trajectory->add (signal, integral);
+	}
+
+	// State at the end
+	engine.save_oscillators (state);
+	trajectory->add_state (state);
+	return trajectory;
+}
+
+inline const BVibratrTrajectory* BVibratrEngine::set_trajectory (const BVibratrTrajectory* trajectory)
+{
+	leave_trajectory ();
+	const BVibratrTrajectory* last = this->trajectory;
+	this->trajectory = trajectory;
+	return last;
+}
+
+inline void BVibratrEngine::leave_trajectory ()
+{
+	if (!trajectory_active) return;
+	trajectory_active = false;
+
+	// Restore the last state before and catch up. The controllers are the
+	// same as for the rendering.
+	uint32_t frame;
+	restore_oscillators (trajectory->get_state (trajectory_frame, frame));
+	const double sample_time = 1.0 / rate;
+	const double amp_f = get_amp_factor ();
+	for (; frame < trajectory_frame; ++frame)
+	{
+		double signal = 0.0;
+		double integral = 0.0;
+		oscillate (sample_time, amp_f, signal, integral);
+	}
+}
+
+inline void BVibratrEngine::save_oscillators (BVibratrOscillatorState& state) const
+{
+	state.adsr = adsr;
+	state.osc1 = osc1;
+	state.osc2 = osc2;
+	state.osc3 = osc3;
+	state.osc1_mode = osc1_mode;
+	state.osc2_mode = osc2_mode;
+	state.osc3_mode = osc3_mode;
+}
+
+inline void BVibratrEngine::restore_oscillators (const BVibratrOscillatorState& state)
+{
+	adsr = state.adsr;
+	osc1 = state.osc1;
+	osc2 = state.osc2;
+	osc3 = state.osc3;
+	osc1_mode = state.osc1_mode;
+	osc2_mode = state.osc2_mode;
+	osc3_mode = state.osc3_mode;
+
+	// The copied callbacks refer to the rendering engine
+	osc1.setCallbackFunction(LFO<double>::PHASE_RESTART, &on_osc1_restart, this);
+	osc2.setCallbackFunction(LFO<double>::PHASE_RESTART, &on_osc2_restart, this);
+	osc3.setCallbackFunction(LFO<double>::PHASE_RESTART, &on_osc3_restart, this);
+}
+
+inline uint32_t BVibratrEngine::get_latency () const {return buffer_offset;}
+
+inline const BVibratrTrajectory::Controllers& BVibratrEngine::get_controllers () const {return controllers;}
+
+inline float BVibratrEngine::get_shift () const {return shift.get();}
+
+inline float BVibratrEngine::get_amp () const {return amp.get();}
+
+inline float BVibratrEngine::get_mix () const {return mix.get();}
+
+inline int32_t BVibratrEngine::get_adsr_phase_nr () const
+{
+	// The ADSR isn't run while the trajectory is read
+	if (trajectory_active)
+	{
+		const double time = trajectory_frame / rate;
+		if (time < controllers[BVIBRATR_DEPTH_ATTACK]) return 1 + ADSR<double>::ATTACK;
+		if (time < controllers[BVIBRATR_DEPTH_ATTACK] + controllers[BVIBRATR_DEPTH_DECAY]) return 1 + ADSR<double>::DECAY;
+		return 1 + ADSR<double>::SUSTAIN;
+	}
+
+	return (adsr.is_active() ? 1 + adsr.getPhase() : 0);
+}
+
+inline int BVibratrEngine::get_note_channel () const
+{
+	return (note_channel < 0x80 ? note_channel : -1);
+}
+
+inline int BVibratrEngine::get_osc_mode (const int nr) const
+{
+	switch (nr)
+	{
+		case 1:		return osc1_mode;
+		case 2:		return osc2_mode;
+		case 3:		return osc3_mode;
+		default:	return 0;
+	}
+}
+
+inline void BVibratrEngine::track_shift_range (const bool on) {shift_tracked = on;}
+
+inline void BVibratrEngine::get_shift_range (float& min, float& max) const
+{
+	min = shift_min;
+	max = shift_max;
+}
+
+inline void BVibratrEngine::clear_shift_range ()
+{
+	shift_min = 0.0f;
+	shift_max = 0.0f;
+}
+
+inline BVibratrModulationAt BVibratrEngine::get_modulation_at (const uint64_t t)
+{
+	leave_trajectory ();
+	return predict (adsr, osc1, osc2, osc3, osc1_mode, osc2_mode, osc3_mode, t);
+}
+
+inline void BVibratrEngine::on_predicted_restart (LFO<double>& lfo, void* restarted)
+{
+	*static_cast<bool*>(restarted) = true;
+}
+
+inline BVibratrModulationAt BVibratrEngine::predict	(const ADSR<double>& adsr, const LFO<double>& osc1, const LFO<double>& osc2, const LFO<double>& osc3,
+													 const int osc1_mode, const int osc2_mode, const int osc3_mode, const uint64_t t) const
+{
+	const double sample_time = 1.0 / rate;
+	const int ctrl_mode[3] =
+	{
+		static_cast<int>(controllers[BVIBRATR_OSC1_MODE]),
+		static_cast<int>(controllers[BVIBRATR_OSC2_MODE]),
+		static_cast<int>(controllers[BVIBRATR_OSC3_MODE])
+	};
+
+	BVibratrModulationAt result;
+	result.osc_mode[0] = osc1_mode;
+	result.osc_mode[1] = osc2_mode;
+	result.osc_mode[2] = osc3_mode;
+	result.exact = true;
+
+	// Frames with an active adsr at their start (and thus with running
+	// oscillators). Without note off, the adsr only stops at the end of
+	// the release phase.
+	uint64_t active = 0;
+	if (adsr.is_active())
+	{
+		active = t;
+		if (adsr.getPhase() == ADSR<double>::RELEASE)
+		{
+			const double left = std::ceil ((adsr.get_parameter (ADSR<double>::RELEASE) - adsr.getPhaseTime()) / sample_time);
+			active = std::min<uint64_t> (t, std::max (left, 1.0));
+		}
+	}
+
+	// Adsr
+	ADSR<double> a = adsr;
+	a.run (t * sample_time);
+	result.envelope = a.get_value();
+	result.adsr_phase_nr = (a.is_active() ? 1 + a.getPhase() : 0);
+
+	// Oscillators: Copies with a restart flag instead of the mode switch
+	LFO<double> osc[3] = {osc1, osc2, osc3};
+	bool restarted[3] = {false, false, false};
+	for (int i = 0; i < 3; ++i) osc[i].setCallbackFunction (LFO<double>::PHASE_RESTART, &on_predicted_restart, &restarted[i]);
+
+	if (active)
+	{
+		// Osc3 isn't modulated
+		osc[2].set_frequency (controllers[BVIBRATR_OSC3_FREQ]);
+		osc[2].run (active * sample_time);
+		if (restarted[2]) result.osc_mode[2] = ctrl_mode[2];
+
+		// Osc2 (FM2 by osc3)
+		if ((osc3_mode == BVIBRATR_OSC_MODE_FM2) || (result.osc_mode[2] == BVIBRATR_OSC_MODE_FM2)) result.exact = false;
+		osc[1].set_frequency (controllers[BVIBRATR_OSC2_FREQ]);
+		osc[1].run (active * sample_time);
+		if (restarted[1]) result.osc_mode[1] = ctrl_mode[1];
+
+		// Osc1 (FM1 and PM1 by osc2 and osc3), only runs in LFO mode
+		if (osc1_mode == BVIBRATR_OSC_MODE_LFO)
+		{
+			for (int m : {osc2_mode, result.osc_mode[1], osc3_mode, result.osc_mode[2]})
+			{
+				if ((m == BVIBRATR_OSC_MODE_FM1) || (m == BVIBRATR_OSC_MODE_PM1)) result.exact = false;
+			}
+
+			const double freq = controllers[BVIBRATR_OSC1_FREQ];
+			osc[0].set_frequency (freq);
+			osc[0].set_phase_shift (0.0);
+			uint64_t frames = active;
+
+			// Osc1 stops running after it restarted in a non-LFO mode
+			if ((ctrl_mode[0] != BVIBRATR_OSC_MODE_LFO) && osc[0].is_active())
+			{
+				const double to_restart = std::ceil ((1.0 - osc[0].get_phase()) / (sample_time * freq));
+				frames = std::min<uint64_t> (frames, std::max (to_restart, 1.0));
+			}
+
+			osc[0].run (frames * sample_time);
+			if (restarted[0]) result.osc_mode[0] = ctrl_mode[0];
+		}
+	}
+
+	// Modes are taken from the controllers while the adsr is stopped
+	if (t > active) for (int i = 0; i < 3; ++i) result.osc_mode[i] = ctrl_mode[i];
+
+	for (int i = 0; i < 3; ++i) result.osc_phase[i] = osc[i].get_phase();
+	return result;
+}
+
+#ifdef BVIBRATR_CYCLE_STATS
+inline CycleStats& BVibratrEngine::get_cycle_stats () {return cycle_stats;}
+
+inline const CycleStats& BVibratrEngine::get_cycle_stats () const {return cycle_stats;}
+#endif
+
+#ifdef BVIBRATR_PROFILE
+inline Profiler& BVibratrEngine::get_profiler () {return profiler;}
+
+inline const Profiler& BVibratrEngine::get_profiler () const {return profiler;}
+#endif
+
+#ifdef BVIBRATR_CHECKPOINTS
+inline BVibratrCheckpoint* BVibratrEngine::save_checkpoint ()
+{
+	leave_trajectory ();
+	return new BVibratrCheckpoint {depth, depth_cc, shift, amp, mix, osc1_mode, osc2_mode, osc3_mode, note, note_channel, adsr, osc1, osc2, osc3};
+}
+
+inline void BVibratrEngine::restore_checkpoint (const BVibratrCheckpoint& checkpoint)
+{
+	depth = checkpoint.depth;
+	depth_cc = checkpoint.depth_cc;
+	shift = checkpoint.shift;
+	amp = checkpoint.amp;
+	mix = checkpoint.mix;
+	osc1_mode = checkpoint.osc1_mode;
+	osc2_mode = checkpoint.osc2_mode;
+	osc3_mode = checkpoint.osc3_mode;
+	note = checkpoint.note;
+	note_channel = checkpoint.note_channel;
+	adsr = checkpoint.adsr;
+	osc1 = checkpoint.osc1;
+	osc2 = checkpoint.osc2;
+	osc3 = checkpoint.osc3;
+	trajectory_active = false;
+
+	// The copied callbacks refer to the saved engine
+	osc1.setCallbackFunction(LFO<double>::PHASE_RESTART, &on_osc1_restart, this);
+	osc2.setCallbackFunction(LFO<double>::PHASE_RESTART, &on_osc2_restart, this);
+	osc3.setCallbackFunction(LFO<double>::PHASE_RESTART, &on_osc3_restart, this);
+}
+
+inline BVibratrModulationAt BVibratrEngine::get_modulation_at (const BVibratrCheckpoint& checkpoint, const uint64_t t) const
+{
+	return predict	(checkpoint.adsr, checkpoint.osc1, checkpoint.osc2, checkpoint.osc3,
+					 checkpoint.osc1_mode, checkpoint.osc2_mode, checkpoint.osc3_mode, t);
+}
+#endif
+
+#endif /* BVIBRATRENGINE_HPP_ */
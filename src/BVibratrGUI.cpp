@@ -30,6 +30,7 @@ BVibratrGUI::BVibratrGUI (const char *bundle_path, const LV2_Feature *const *fea
 	write_function (NULL),
 	pluginPath (bundle_path ? std::string (bundle_path) : std::string ("")),
 	map (nullptr),
+	sineTable (get_shared_table<SineTable>()),
 
 	mContainer(0, 0, BVIBRATR_GUI_WIDTH, BVIBRATR_GUI_HEIGHT, pluginPath + "inc/surface.png", URID ("/bgimage")),
 	//helpButton (918, 508, 24, 24, false, false, URID ("/halobutton"), BDICT ("Help")),
@@ -315,6 +316,7 @@ void BVibratrGUI::drawAdsr()
 	const double sampleTime = totalTime / w;
 
 	ADSR<double> adsr(attack, decay, sustain, release, ADSR<double>::INVSQR);
+	adsr.set_sine_table(sineTable.get());
 	adsr.start();
 
 	cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
@@ -363,6 +365,10 @@ void BVibratrGUI::drawWaveform()
 	LFO<double> osc1(static_cast<LFO<double>::Waveform>(osc1WaveformCombobox.getValue()), osc1FreqDial.getValue());
 	LFO<double> osc2(static_cast<LFO<double>::Waveform>(osc2WaveformCombobox.getValue()), osc2FreqDial.getValue());
 	LFO<double> osc3(static_cast<LFO<double>::Waveform>(osc3WaveformCombobox.getValue()), osc3FreqDial.getValue());
+	adsr.set_sine_table(sineTable.get());
+	osc1.set_sine_table(sineTable.get());
+	osc2.set_sine_table(sineTable.get());
+	osc3.set_sine_table(sineTable.get());
 
 	adsr.start();
 	osc1.start();
@@ -22,6 +22,7 @@
 #include "ValueHSlider.hpp"
 #include "Ports.hpp"
 #include "Urids.hpp"
+#include "SharedTables.hpp"
 
 #ifndef WWW_BROWSER_CMD
 #define WWW_BROWSER_CMD "x-www-browser"
@@ -61,6 +62,9 @@ private:
 	LV2_URID_Map* map;
 	// LV2_URID_Unmap* unmap;
 
+	// Shared tables for the ADSR and LFO previews
+	std::shared_ptr<const SineTable> sineTable;
+
 	// Widgets
 	BWidgets::Image mContainer;
 	//BWidgets::Button helpButton;
@@ -0,0 +1,109 @@
+#ifndef BVIBRATRTIMELINE_HPP_
+#define BVIBRATRTIMELINE_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "BVibratrEngine.hpp"
+
+#ifdef BVIBRATR_CHECKPOINTS
+
+/**
+Random access to the modulation of an engine for the next frames without
+MIDI messages and parameter changes. Checkpoints are recorded in a fixed
+interval. A request is solved in O(1) from the last checkpoint before (see
+BVibratrEngine::get_modulation_at()). For FM and PM routings, the phase
+drift to the next checkpoint is distributed linearly over the interval.
+Thus, the error only depends on the curvature of the phase within one
+interval. Not realtime safe.
+
+Usage:
+	BVibratrTimeline timeline (engine, frames, interval);
+	const BVibratrModulationAt state = timeline.get (t);
+*/
+class BVibratrTimeline
+{
+public:
+	/**
+	Records the checkpoints by proceeding the modulation of an engine. The
+	modulation state of the engine is restored afterwards.
+	@param engine	Engine. Must outlive the timeline.
+	@param frames	Number of frames to record.
+	@param interval	Frames between two checkpoints, > 0.
+	@throws std::bad_alloc.
+	*/
+	BVibratrTimeline (BVibratrEngine& engine, const uint64_t frames, const uint32_t interval);
+
+	/**
+	@return	Number of recorded frames.
+	*/
+	uint64_t size () const;
+
+	/**
+	@return	Frames between two checkpoints.
+	*/
+	uint32_t get_interval () const;
+
+	/**
+	Gets the modulation state t frames after the start of the timeline.
+	Exact at the checkpoints (and everywhere for routings without FM and
+	PM, except rounding). Extrapolated from the last checkpoint for t >=
+	size().
+	@param t	Time offset in frames.
+	@return		Modulation state.
+	*/
+	BVibratrModulationAt get (const uint64_t t) const;
+
+private:
+	const BVibratrEngine& engine;
+	uint64_t frames;
+	uint32_t interval;
+	std::vector<std::unique_ptr<BVibratrCheckpoint>> checkpoints;
+};
+
+inline BVibratrTimeline::BVibratrTimeline (BVibratrEngine& engine, const uint64_t frames, const uint32_t interval) :
+	engine (engine),
+	frames (frames),
+	interval (std::max<uint32_t> (interval, 1)),
+	checkpoints ()
+{
+	checkpoints.reserve (frames / this->interval + 1);
+	std::unique_ptr<BVibratrCheckpoint> start (engine.save_checkpoint ());
+	for (uint64_t t = 0; t <= frames; t += this->interval)
+	{
+		if (t > 0) engine.advance (this->interval);
+		checkpoints.emplace_back (engine.save_checkpoint ());
+	}
+	engine.restore_checkpoint (*start);
+}
+
+inline uint64_t BVibratrTimeline::size () const {return frames;}
+
+inline uint32_t BVibratrTimeline::get_interval () const {return interval;}
+
+inline BVibratrModulationAt BVibratrTimeline::get (const uint64_t t) const
+{
+	const uint64_t k = std::min<uint64_t> (t / interval, checkpoints.size() - 1);
+	const uint64_t dt = t - k * interval;
+	BVibratrModulationAt result = engine.get_modulation_at (*checkpoints[k], dt);
+	if (result.exact || (dt == 0) || (k + 1 >= checkpoints.size())) return result;
+
+	// Correct the phases by the drift between the prediction and the next
+	// checkpoint (in the range [-0.5, 0.5))
+	const BVibratrModulationAt predicted = engine.get_modulation_at (*checkpoints[k], interval);
+	const BVibratrModulationAt next = engine.get_modulation_at (*checkpoints[k + 1], 0);
+	for (int i = 0; i < 3; ++i)
+	{
+		const double d = next.osc_phase[i] - predicted.osc_phase[i];
+		const double drift = d - std::floor (d + 0.5);
+		const double phase = result.osc_phase[i] + drift * static_cast<double>(dt) / interval;
+		result.osc_phase[i] = phase - std::floor (phase);
+	}
+	return result;
+}
+
+#endif /* BVIBRATR_CHECKPOINTS */
+
+#endif /* BVIBRATRTIMELINE_HPP_ */
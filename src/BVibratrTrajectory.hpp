@@ -0,0 +1,198 @@
+#ifndef BVIBRATRTRAJECTORY_HPP_
+#define BVIBRATRTRAJECTORY_HPP_
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "ADSR.hpp"
+#include "LFO.hpp"
+#include "Ports.hpp"
+
+#define BVIBRATR_TRAJECTORY_STATE_INTERVAL 128	// Frames between two saved oscillator states (max. catch-up)
+
+/**
+State of the ADSR and the oscillators of an engine.
+*/
+struct BVibratrOscillatorState
+{
+	ADSR<double> adsr;
+	LFO<double> osc1, osc2, osc3;
+	int osc1_mode, osc2_mode, osc3_mode;
+};
+
+/**
+Precomputed modulation (signal and integral, both scaled by the ADSR, but
+not by the depth) of the attack and decay phases after a note on. Stored
+for each frame in double precision (16 bytes per frame) and thus identical
+to the modulation of the live oscillators. Also stores the oscillator state
+each BVIBRATR_TRAJECTORY_STATE_INTERVAL frames and at the end to continue
+with the live oscillators at any position.
+
+Only valid for the sample rate and the controllers (see is_relevant()) it
+was rendered with. Rendered by BVibratrEngine::render_trajectory(). Not
+realtime safe except the const methods.
+*/
+class BVibratrTrajectory
+{
+public:
+	typedef std::array<float, BVIBRATR_NR_CONTROLLERS> Controllers;
+
+	/**
+	Allocates an empty trajectory.
+	@param samplerate	Sample rate in Hz.
+	@param controllers	Controllers.
+	@param frames		Number of frames.
+	@throws std::bad_alloc.
+	*/
+	BVibratrTrajectory (const double samplerate, const Controllers& controllers, const uint32_t frames);
+
+	/**
+	Tests if a controller changes the modulation of the attack and decay
+	phases (or the state at their end).
+	@param nr	Controller number (BVibratrControllers).
+	@return		True if relevant.
+	*/
+	static bool is_relevant (const int nr);
+
+	/**
+	Tests if two sets of controllers lead to the same trajectory.
+	@param a	Controllers.
+	@param b	Controllers.
+	@return		True if all relevant controllers are equal.
+	*/
+	static bool is_equivalent (const Controllers& a, const Controllers& b);
+
+	/**
+	Tests if the trajectory is valid for a sample rate and controllers.
+	@param samplerate	Sample rate in Hz.
+	@param controllers	Controllers.
+	@return				True if valid.
+	*/
+	bool matches (const double samplerate, const Controllers& controllers) const;
+
+	/**
+	@return	Number of frames.
+	*/
+	uint32_t size () const;
+
+	/**
+	Gets the modulation of a frame.
+	@param frame	Frame, < size().
+	@param signal	Target for the signal.
+	@param integral	Target for the integral.
+	*/
+	void get (const uint32_t frame, double& signal, double& integral) const;
+
+	/**
+	Gets the last saved oscillator state at or before a frame.
+	@param frame	Frame, <= size().
+	@param start	Target for the frame of the state.
+	@return			Oscillator state before processing frame start.
+	*/
+	const BVibratrOscillatorState& get_state (const uint32_t frame, uint32_t& start) const;
+
+	/**
+	Adds the modulation of the next frame. Rendering only.
+	*/
+	void add (const double signal, const double integral);
+
+	/**
+	Adds the oscillator state of the next frame n *
+	BVIBRATR_TRAJECTORY_STATE_INTERVAL (< size()), and finally of size().
+	Rendering only.
+	*/
+	void add_state (const BVibratrOscillatorState& state);
+
+private:
+	double samplerate;
+	Controllers controllers;
+	uint32_t frames;
+	std::vector<double> signals;
+	std::vector<double> integrals;
+	std::vector<BVibratrOscillatorState> states;
+};
+
+inline BVibratrTrajectory::BVibratrTrajectory (const double samplerate, const Controllers& controllers, const uint32_t frames) :
+	samplerate (samplerate),
+	controllers (controllers),
+	frames (frames),
+	signals (),
+	integrals (),
+	states ()
+{
+	signals.reserve (frames);
+	integrals.reserve (frames);
+	states.reserve ((frames + BVIBRATR_TRAJECTORY_STATE_INTERVAL - 1) / BVIBRATR_TRAJECTORY_STATE_INTERVAL + 1);
+}
+
+inline bool BVibratrTrajectory::is_relevant (const int nr)
+{
+	switch (nr)
+	{
+		case BVIBRATR_DEPTH_ATTACK:
+		case BVIBRATR_DEPTH_DECAY:
+		case BVIBRATR_DEPTH_SUSTAIN:
+		case BVIBRATR_DEPTH_RELEASE:
+		case BVIBRATR_OSC1_FREQ:
+		case BVIBRATR_OSC1_MODE:
+		case BVIBRATR_OSC1_WAVEFORM:
+		case BVIBRATR_OSC2_AMP:
+		case BVIBRATR_OSC2_FREQ:
+		case BVIBRATR_OSC2_MODE:
+		case BVIBRATR_OSC2_WAVEFORM:
+		case BVIBRATR_OSC3_AMP:
+		case BVIBRATR_OSC3_FREQ:
+		case BVIBRATR_OSC3_MODE:
+		case BVIBRATR_OSC3_WAVEFORM:
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+inline bool BVibratrTrajectory::is_equivalent (const Controllers& a, const Controllers& b)
+{
+	for (int i = 0; i < BVIBRATR_NR_CONTROLLERS; ++i)
+	{
+		if (is_relevant (i) && (a[i] != b[i])) return false;
+	}
+	return true;
+}
+
+inline bool BVibratrTrajectory::matches (const double samplerate, const Controllers& controllers) const
+{
+	return (samplerate == this->samplerate) && is_equivalent (controllers, this->controllers);
+}
+
+inline uint32_t BVibratrTrajectory::size () const {return frames;}
+
+inline void BVibratrTrajectory::get (const uint32_t frame, double& signal, double& integral) const
+{
+	signal = signals[frame];
+	integral = integrals[frame];
+}
+
+inline const BVibratrOscillatorState& BVibratrTrajectory::get_state (const uint32_t frame, uint32_t& start) const
+{
+	if (frame >= frames)
+	{
+		start = frames;
+		return states.back();
+	}
+
+	const uint32_t k = frame / BVIBRATR_TRAJECTORY_STATE_INTERVAL;
+	start = k * BVIBRATR_TRAJECTORY_STATE_INTERVAL;
+	return states[k];
+}
+
+inline void BVibratrTrajectory::add (const double signal, const double integral)
+{
+	signals.push_back (signal);
+	integrals.push_back (integral);
+}
+
+inline void BVibratrTrajectory::add_state (const BVibratrOscillatorState& state) {states.push_back (state);}
+
+#endif /* BVIBRATRTRAJECTORY_HPP_ */
@@ -0,0 +1,283 @@
+#ifndef CYCLESTATS_HPP_
+#define CYCLESTATS_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define CYCLESTATS_BUCKETS 256          // Histogram buckets, 4 per octave
+#define CYCLESTATS_EVENT_CLASSES 8      // Event counts 0, 1, 2-3, 4-7, 8-15, 16-31, 32-63, >= 64
+#define CYCLESTATS_PHASES 5             // Idle, attack, decay, sustain, release
+
+/**
+Worst case of a measured section together with the circumstances.
+*/
+struct CycleStatsWorstCase
+{
+    uint64_t cycles;
+    uint64_t run;           // Number of the run() call
+    uint32_t n_samples;
+    uint32_t events;        // All events in the run() call
+    uint32_t note_ons;
+    uint32_t controllers;
+    int32_t adsr_phase;     // 0 = idle, 1 + ADSR<T>::Phase otherwise
+};
+
+/**
+Copy of the statistics for the reader.
+*/
+struct CycleStatsSnapshot
+{
+    uint64_t runs;
+    uint64_t plays;
+    uint64_t run_cycles;                                // Sum of all runs
+    uint64_t run_histogram[CYCLESTATS_BUCKETS];
+    uint64_t play_histogram[CYCLESTATS_BUCKETS];
+    uint64_t max_by_events[CYCLESTATS_EVENT_CLASSES];   // Worst run for each event count class
+    uint64_t max_by_phase[CYCLESTATS_PHASES];           // Worst run for each ADSR phase
+    CycleStatsWorstCase worst_run;
+    CycleStatsWorstCase worst_play;
+};
+
+/**
+Lock-free cycle count statistics. Histograms of the cycle counts of the
+measured sections (run() calls and play() segments) with 4 logarithmic
+buckets per octave and the worst cases.
+
+A single (realtime) writer thread calls add_play() and add_run(). Any
+number of non-realtime reader threads may call get() and reset()
+concurrently. Neither side blocks or allocates.
+*/
+class CycleStats
+{
+public:
+    CycleStats ();
+
+    /**
+    Gets the current value of the cycle counter (time stamp counter on x86,
+    nanoseconds otherwise).
+    @return Cycle counter value.
+    */
+    static uint64_t now ();
+
+    /**
+    Gets the histogram bucket for a cycle count.
+    @param cycles   Cycle count.
+    @return         Bucket index.
+    */
+    static size_t bucket (const uint64_t cycles);
+
+    /**
+    Gets the smallest cycle count of a histogram bucket.
+    @param bucket   Bucket index.
+    @return         Cycle count.
+    */
+    static uint64_t bucket_min (const size_t bucket);
+
+    /**
+    Adds a play() segment. Writer only.
+    @param cycles       Cycles used.
+    @param n_samples    Number of samples of the segment.
+    @param adsr_phase   0 = idle, 1 + ADSR<T>::Phase otherwise.
+    */
+    void add_play (const uint64_t cycles, const uint32_t n_samples, const int32_t adsr_phase);
+
+    /**
+    Adds a run() call. Writer only. Also executes a requested reset before.
+    @param cycles       Cycles used.
+    @param n_samples    Number of samples.
+    @param events       Number of events.
+    @param note_ons     Number of note on events.
+    @param controllers  Number of MIDI CC events.
+    @param adsr_phase   0 = idle, 1 + ADSR<T>::Phase otherwise.
+    */
+    void add_run (const uint64_t cycles, const uint32_t n_samples, const uint32_t events, const uint32_t note_ons, const uint32_t controllers, const int32_t adsr_phase);
+
+    /**
+    Copies the statistics. Reader only.
+    @param snapshot Target.
+    */
+    void get (CycleStatsSnapshot& snapshot) const;
+
+    /**
+    Requests to reset the statistics. The reset is executed by the writer
+    with the next call of add_run(). Reader only.
+    */
+    void reset ();
+
+protected:
+    struct AtomicWorstCase
+    {
+        std::atomic<uint32_t> sequence;     // Odd while written
+        std::atomic<uint64_t> cycles;
+        std::atomic<uint64_t> run;
+        std::atomic<uint32_t> n_samples;
+        std::atomic<uint32_t> events;
+        std::atomic<uint32_t> note_ons;
+        std::atomic<uint32_t> controllers;
+        std::atomic<int32_t> adsr_phase;
+    };
+
+    std::atomic<uint64_t> runs_;
+    std::atomic<uint64_t> plays_;
+    std::atomic<uint64_t> run_cycles_;
+    std::atomic<uint64_t> run_histogram_[CYCLESTATS_BUCKETS];
+    std::atomic<uint64_t> play_histogram_[CYCLESTATS_BUCKETS];
+    std::atomic<uint64_t> max_by_events_[CYCLESTATS_EVENT_CLASSES];
+    std::atomic<uint64_t> max_by_phase_[CYCLESTATS_PHASES];
+    AtomicWorstCase worst_run_;
+    AtomicWorstCase worst_play_;
+    std::atomic<bool> reset_requested_;
+
+    // Single writer: Plain load and store instead of read-modify-write
+    template <class T> static void increase_ (std::atomic<T>& value, const T delta);
+    template <class T> static void maximize_ (std::atomic<T>& value, const T candidate);
+    static void write_ (AtomicWorstCase& target, const CycleStatsWorstCase& value);
+    static void read_ (const AtomicWorstCase& source, CycleStatsWorstCase& value);
+    void clear_ ();
+};
+
+inline CycleStats::CycleStats () : reset_requested_ (false)
+{
+    worst_run_.sequence.store (0, std::memory_order_relaxed);
+    worst_play_.sequence.store (0, std::memory_order_relaxed);
+    clear_ ();
+}
+
+inline uint64_t CycleStats::now ()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc ();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds> (std::chrono::steady_clock::now ().time_since_epoch ()).count ();
+#endif
+}
+
+inline size_t CycleStats::bucket (const uint64_t cycles)
+{
+    if (cycles < 4) return cycles;
+    const int msb = 63 - __builtin_clzll (cycles);
+    const size_t b = (static_cast<size_t> (msb) << 2) | ((cycles >> (msb - 2)) & 3);
+    return (b < CYCLESTATS_BUCKETS ? b : CYCLESTATS_BUCKETS - 1);
+}
+
+inline uint64_t CycleStats::bucket_min (const size_t bucket)
+{
+    if (bucket < 4) return bucket;
+    const int msb = bucket >> 2;
+    return (uint64_t (1) << msb) | (static_cast<uint64_t> (bucket & 3) << (msb - 2));
+}
+
+inline void CycleStats::add_play (const uint64_t cycles, const uint32_t n_samples, const int32_t adsr_phase)
+{
+    increase_ (plays_, uint64_t (1));
+    increase_ (play_histogram_[bucket (cycles)], uint64_t (1));
+    if (cycles > worst_play_.cycles.load (std::memory_order_relaxed))
+    {
+        write_ (worst_play_, {cycles, runs_.load (std::memory_order_relaxed), n_samples, 0, 0, 0, adsr_phase});
+    }
+}
+
+inline void CycleStats::add_run (const uint64_t cycles, const uint32_t n_samples, const uint32_t events, const uint32_t note_ons, const uint32_t controllers, const int32_t adsr_phase)
+{
+    if (reset_requested_.load (std::memory_order_acquire))
+    {
+        clear_ ();
+        reset_requested_.store (false, std::memory_order_release);
+    }
+
+    const uint64_t run = runs_.load (std::memory_order_relaxed);
+    increase_ (runs_, uint64_t (1));
+    increase_ (run_cycles_, cycles);
+    increase_ (run_histogram_[bucket (cycles)], uint64_t (1));
+
+    const size_t event_class = (events == 0 ? 0 : 64 - __builtin_clzll (events));
+    maximize_ (max_by_events_[event_class < CYCLESTATS_EVENT_CLASSES ? event_class : CYCLESTATS_EVENT_CLASSES - 1], cycles);
+    if ((adsr_phase >= 0) && (adsr_phase < CYCLESTATS_PHASES)) maximize_ (max_by_phase_[adsr_phase], cycles);
+
+    if (cycles > worst_run_.cycles.load (std::memory_order_relaxed))
+    {
+        write_ (worst_run_, {cycles, run, n_samples, events, note_ons, controllers, adsr_phase});
+    }
+}
+
+inline void CycleStats::get (CycleStatsSnapshot& snapshot) const
+{
+    snapshot.runs = runs_.load (std::memory_order_relaxed);
+    snapshot.plays = plays_.load (std::memory_order_relaxed);
+    snapshot.run_cycles = run_cycles_.load (std::memory_order_relaxed);
+    for (size_t i = 0; i < CYCLESTATS_BUCKETS; ++i)
+    {
+        snapshot.run_histogram[i] = run_histogram_[i].load (std::memory_order_relaxed);
+        snapshot.play_histogram[i] = play_histogram_[i].load (std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < CYCLESTATS_EVENT_CLASSES; ++i) snapshot.max_by_events[i] = max_by_events_[i].load (std::memory_order_relaxed);
+    for (size_t i = 0; i < CYCLESTATS_PHASES; ++i) snapshot.max_by_phase[i] = max_by_phase_[i].load (std::memory_order_relaxed);
+    read_ (worst_run_, snapshot.worst_run);
+    read_ (worst_play_, snapshot.worst_play);
+}
+
+inline void CycleStats::reset () {reset_requested_.store (true, std::memory_order_release);}
+
+template <class T> inline void CycleStats::increase_ (std::atomic<T>& value, const T delta)
+{
+    value.store (value.load (std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+template <class T> inline void CycleStats::maximize_ (std::atomic<T>& value, const T candidate)
+{
+    if (candidate > value.load (std::memory_order_relaxed)) value.store (candidate, std::memory_order_relaxed);
+}
+
+inline void CycleStats::write_ (AtomicWorstCase& target, const CycleStatsWorstCase& value)
+{
+    // Sequence lock: Readers retry if the sequence is odd or has changed
+    const uint32_t seq = target.sequence.load (std::memory_order_relaxed);
+    target.sequence.store (seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence (std::memory_order_release);
+    target.cycles.store (value.cycles, std::memory_order_relaxed);
+    target.run.store (value.run, std::memory_order_relaxed);
+    target.n_samples.store (value.n_samples, std::memory_order_relaxed);
+    target.events.store (value.events, std::memory_order_relaxed);
+    target.note_ons.store (value.note_ons, std::memory_order_relaxed);
+    target.controllers.store (value.controllers, std::memory_order_relaxed);
+    target.adsr_phase.store (value.adsr_phase, std::memory_order_relaxed);
+    target.sequence.store (seq + 2, std::memory_order_release);
+}
+
+inline void CycleStats::read_ (const AtomicWorstCase& source, CycleStatsWorstCase& value)
+{
+    uint32_t seq;
+    do
+    {
+        seq = source.sequence.load (std::memory_order_acquire);
+        value.cycles = source.cycles.load (std::memory_order_relaxed);
+        value.run = source.run.load (std::memory_order_relaxed);
+        value.n_samples = source.n_samples.load (std::memory_order_relaxed);
+        value.events = source.events.load (std::memory_order_relaxed);
+        value.note_ons = source.note_ons.load (std::memory_order_relaxed);
+        value.controllers = source.controllers.load (std::memory_order_relaxed);
+        value.adsr_phase = source.adsr_phase.load (std::memory_order_relaxed);
+        std::atomic_thread_fence (std::memory_order_acquire);
+    } while ((seq & 1) || (seq != source.sequence.load (std::memory_order_relaxed)));
+}
+
+inline void CycleStats::clear_ ()
+{
+    runs_.store (0, std::memory_order_relaxed);
+    plays_.store (0, std::memory_order_relaxed);
+    run_cycles_.store (0, std::memory_order_relaxed);
+    for (std::atomic<uint64_t>& h : run_histogram_) h.store (0, std::memory_order_relaxed);
+    for (std::atomic<uint64_t>& h : play_histogram_) h.store (0, std::memory_order_relaxed);
+    for (std::atomic<uint64_t>& m : max_by_events_) m.store (0, std::memory_order_relaxed);
+    for (std::atomic<uint64_t>& m : max_by_phase_) m.store (0, std::memory_order_relaxed);
+    write_ (worst_run_, {0, 0, 0, 0, 0, 0, 0});
+    write_ (worst_play_, {0, 0, 0, 0, 0, 0, 0});
+}
+
+#endif /* CYCLESTATS_HPP_ */
@@ -0,0 +1,100 @@
+#ifndef DELAYLINE_HPP_
+#define DELAYLINE_HPP_
+
+#include <cstddef>
+#include <algorithm>
+#include <stdexcept>
+
+/**
+Delay line. Ring buffer on external memory (e.g., from an Arena) with a size
+of a power of 2. Index 0 is the newest (front) sample, index n is the sample
+pushed n samples before. The delay line doesn't own its memory.
+*/
+template <class T>
+class DelayLine
+{
+public:
+    /**
+    Constructs an empty delay line of the size 1 without memory. Don't use
+    until memory is assigned.
+    */
+    DelayLine ();
+
+    /**
+    Constructs a delay line on the provided memory.
+    @param data Pointer to the memory for size objects of the type T.
+    @param size Size of the delay line. Must be a power of 2.
+    @throws std::invalid_argument if size is not a power of 2.
+    */
+    DelayLine (T* data, const size_t size);
+
+    T& operator[] (const long n);
+    const T& operator[] (const long n) const;
+    T* data ();
+    const T* data () const;
+    size_t size () const;
+
+    /**
+    Gets the mask for the index calculation (size - 1).
+    @return Mask.
+    */
+    size_t mask () const;
+
+    /**
+    Gets the position of the front sample in data.
+    @return Index of the front sample in data.
+    */
+    size_t front_index () const;
+
+    void fill (const T& value);
+    void push_front (const T& value);
+
+    /**
+    Moves the front by n samples. Use after n samples were written directly
+    to data (in front of front_index()).
+    @param n    Number of samples.
+    */
+    void move (const size_t n);
+
+protected:
+    T* data_;
+    size_t mask_;
+    size_t position_;
+};
+
+template <class T> inline DelayLine<T>::DelayLine () : data_ (nullptr), mask_ (0), position_ (0) {}
+
+template <class T> inline DelayLine<T>::DelayLine (T* data, const size_t size) : data_ (data), mask_ (size - 1), position_ (0)
+{
+    if ((size == 0) || (size & (size - 1))) throw std::invalid_argument ("Delay line size must be a power of 2.");
+}
+
+template <class T> inline T& DelayLine<T>::operator[] (const long n) {return data_[(position_ + n) & mask_];}
+
+template <class T> inline const T& DelayLine<T>::operator[] (const long n) const {return data_[(position_ + n) & mask_];}
+
+template <class T> inline T* DelayLine<T>::data () {return data_;}
+
+template <class T> inline const T* DelayLine<T>::data () const {return data_;}
+
+template <class T> inline size_t DelayLine<T>::size () const {return mask_ + 1;}
+
+template <class T> inline size_t DelayLine<T>::mask () const {return mask_;}
+
+template <class T> inline size_t DelayLine<T>::front_index () const {return position_;}
+
+template <class T> inline void DelayLine<T>::fill (const T& value)
+{
+    if (data_) std::fill (data_, data_ + mask_ + 1, value);
+    position_ = 0;
+}
+
+template <class T> inline void DelayLine<T>::push_front (const T& value)
+{
+    position_ = (position_ - 1) & mask_;
+    data_[position_] = value;
+}
+
+template <class T> inline void DelayLine<T>::move (const size_t n) {position_ = (position_ - n) & mask_;}
+
+#endif /* DELAYLINE_HPP_ */
@@ -0,0 +1,168 @@
+#ifndef KERNELS_HPP_
+#define KERNELS_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#define BVIBRATR_KERNEL_TMP_SIZE 64     // Size of the temporary buffers used by the half precision kernels
+
+/**
+Set of block processing kernels. The kernels are compiled for different
+instruction sets (see KernelsImpl.hpp) and the best variant for the running
+CPU is selected at runtime by get_kernels().
+*/
+struct Kernels
+{
+    const char* name;
+    void (*delay_write) (float* data, const size_t mask, const size_t position, const float* in, const uint32_t n);
+    void (*delay_read_fixed) (const float* data, const size_t mask, const size_t position, const size_t delay, float* out, const uint32_t n);
+    void (*delay_read) (const float* data, const size_t mask, const size_t position, const float* delay, float* out, const uint32_t n);
+    void (*mix) (const float* dry, const float* wet, const float* amp, const float* drywet, float* out, const uint32_t n);
+
+    // Delay lines with half precision (IEEE 754 binary16) storage
+    void (*delay_write_half) (uint16_t* data, const size_t mask, const size_t position, const float* in, const uint32_t n);
+    void (*delay_read_fixed_half) (const uint16_t* data, const size_t mask, const size_t position, const size_t delay, float* out, const uint32_t n);
+    void (*delay_read_half) (const uint16_t* data, const size_t mask, const size_t position, const float* delay, float* out, const uint32_t n);
+
+    // Modulation from external signals (CV inputs)
+    void (*modulate_external)  (const float* pitch, const float* tremolo, const float gain, const float tremolo_gain,
+                                const double max_shift, const double offset, double& shift, float* signal, float* shifts,
+                                float* delay, float* amp, const uint32_t n);
+};
+
+/**
+Converts a single precision float to half precision (IEEE 754 binary16).
+Rounds to nearest even, like the F16C instructions.
+@param value    Single precision value.
+@return         Bit pattern of the half precision value.
+*/
+inline uint16_t float_to_half (const float value)
+{
+    uint32_t x;
+    memcpy (&x, &value, sizeof (x));
+    const uint16_t sign = (x >> 16) & 0x8000;
+    uint32_t abs = x & 0x7fffffff;
+
+    // Inf and NaN
+    if (abs >= 0x7f800000) return sign | 0x7c00 | ((abs > 0x7f800000) ? (0x0200 | ((abs >> 13) & 0x03ff)) : 0);
+
+    // Overflow (>= 65520.0 after rounding)
+    if (abs >= 0x477ff000) return sign | 0x7c00;
+
+    // Subnormal: Let the FPU round by adding 0.5
+    if (abs < 0x38800000)
+    {
+        float f;
+        memcpy (&f, &abs, sizeof (f));
+        f += 0.5f;
+        uint32_t r;
+        memcpy (&r, &f, sizeof (r));
+        return sign | (r - 0x3f000000);
+    }
+
+    // Normal: Rebias the exponent and round to nearest even
+    abs += 0xc8000fff + ((abs >> 13) & 1);
+    return sign | (abs >> 13);
+}
+
+/**
+Converts a half precision (IEEE 754 binary16) value to single precision.
+@param value    Bit pattern of the half precision value.
+@return         Single precision value.
+*/
+inline float half_to_float (const uint16_t value)
+{
+    const uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+    const uint32_t abs = value & 0x7fff;
+    uint32_t x;
+
+    // Inf and NaN
+    if (abs >= 0x7c00) x = sign | 0x7f800000 | ((abs & 0x03ff) << 13);
+
+    // Normal
+    else if (abs >= 0x0400) x = sign | ((abs << 13) + 0x38000000);
+
+    // Subnormal: abs * 2^-24
+    else
+    {
+        const float f = static_cast<float>(abs) * 5.9604644775390625e-8f;
+        memcpy (&x, &f, sizeof (x));
+        x |= sign;
+    }
+
+    float result;
+    memcpy (&result, &x, sizeof (result));
+    return result;
+}
+
+// Don't contract multiplications and additions to FMA instructions in the
+// FMA enabled variants. All variants return the same results then.
+#if defined(__clang__)
+#pragma float_control (push)
+#pragma clang fp contract (off)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC optimize ("fp-contract=off")
+#endif
+
+namespace KernelsGeneric
+{
+#define BVIBRATR_KERNEL_TARGET
+#define BVIBRATR_KERNEL_NAME "generic"
+#include "KernelsImpl.hpp"
+#undef BVIBRATR_KERNEL_NAME
+#undef BVIBRATR_KERNEL_TARGET
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BVIBRATR_KERNELS_X86
+
+namespace KernelsAvx2
+{
+#define BVIBRATR_KERNEL_TARGET __attribute__((target ("avx2,fma,f16c")))
+#define BVIBRATR_KERNEL_NAME "avx2"
+#define BVIBRATR_KERNEL_F16C
+#include "KernelsImpl.hpp"
+#undef BVIBRATR_KERNEL_F16C
+#undef BVIBRATR_KERNEL_NAME
+#undef BVIBRATR_KERNEL_TARGET
+}
+
+namespace KernelsAvx512
+{
+#define BVIBRATR_KERNEL_TARGET __attribute__((target ("avx512f,avx512vl,avx2,fma,f16c")))
+#define BVIBRATR_KERNEL_NAME "avx512"
+#define BVIBRATR_KERNEL_F16C
+#include "KernelsImpl.hpp"
+#undef BVIBRATR_KERNEL_F16C
+#undef BVIBRATR_KERNEL_NAME
+#undef BVIBRATR_KERNEL_TARGET
+}
+#endif
+
+#if defined(__clang__)
+#pragma float_control (pop)
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+/**
+Gets the best kernel variant for the running CPU.
+@return Reference to the kernels.
+*/
+inline const Kernels& get_kernels ()
+{
+#ifdef BVIBRATR_KERNELS_X86
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx512f") && __builtin_cpu_supports ("avx512vl") && __builtin_cpu_supports ("f16c")) return KernelsAvx512::kernels;
+    if (__builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("fma") && __builtin_cpu_supports ("f16c")) return KernelsAvx2::kernels;
+#endif
+    return KernelsGeneric::kernels;
+}
+
+#endif /* KERNELS_HPP_ */
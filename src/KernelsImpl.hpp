@@ -0,0 +1,293 @@
+/* Block processing kernels.
+ *
+ * No include guard: This file is included once for each instruction set
+ * variant by Kernels.hpp. The including file has to define
+ * BVIBRATR_KERNEL_TARGET (target attribute for each function) and
+ * BVIBRATR_KERNEL_NAME (name of the variant) before. Optionally, define
+ * BVIBRATR_KERNEL_F16C to use the F16C instructions for the conversion to
+ * and from half precision.
+ *
+ * All delay lines are ring buffers with a size of a power of 2. Position is
+ * the index of the front (newest) sample before writing the block. The
+ * sample i of a block is stored at (position - 1 - i) & mask.
+ */
+
+/**
+Writes n samples into a delay line.
+@param data     Delay line data.
+@param mask     Delay line size - 1.
+@param position Index of the front sample before writing.
+@param in       Input samples.
+@param n        Number of samples.
+*/
+template <class T>
+BVIBRATR_KERNEL_TARGET static void delay_write (T* __restrict data, const size_t mask, const size_t position, const T* __restrict in, const uint32_t n)
+{
+    uint32_t i = 0;
+    while (i < n)
+    {
+        // Copy in contiguous (reverse order) segments until wrap
+        const size_t p = (position - 1 - i) & mask;
+        const uint32_t m = ((n - i) < p + 1 ? n - i : p + 1);
+        T* __restrict dst = data + p;
+        const T* __restrict src = in + i;
+        for (uint32_t j = 0; j < m; ++j) *(dst - j) = src[j];
+        i += m;
+    }
+}
+
+/**
+Reads n samples from a delay line with a fixed delay.
+@param data     Delay line data.
+@param mask     Delay line size - 1.
+@param position Index of the front sample before writing the block.
+@param delay    Delay in samples.
+@param out      Output samples.
+@param n        Number of samples.
+*/
+template <class T>
+BVIBRATR_KERNEL_TARGET static void delay_read_fixed (const T* __restrict data, const size_t mask, const size_t position, const size_t delay, T* __restrict out, const uint32_t n)
+{
+    uint32_t i = 0;
+    while (i < n)
+    {
+        const size_t p = (position - 1 - i + delay) & mask;
+        const uint32_t m = ((n - i) < p + 1 ? n - i : p + 1);
+        const T* __restrict src = data + p;
+        T* __restrict dst = out + i;
+        for (uint32_t j = 0; j < m; ++j) dst[j] = *(src - j);
+        i += m;
+    }
+}
+
+/**
+Reads n samples from a delay line with a variable delay for each sample.
+Non-integer delays are truncated.
+@param data     Delay line data.
+@param mask     Delay line size - 1. Must be < 2^32.
+@param position Index of the front sample before writing the block.
+@param delay    Delays in samples.
+@param out      Output samples.
+@param n        Number of samples.
+*/
+template <class T>
+BVIBRATR_KERNEL_TARGET static void delay_read (const T* __restrict data, const size_t mask, const size_t position, const float* __restrict delay, T* __restrict out, const uint32_t n)
+{
+    // 32 bit index arithmetics is sufficient as the delay line size is a power of 2
+    const uint32_t m = mask;
+    const uint32_t p = position - 1;
+    for (uint32_t i = 0; i < n; ++i)
+    {
+        const uint32_t idx = (p - i + static_cast<uint32_t>(static_cast<int32_t>(delay[i]))) & m;
+        out[i] = data[idx];
+    }
+}
+
+/**
+Mixes dry and amplified wet signal.
+@param dry      Dry samples.
+@param wet      Wet samples.
+@param amp      Amplification of the wet samples.
+@param drywet   Dry/wet mix, range [0.0, 1.0] with 0.0 is dry.
+@param out      Output samples.
+@param n        Number of samples.
+*/
+BVIBRATR_KERNEL_TARGET static void mix (const float* __restrict dry, const float* __restrict wet, const float* __restrict amp, const float* __restrict drywet, float* __restrict out, const uint32_t n)
+{
+    for (uint32_t i = 0; i < n; ++i) out[i] = (1.0f - drywet[i]) * dry[i] + drywet[i] * (amp[i] * wet[i]);
+}
+
+/**
+Converts n samples from single to half precision.
+@param in       Single precision samples.
+@param out      Half precision samples.
+@param n        Number of samples.
+*/
+BVIBRATR_KERNEL_TARGET static void to_half (const float* __restrict in, uint16_t* __restrict out, const uint32_t n)
+{
+    uint32_t i = 0;
+#ifdef BVIBRATR_KERNEL_F16C
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m128i h = _mm256_cvtps_ph (_mm256_loadu_ps (in + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128 (reinterpret_cast<__m128i*>(out + i), h);
+    }
+#endif
+    for (; i < n; ++i) out[i] = float_to_half (in[i]);
+}
+
+/**
+Converts n samples from half to single precision.
+@param in       Half precision samples.
+@param out      Single precision samples.
+@param n        Number of samples.
+*/
+BVIBRATR_KERNEL_TARGET static void from_half (const uint16_t* __restrict in, float* __restrict out, const uint32_t n)
+{
+    uint32_t i = 0;
+#ifdef BVIBRATR_KERNEL_F16C
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m128i h = _mm_loadu_si128 (reinterpret_cast<const __m128i*>(in + i));
+        _mm256_storeu_ps (out + i, _mm256_cvtph_ps (h));
+    }
+#endif
+    for (; i < n; ++i) out[i] = half_to_float (in[i]);
+}
+
+/**
+Writes n samples into a delay line with half precision storage.
+@param data     Delay line data.
+@param mask     Delay line size - 1.
+@param position Index of the front sample before writing.
+@param in       Input samples.
+@param n        Number of samples.
+*/
+BVIBRATR_KERNEL_TARGET static void delay_write_half (uint16_t* __restrict data, const size_t mask, const size_t position, const float* __restrict in, const uint32_t n)
+{
+    uint16_t tmp[BVIBRATR_KERNEL_TMP_SIZE];
+    for (uint32_t i = 0; i < n; i += BVIBRATR_KERNEL_TMP_SIZE)
+    {
+        const uint32_t m = ((n - i) < BVIBRATR_KERNEL_TMP_SIZE ? n - i : BVIBRATR_KERNEL_TMP_SIZE);
+        to_half (in + i, tmp, m);
+        delay_write<uint16_t> (data, mask, position - i, tmp, m);
+    }
+}
+
+/**
+Reads n samples from a delay line with half precision storage and a fixed
+delay.
+@param data     Delay line data.
+@param mask     Delay line size - 1.
+@param position Index of the front sample before writing the block.
+@param delay    Delay in samples.
+@param out      Output samples.
+@param n        Number of samples.
+*/
+BVIBRATR_KERNEL_TARGET static void delay_read_fixed_half (const uint16_t* __restrict data, const size_t mask, const size_t position, const size_t delay, float* __restrict out, const uint32_t n)
+{
+    uint16_t tmp[BVIBRATR_KERNEL_TMP_SIZE];
+    for (uint32_t i = 0; i < n; i += BVIBRATR_KERNEL_TMP_SIZE)
+    {
+        const uint32_t m = ((n - i) < BVIBRATR_KERNEL_TMP_SIZE ? n - i : BVIBRATR_KERNEL_TMP_SIZE);
+        delay_read_fixed<uint16_t> (data, mask, position - i, delay, tmp, m);
+        from_half (tmp, out + i, m);
+    }
+}
+
+/**
+Reads n samples from a delay line with half precision storage and a
+variable delay for each sample. Non-integer delays are truncated.
+@param data     Delay line data.
+@param mask     Delay line size - 1. Must be < 2^32.
+@param position Index of the front sample before writing the block.
+@param delay    Delays in samples.
+@param out      Output samples.
+@param n        Number of samples.
+*/
+BVIBRATR_KERNEL_TARGET static void delay_read_half (const uint16_t* __restrict data, const size_t mask, const size_t position, const float* __restrict delay, float* __restrict out, const uint32_t n)
+{
+    uint16_t tmp[BVIBRATR_KERNEL_TMP_SIZE];
+    for (uint32_t i = 0; i < n; i += BVIBRATR_KERNEL_TMP_SIZE)
+    {
+        const uint32_t m = ((n - i) < BVIBRATR_KERNEL_TMP_SIZE ? n - i : BVIBRATR_KERNEL_TMP_SIZE);
+        delay_read<uint16_t> (data, mask, position - i, delay + i, tmp, m);
+        from_half (tmp, out + i, m);
+    }
+}
+
+/**
+Computes the modulation from external signals instead of the oscillators
+and the ADSR. The pitch signal is limited to [-1.0, 1.0] and integrated to
+the temporal shift (limited to [-max_shift, max_shift]). The integration
+is done in blocks of 8 frames: The partial sums within a block don't depend
+on the shift before, thus only one addition per block is on the critical
+path. Blocks which would exceed the max. shift are integrated frame by
+frame.
+@param pitch        Pitch signal or nullptr for 0.0.
+@param tremolo      Tremolo signal or nullptr to use the pitch signal.
+@param gain         Shift per frame for a pitch signal of 1.0.
+@param tremolo_gain Tremolo depth.
+@param max_shift    Max. absolute shift.
+@param offset       Delay for a shift of 0.0.
+@param shift        Shift before the first frame. Output: Shift after the
+                    last frame.
+@param signal       Output: Limited pitch signal.
+@param shifts       Output: Shift.
+@param delay        Output: Delay (offset + shift) for delay_read().
+@param amp          Output: Tremolo gain.
+@param n            Number of frames.
+*/
+BVIBRATR_KERNEL_TARGET static void modulate_external   (const float* __restrict pitch, const float* __restrict tremolo, const float gain,
+                                                        const float tremolo_gain, const double max_shift, const double offset, double& shift,
+                                                        float* __restrict signal, float* __restrict shifts, float* __restrict delay,
+                                                        float* __restrict amp, const uint32_t n)
+{
+    // Limit the signal and compute the tremolo
+    if (pitch) for (uint32_t i = 0; i < n; ++i) signal[i] = (pitch[i] < -1.0f ? -1.0f : (pitch[i] > 1.0f ? 1.0f : pitch[i]));
+    else for (uint32_t i = 0; i < n; ++i) signal[i] = 0.0f;
+    const float* __restrict t = (tremolo ? tremolo : signal);
+    for (uint32_t i = 0; i < n; ++i) amp[i] = 1.0f - tremolo_gain * t[i];
+
+    // Integrate
+    double s = shift;
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        double sum[8];
+        double acc = 0.0;
+        for (int j = 0; j < 8; ++j)
+        {
+            acc += static_cast<double>(gain * signal[i + j]);
+            sum[j] = acc;
+        }
+
+        double lo = sum[0];
+        double hi = sum[0];
+        for (int j = 1; j < 8; ++j)
+        {
+            lo = (sum[j] < lo ? sum[j] : lo);
+            hi = (sum[j] > hi ? sum[j] : hi);
+        }
+
+        if ((s + hi <= max_shift) && (s + lo >= -max_shift))
+        {
+            for (int j = 0; j < 8; ++j) shifts[i + j] = s + sum[j];
+            s += sum[7];
+        }
+
+        else
+        {
+            for (int j = 0; j < 8; ++j)
+            {
+                s += static_cast<double>(gain * signal[i + j]);
+                s = (s < -max_shift ? -max_shift : (s > max_shift ? max_shift : s));
+                shifts[i + j] = s;
+            }
+        }
+    }
+
+    for (; i < n; ++i)
+    {
+        s += static_cast<double>(gain * signal[i]);
+        s = (s < -max_shift ? -max_shift : (s > max_shift ? max_shift : s));
+        shifts[i] = s;
+    }
+    shift = s;
+
+    // Delays (truncated like in BVibratrEngine::modulate())
+    for (uint32_t i = 0; i < n; ++i) delay[i] = static_cast<int32_t>(offset + shifts[i]);
+}
+
+static const Kernels kernels =
+{
+    BVIBRATR_KERNEL_NAME,
+    &delay_write<float>,
+    &delay_read_fixed<float>,
+    &delay_read<float>,
+    &mix,
+    &delay_write_half,
+    &delay_read_fixed_half,
+    &delay_read_half,
+    &modulate_external
+};
@@ -1,5 +1,9 @@
+#ifndef LFO_HPP_
+#define LFO_HPP_
+
 #include <cmath>
 #include <functional>
+#include "SharedTables.hpp"
 
 template <class T>
 class LFO
@@ -64,6 +68,20 @@ public:
     */
     T get_phase_shift () const;
 
+    /**
+    Gets the LFO phase (without the phase offset).
+    @return Phase in the range [0.0, 1.0).
+    */
+    T get_phase () const;
+
+    /**
+    Sets a sine table for the SINE waveform. Faster than std::sin, but not
+    exact (see SineTable). The table isn't owned by the LFO and must outlive
+    it (and its copies).
+    @param table    Pointer to the table or nullptr (default) to use std::sin.
+    */
+    void set_sine_table (const SineTable* table);
+
     /**
     Starts the LFO and applies scheduled changes.
     */
@@ -119,6 +137,7 @@ protected:
     T phase_;
     T shift_;
     bool active_;
+    const SineTable* sine_;
 
     std::array<std::pair<std::function<void(LFO<T>&, void*)>, void*>, STOP + 1> callbacks_;
 
@@ -145,7 +164,8 @@ template <class T> inline LFO<T>::LFO (const Waveform waveform, const T freq) :
     freq_(freq), 
     phase_(0.0), 
     shift_(0.0),
-    active_(false)
+    active_(false),
+    sine_(nullptr)
 {
     callbacks_.fill(std::pair<std::function<void(LFO<T>&, void*)>, void*>(&defaultCallback_, nullptr));
 }
@@ -166,6 +186,10 @@ template <class T> inline void LFO<T>::set_phase_shift (const T shift) {shift_ =
 
 template <class T> inline T LFO<T>::get_phase_shift () const {return shift_;}
 
+template <class T> inline T LFO<T>::get_phase () const {return phase_;}
+
+template <class T> inline void LFO<T>::set_sine_table (const SineTable* table) {sine_ = table;}
+
 template <class T> inline void LFO<T>::start () 
 {
     phase_ = 0.0;
@@ -201,7 +225,7 @@ template <class T> inline T LFO<T>::get_value () const
     const T x = phase_ + shift_ - floor(phase_ + shift_);
     switch (waveform_) 
     {
-        case SINE:     return -std::cos (2.0 * M_PI * x);
+        case SINE:     return (sine_ ? -sine_->cos (x) : -std::cos (2.0 * M_PI * x));
 
         case TRIANGLE: return x < 0.25 ? 
                               4.0 * x : 
@@ -222,7 +246,7 @@ template <class T> inline T LFO<T>::get_integral () const
     const T x = phase_ + shift_ - floor(phase_ + shift_);
     switch (waveform_) 
     {
-        case SINE:     return std::sin (2.0 * M_PI * x);
+        case SINE:     return (sine_ ? sine_->sin (x) : std::sin (2.0 * M_PI * x));
 
         case TRIANGLE:  {
                             const int sec = x * 4.0;
@@ -262,4 +286,6 @@ template <class T> void LFO<T>::removeCallbackFunction(const typename LFO<T>::Ev
 template <class T> void LFO<T>::on_event_(const typename LFO<T>::Event event)
 {
     callbacks_[event].first(*this, callbacks_[event].second);
-}
\ No newline at end of file
+}
+
+#endif /* LFO_HPP_ */
@@ -0,0 +1,335 @@
+#ifndef MODULATIONBUS_HPP_
+#define MODULATIONBUS_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#define MODULATIONBUS_GROUPS 16			// Number of groups per process
+#define MODULATIONBUS_SIZE 32768		// Frames of modulation history, power of 2
+#define MODULATIONBUS_MAX_WRITE 256		// Max. frames per write()
+
+/**
+Shares the modulation (temporal shift, its integer delay, tremolo gain and
+signal) of a modulation group between the instances of the group in the same process.
+The modulation is rendered once per cycle by the first instance of the
+group to run in this cycle. It writes the modulation of its block into a
+ring buffer and publishes the block with the cycle number as stamp. The
+other instances of the cycle only read the block. The state of the
+modulator (State) is passed from each rendering instance to the next.
+
+Each instance counts the cycles it consumed. An instance which already
+consumed the last published block renders the next one. An instance which
+didn't reads the last published block. Thus, the instances may run in any
+order or in parallel. A joining instance starts with reading the last
+published block if it was published less than half a block ago (i.e., in
+this cycle if run in realtime), otherwise with rendering the next one. The
+first instance of an empty group starts with rendering.
+
+Lock-free and never waits: An instance which finds another one still
+rendering the block of this cycle skips the block. It may copy the state
+the block is rendered from and render the same block on its own. The frames
+are atomic. Readers detect if the frames or the copied state were
+overwritten during reading (like a seqlock). The state is double buffered:
+The instance rendering a block reads the state of the previous block and
+saves the state of its block to the other buffer.
+
+The buses are static (see get_modulation_buses()) and the memory is only
+committed for the used groups.
+*/
+template <class State>
+class ModulationBus
+{
+public:
+	enum Role
+	{
+		NONE,	// Neither reading nor rendering (another instance renders)
+		READ,	// Read the last published block
+		RENDER	// Render and publish the next block
+	};
+
+	/**
+	Joins the group. Takes the sample rate if the group was empty.
+	@param samplerate	Sample rate of the instance.
+	@return				Cycle to start with for begin().
+	*/
+	uint64_t join (const double samplerate);
+
+	/**
+	Leaves the group. The state is dropped if the group becomes empty.
+	*/
+	void leave ();
+
+	/**
+	@return	Sample rate of the first instance of the group.
+	*/
+	double get_samplerate () const;
+
+	/**
+	Starts a block of an instance. Either takes the rendering of the next
+	block or returns the last published block to read. Doesn't wait if
+	another instance is rendering the next block: The block is skipped
+	then (NONE). Realtime safe.
+	@param cycle	Last cycle consumed by the instance. Output: Cycle of
+					this block.
+	@param end		Output: Position after the last frame of the last
+					published block (READ and NONE) or the first frame to
+					render (RENDER).
+	@return			Role of the instance in this cycle.
+	*/
+	Role begin (uint64_t& cycle, int64_t& end);
+
+	/**
+	Tests if the state of the last published block was saved since the
+	group became non-empty. RENDER only.
+	@return	True if the state was saved.
+	*/
+	bool has_state () const;
+
+	/**
+	Gets the state of the modulator after the last published block (the
+	start of this block). RENDER only.
+	@return	Reference to the state.
+	*/
+	const State& get_state () const;
+
+	/**
+	Gets the state of the modulator after this block, to be saved before
+	publish(). RENDER only.
+	@return	Reference to the state.
+	*/
+	State& get_next_state ();
+
+	/**
+	Copies the state the skipped block is rendered from. NONE only.
+	Realtime safe.
+	@param cycle	Cycle of the skipped block (see begin()).
+	@param state	Output: State. Undefined on failure.
+	@return			True on success, false if no state was saved or if it
+					was overwritten meanwhile.
+	*/
+	bool copy_state (const uint64_t cycle, State& state) const;
+
+	/**
+	Writes the modulation of the next frames of the block. RENDER only.
+	@param shift	Temporal shift in frames.
+	@param amp		Tremolo gain.
+	@param signal	Modulation signal.
+	@param delay	Integer part of the temporal shift as applied by the
+					rendering instance (from the unrounded shift).
+	@param n		Number of frames, <= MODULATIONBUS_MAX_WRITE.
+	*/
+	void write (const float* shift, const float* amp, const float* signal, const float* delay, const uint32_t n);
+
+	/**
+	Marks the state as saved and publishes the written frames as the block
+	of this cycle. RENDER only.
+	*/
+	void publish ();
+
+	/**
+	Reads written frames. Frames before the start of the group (negative
+	positions) are read as no modulation.
+	@param position	Position of the first frame.
+	@param n		Number of frames.
+	@param shift	Output: Temporal shift in frames.
+	@param amp		Output: Tremolo gain.
+	@param signal	Output: Modulation signal.
+	@param delay	Output: Integer part of the temporal shift.
+	@return			True on success, false if the frames are not written
+					yet or were overwritten. The output is undefined then.
+	*/
+	bool read (const int64_t position, const uint32_t n, float* shift, float* amp, float* signal, float* delay) const;
+
+protected:
+	std::atomic<int> members_;
+	std::atomic<uint64_t> session_;					// Incremented if the group becomes empty
+	std::atomic<double> samplerate_;
+	alignas (64) std::atomic<uint64_t> stamp_;		// 2 * last published cycle (+ 1 while rendering the next)
+	std::atomic<int64_t> end_;						// Position after the last published frame
+	std::atomic<int64_t> written_;					// Position after the last written frame
+	std::atomic<int64_t> frames_;					// Size of the last published block
+	std::atomic<int64_t> time_;						// Time of publishing the last block in ns
+	alignas (64) std::atomic<float> shift_[MODULATIONBUS_SIZE];
+	std::atomic<float> amp_[MODULATIONBUS_SIZE];
+	std::atomic<float> signal_[MODULATIONBUS_SIZE];
+	std::atomic<float> delay_[MODULATIONBUS_SIZE];
+	State state_[2];								// Indexed by cycle & 1
+	uint64_t state_session_[2];						// Session of the saved state + 1, 0 if none
+
+	bool is_valid_ (const int64_t position, const uint32_t n, const int64_t written) const;
+	static int64_t now_ ();
+};
+
+/**
+Gets the buses of all modulation groups. The first call constructs them
+(not realtime safe, e.g., call on instantiation and keep the pointer).
+@return	Array of MODULATIONBUS_GROUPS buses, group 1 first.
+*/
+template <class State>
+inline ModulationBus<State>* get_modulation_buses ()
+{
+	static ModulationBus<State> buses[MODULATIONBUS_GROUPS];
+	return buses;
+}
+
+/**
+Gets the bus of a modulation group. See get_modulation_buses().
+@param group	Group number, 1 to MODULATIONBUS_GROUPS.
+@return			Pointer to the bus or nullptr if group is out of range.
+*/
+template <class State>
+inline ModulationBus<State>* get_modulation_bus (const int group)
+{
+	return ((group >= 1) && (group <= MODULATIONBUS_GROUPS) ? &get_modulation_buses<State> ()[group - 1] : nullptr);
+}
+
+template <class State>
+inline uint64_t ModulationBus<State>::join (const double samplerate)
+{
+	const bool first = (members_.fetch_add (1, std::memory_order_acq_rel) == 0);
+	if (first) samplerate_.store (samplerate, std::memory_order_relaxed);
+
+	const uint64_t cycle = stamp_.load (std::memory_order_acquire) / 2;
+	if (first || (cycle == 0)) return cycle;
+
+	const int64_t age = now_ () - time_.load (std::memory_order_relaxed);
+	return (1e-9 * age * samplerate > 0.5 * frames_.load (std::memory_order_relaxed) ? cycle : cycle - 1);
+}
+
+template <class State>
+inline void ModulationBus<State>::leave ()
+{
+	if (members_.fetch_sub (1, std::memory_order_acq_rel) == 1) session_.fetch_add (1, std::memory_order_acq_rel);
+}
+
+template <class State>
+inline double ModulationBus<State>::get_samplerate () const {return samplerate_.load (std::memory_order_relaxed);}
+
+template <class State>
+inline typename ModulationBus<State>::Role ModulationBus<State>::begin (uint64_t& cycle, int64_t& end)
+{
+	// Only repeats if another instance published or took a block meanwhile
+	while (true)
+	{
+		const uint64_t stamp = stamp_.load (std::memory_order_acquire);
+		const uint64_t published = stamp / 2;
+		if (cycle > published) cycle = published;	// Bus reset
+
+		// Not consumed yet
+		if (cycle < published)
+		{
+			end = end_.load (std::memory_order_acquire);
+			if (stamp_.load (std::memory_order_relaxed) / 2 != published) continue;
+			cycle = published;
+			return READ;
+		}
+
+		// Another instance renders the next block: Skip it
+		if (stamp & 1)
+		{
+			end = end_.load (std::memory_order_acquire);
+			if (stamp_.load (std::memory_order_relaxed) != stamp) continue;
+			cycle = published + 1;
+			return NONE;
+		}
+
+		// Take the next block
+		uint64_t expected = stamp;
+		if (stamp_.compare_exchange_strong (expected, stamp + 1, std::memory_order_acq_rel))
+		{
+			cycle = published + 1;
+			end = written_.load (std::memory_order_relaxed);
+			return RENDER;
+		}
+	}
+}
+
+template <class State>
+inline bool ModulationBus<State>::has_state () const
+{
+	const uint64_t published = stamp_.load (std::memory_order_relaxed) / 2;
+	return state_session_[published & 1] == session_.load (std::memory_order_acquire) + 1;
+}
+
+template <class State>
+inline const State& ModulationBus<State>::get_state () const {return state_[(stamp_.load (std::memory_order_relaxed) / 2) & 1];}
+
+template <class State>
+inline State& ModulationBus<State>::get_next_state () {return state_[(stamp_.load (std::memory_order_relaxed) / 2 + 1) & 1];}
+
+template <class State>
+inline bool ModulationBus<State>::copy_state (const uint64_t cycle, State& state) const
+{
+	// Saved before publishing the previous block (see begin())
+	const size_t idx = (cycle - 1) & 1;
+	if (state_session_[idx] != session_.load (std::memory_order_acquire) + 1) return false;
+	state = state_[idx];
+
+	// Overwritten if the block after the skipped one was taken meanwhile
+	std::atomic_thread_fence (std::memory_order_acquire);
+	return stamp_.load (std::memory_order_relaxed) <= 2 * cycle;
+}
+
+template <class State>
+inline void ModulationBus<State>::write (const float* shift, const float* amp, const float* signal, const float* delay, const uint32_t n)
+{
+	const int64_t position = written_.load (std::memory_order_relaxed);
+	for (uint32_t i = 0; i < n; ++i)
+	{
+		const size_t idx = static_cast<uint64_t>(position + i) & (MODULATIONBUS_SIZE - 1);
+		shift_[idx].store (shift[i], std::memory_order_relaxed);
+		amp_[idx].store (amp[i], std::memory_order_relaxed);
+		signal_[idx].store (signal[i], std::memory_order_relaxed);
+		delay_[idx].store (delay[i], std::memory_order_relaxed);
+	}
+	written_.store (position + n, std::memory_order_release);
+}
+
+template <class State>
+inline void ModulationBus<State>::publish ()
+{
+	state_session_[(stamp_.load (std::memory_order_relaxed) / 2 + 1) & 1] = session_.load (std::memory_order_acquire) + 1;
+	const int64_t written = written_.load (std::memory_order_relaxed);
+	frames_.store (written - end_.load (std::memory_order_relaxed), std::memory_order_relaxed);
+	end_.store (written, std::memory_order_relaxed);
+	time_.store (now_ (), std::memory_order_relaxed);
+	stamp_.fetch_add (1, std::memory_order_release);
+}
+
+template <class State>
+inline bool ModulationBus<State>::read (const int64_t position, const uint32_t n, float* shift, float* amp, float* signal, float* delay) const
+{
+	if (!is_valid_ (position, n, written_.load (std::memory_order_acquire))) return false;
+
+	for (uint32_t i = 0; i < n; ++i)
+	{
+		const int64_t p = position + i;
+		const size_t idx = static_cast<uint64_t>(p) & (MODULATIONBUS_SIZE - 1);
+		shift[i] = (p >= 0 ? shift_[idx].load (std::memory_order_relaxed) : 0.0f);
+		amp[i] = (p >= 0 ? amp_[idx].load (std::memory_order_relaxed) : 1.0f);
+		signal[i] = (p >= 0 ? signal_[idx].load (std::memory_order_relaxed) : 0.0f);
+		delay[i] = (p >= 0 ? delay_[idx].load (std::memory_order_relaxed) : 0.0f);
+	}
+
+	// Check if the frames were overwritten in the meantime
+	std::atomic_thread_fence (std::memory_order_acquire);
+	return is_valid_ (position, n, written_.load (std::memory_order_relaxed));
+}
+
+template <class State>
+inline bool ModulationBus<State>::is_valid_ (const int64_t position, const uint32_t n, const int64_t written) const
+{
+	// Written and not within the range of the next write
+	return	(position + n <= written) &&
+			(position + MODULATIONBUS_SIZE >= written + MODULATIONBUS_MAX_WRITE);
+}
+
+template <class State>
+inline int64_t ModulationBus<State>::now_ ()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds> (std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#endif /* MODULATIONBUS_HPP_ */
@@ -44,6 +44,39 @@ enum BVibratrControllers
 	BVIBRATR_LATENCY			= 22	// Output controller!
 };
 
+// Optional plugin ports as declared in the .ttl file, following the
+// controllers
+enum BVibratrOptionalPorts
+{
+	BVIBRATR_NOTIFY				= 28,	// Statistics (atom output)
+	BVIBRATR_MIDI_OUT			= 29,	// Pitch bend and MIDI thru (atom output)
+	BVIBRATR_VIBRATO_OUTPUT		= 30,	// BVibratrVibratoOutputs
+	BVIBRATR_BEND_RATE			= 31,	// Pitch bend messages per second
+	BVIBRATR_BEND_RANGE			= 32,	// Pitch bend range in semitones
+	BVIBRATR_BEND_CHANNEL		= 33,	// 0 = channel of the trigger note (MPE), 1 to 16
+	BVIBRATR_CV_MODULATION		= 34,	// Modulation signal (CV output)
+	BVIBRATR_CV_TREMOLO			= 35,	// Tremolo gain (CV output)
+	BVIBRATR_CV_SHIFT			= 36,	// Temporal shift in frames (CV output)
+	BVIBRATR_CV_PITCH_IN		= 37,	// External pitch modulation (CV input)
+	BVIBRATR_CV_TREMOLO_IN		= 38,	// External tremolo modulation (CV input)
+	BVIBRATR_MODULATION_GROUP	= 39,	// 0 = none, 1 to 16 = shared modulation group
+	BVIBRATR_MODULATION_OFFSET	= 40,	// Delay of the shared modulation in ms
+	BVIBRATR_MODULATION_SOURCE	= 41	// BVibratrModulationSources
+};
+
+enum BVibratrVibratoOutputs
+{
+	BVIBRATR_VIBRATO_OUTPUT_AUDIO		= 0,	// Delay lines
+	BVIBRATR_VIBRATO_OUTPUT_PITCH_BEND	= 1		// Pitch bend via MIDI_OUT, audio passes through
+};
+
+enum BVibratrModulationSources
+{
+	BVIBRATR_MODULATION_SOURCE_INTERNAL	= 0,	// Oscillators and envelope
+	BVIBRATR_MODULATION_SOURCE_CV_PITCH	= 1,	// CV_PITCH_IN for pitch and tremolo
+	BVIBRATR_MODULATION_SOURCE_CV		= 2		// CV_PITCH_IN for pitch, CV_TREMOLO_IN for tremolo
+};
+
 enum BVibratrOscModes
 {
 	BVIBRATR_OSC_MODE_PASS		= 1,
@@ -0,0 +1,153 @@
+#ifndef PROFILER_HPP_
+#define PROFILER_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "CycleStats.hpp"
+
+/**
+Processing stages of the engine. Zones may be nested (e.g., oscillators and
+ADSR within modulation, all zones within run).
+*/
+enum ProfileZone
+{
+    PROFILE_RUN             = 0,    // Whole run() call
+    PROFILE_CONTROLLERS     = 1,    // Controller ingestion
+    PROFILE_MIDI            = 2,    // MIDI dispatch
+    PROFILE_MODULATION      = 3,    // Modulation, incl. oscillators and ADSR
+    PROFILE_OSCILLATORS     = 4,    // Oscillator chain (per sample)
+    PROFILE_ADSR            = 5,    // ADSR (per sample)
+    PROFILE_DELAY_WRITE     = 6,
+    PROFILE_DELAY_READ      = 7,
+    PROFILE_MIX             = 8,    // Output mix
+    PROFILE_NR_ZONES        = 9
+};
+
+static const char* const profile_zone_names[PROFILE_NR_ZONES] =
+{
+    "run", "controllers", "midi", "modulation", "oscillators", "adsr", "delay_write", "delay_read", "mix"
+};
+
+/**
+Copy of the profiling data for the reader.
+*/
+struct ProfileSnapshot
+{
+    uint64_t cycles[PROFILE_NR_ZONES];  // Sum of the cycles in each zone
+    uint64_t calls[PROFILE_NR_ZONES];   // Number of times each zone was entered
+};
+
+/**
+Cycle counts of the processing stages. Filled by a single (realtime)
+writer thread via the BVIBRATR_PROFILE_* macros. Any number of non-realtime
+reader threads may call get() and reset().
+*/
+class Profiler
+{
+public:
+    Profiler ();
+
+    void begin (const ProfileZone zone);
+    void end (const ProfileZone zone);
+    void add (const ProfileZone zone, const uint64_t cycles);
+
+    /**
+    Copies the profiling data since the last reset(). Reader only.
+    @param snapshot Target.
+    */
+    void get (ProfileSnapshot& snapshot) const;
+
+    /**
+    Resets the profiling data for the reader. Doesn't touch the data of the
+    writer. Reader only.
+    */
+    void reset ();
+
+protected:
+    uint64_t start_[PROFILE_NR_ZONES];                  // Writer only
+    std::atomic<uint64_t> cycles_[PROFILE_NR_ZONES];
+    std::atomic<uint64_t> calls_[PROFILE_NR_ZONES];
+    std::atomic<uint64_t> base_cycles_[PROFILE_NR_ZONES];   // Reader only
+    std::atomic<uint64_t> base_calls_[PROFILE_NR_ZONES];    // Reader only
+};
+
+/**
+Scoped profiling zone. Adds the cycles from construction to destruction.
+*/
+class ProfileScope
+{
+public:
+    ProfileScope (Profiler& profiler, const ProfileZone zone) :
+        profiler_ (profiler), zone_ (zone), start_ (CycleStats::now ()) {}
+
+    ProfileScope (const ProfileScope& that) = delete;
+    ~ProfileScope () {profiler_.add (zone_, CycleStats::now () - start_);}
+
+    ProfileScope& operator= (const ProfileScope& that) = delete;
+
+protected:
+    Profiler& profiler_;
+    ProfileZone zone_;
+    uint64_t start_;
+};
+
+inline Profiler::Profiler ()
+{
+    for (size_t i = 0; i < PROFILE_NR_ZONES; ++i)
+    {
+        start_[i] = 0;
+        cycles_[i].store (0, std::memory_order_relaxed);
+        calls_[i].store (0, std::memory_order_relaxed);
+        base_cycles_[i].store (0, std::memory_order_relaxed);
+        base_calls_[i].store (0, std::memory_order_relaxed);
+    }
+}
+
+inline void Profiler::begin (const ProfileZone zone) {start_[zone] = CycleStats::now ();}
+
+inline void Profiler::end (const ProfileZone zone) {add (zone, CycleStats::now () - start_[zone]);}
+
+inline void Profiler::add (const ProfileZone zone, const uint64_t cycles)
+{
+    // Single writer: Plain load and store instead of read-modify-write
+    cycles_[zone].store (cycles_[zone].load (std::memory_order_relaxed) + cycles, std::memory_order_relaxed);
+    calls_[zone].store (calls_[zone].load (std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+inline void Profiler::get (ProfileSnapshot& snapshot) const
+{
+    for (size_t i = 0; i < PROFILE_NR_ZONES; ++i)
+    {
+        snapshot.cycles[i] = cycles_[i].load (std::memory_order_relaxed) - base_cycles_[i].load (std::memory_order_relaxed);
+        snapshot.calls[i] = calls_[i].load (std::memory_order_relaxed) - base_calls_[i].load (std::memory_order_relaxed);
+    }
+}
+
+inline void Profiler::reset ()
+{
+    for (size_t i = 0; i < PROFILE_NR_ZONES; ++i)
+    {
+        base_cycles_[i].store (cycles_[i].load (std::memory_order_relaxed), std::memory_order_relaxed);
+        base_calls_[i].store (calls_[i].load (std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+}
+
+/*
+Profiling zone macros. Expect a Profiler named profiler in the scope. Compile
+to nothing unless BVIBRATR_PROFILE is defined.
+BVIBRATR_PROFILE_ZONE (zone) profiles until the end of the enclosing block.
+BVIBRATR_PROFILE_BEGIN (zone) and BVIBRATR_PROFILE_END (zone) enclose a
+sequence of statements. A zone must not be nested within itself.
+*/
+#ifdef BVIBRATR_PROFILE
+#define BVIBRATR_PROFILE_ZONE(zone) ProfileScope profile_scope_##zone (profiler, zone)
+#define BVIBRATR_PROFILE_BEGIN(zone) profiler.begin (zone)
+#define BVIBRATR_PROFILE_END(zone) profiler.end (zone)
+#else
+#define BVIBRATR_PROFILE_ZONE(zone)
+#define BVIBRATR_PROFILE_BEGIN(zone)
+#define BVIBRATR_PROFILE_END(zone)
+#endif
+
+#endif /* PROFILER_HPP_ */
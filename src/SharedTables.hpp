@@ -0,0 +1,87 @@
+#ifndef SHAREDTABLES_HPP_
+#define SHAREDTABLES_HPP_
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+
+#define SINETABLE_SIZE 1024     // Table entries for a full phase, must be a power of 2
+
+/**
+Gets a process-wide shared read-only table of the type Table. The table is
+lazily constructed on the first request and destructed if the last
+reference is released. Thread-safe, but may allocate and block. Thus, don't
+call from realtime threads. Acquire the table in advance (e.g., in
+instantiate) instead and keep the returned pointer.
+
+Note: Each shared object (plugin DSP, plugin GUI) has its own registry.
+Only the GUI previews use tables yet. The DSP doesn't, as none of the tables
+reproduces its results bit by bit.
+@return Shared pointer to the table.
+@throws std::bad_alloc if the table can't be constructed.
+*/
+template <class Table>
+inline std::shared_ptr<const Table> get_shared_table ()
+{
+    static std::mutex mutex;
+    static std::weak_ptr<const Table> registered;
+
+    std::lock_guard<std::mutex> lock (mutex);
+    std::shared_ptr<const Table> table = registered.lock ();
+    if (!table)
+    {
+        table = std::make_shared<const Table> ();
+        registered = table;
+    }
+    return table;
+}
+
+/**
+Sine table. Sine and cosine values are calculated from the nearest table
+entries using a Taylor series of the 3rd order. The max. error is about
+1e-10.
+*/
+class SineTable
+{
+public:
+    SineTable ();
+
+    /**
+    Gets sin (2 * pi * x).
+    @param x    Position in phases.
+    @return     Sine value.
+    */
+    template <class T> T sin (const T x) const;
+
+    /**
+    Gets cos (2 * pi * x).
+    @param x    Position in phases.
+    @return     Cosine value.
+    */
+    template <class T> T cos (const T x) const;
+
+protected:
+    std::array<double, SINETABLE_SIZE> data_;
+};
+
+inline SineTable::SineTable ()
+{
+    for (size_t i = 0; i < SINETABLE_SIZE; ++i) data_[i] = std::sin (2.0 * M_PI * static_cast<double>(i) / SINETABLE_SIZE);
+}
+
+template <class T> inline T SineTable::sin (const T x) const
+{
+    const double pos = static_cast<double>(x) * SINETABLE_SIZE;
+    const double fl = std::floor (pos);
+    const size_t i = static_cast<size_t>(static_cast<long>(fl)) & (SINETABLE_SIZE - 1);
+    const double s = data_[i];
+    const double c = data_[(i + SINETABLE_SIZE / 4) & (SINETABLE_SIZE - 1)];
+    const double d = (pos - fl) * (2.0 * M_PI / SINETABLE_SIZE);
+    return s + d * (c - d * (0.5 * s + d * (1.0 / 6.0) * c));
+}
+
+template <class T> inline T SineTable::cos (const T x) const {return sin (x + T(0.25));}
+
+#endif /* SHAREDTABLES_HPP_ */
@@ -0,0 +1,256 @@
+#ifndef STREAMSCHEDULER_HPP_
+#define STREAMSCHEDULER_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <semaphore.h>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define STREAMSCHEDULER_PAUSE() _mm_pause ()
+#else
+#define STREAMSCHEDULER_PAUSE() std::this_thread::yield ()
+#endif
+
+/**
+Realtime scheduler for processing a large number of stream groups (e.g.,
+BVibratrEngine instances) in each audio cycle on a fixed pool of worker
+threads.
+
+Each worker owns a fixed range of groups and processes the same groups in
+each cycle (cache-affine). Workers are pinned to the CPUs 1, 2, ... The
+calling (audio) thread is worker 0 and isn't pinned by the scheduler. A
+worker takes groups from the front of its own range and, if done, steals
+groups from the back of the other ranges. The ranges are lock-free (a front
+and a back index packed into one atomic). run() returns after all groups
+are done (barrier).
+
+run() doesn't allocate or lock. The workers are woken by semaphores
+(sem_post() only calls the kernel if a worker sleeps) and the caller spins
+on the barrier. Threads are created and destructed in the constructor and
+the destructor, thus construct and destruct outside the audio thread.
+*/
+class StreamScheduler
+{
+public:
+    /**
+    @param groups   Number of stream groups.
+    @param workers  Number of workers including the calling thread, 0 =
+                    number of hardware threads. Limited to groups.
+    @param priority SCHED_FIFO priority of the worker threads, 0 = inherit.
+                    Silently ignored if not permitted.
+    @throws std::system_error if a thread can't be created.
+    */
+    explicit StreamScheduler (const size_t groups, const size_t workers = 0, const int priority = 0);
+    ~StreamScheduler ();
+
+    StreamScheduler (const StreamScheduler&) = delete;
+    StreamScheduler& operator= (const StreamScheduler&) = delete;
+
+    size_t groups () const;
+    size_t workers () const;
+
+    /**
+    Gets the worker which owns a group.
+    @param group    Group number.
+    @return         Worker number.
+    */
+    size_t owner (const size_t group) const;
+
+    /**
+    Processes all groups and blocks until all groups are done. Realtime
+    safe. Don't call concurrently.
+    @param func Function object called with the group and the worker
+                number, must not throw. Not copied, must stay valid until
+                run() returns.
+    */
+    template <class Func> void run (Func& func);
+
+protected:
+    struct alignas (64) Worker
+    {
+        std::atomic<uint64_t> range {0};    // Back (high 32 bits) and front (low 32 bits) index of the remaining groups
+        sem_t wake;
+    };
+
+    size_t groups_;
+    size_t workers_;
+    std::unique_ptr<Worker[]> worker_;
+    std::vector<std::thread> threads_;
+    void (*invoke_) (void* func, size_t group, size_t worker);
+    void* func_;
+    alignas (64) std::atomic<size_t> pending_;
+    std::atomic<bool> stop_;
+
+    static uint64_t pack_ (const uint32_t front, const uint32_t back);
+    template <class Func> static void invoke_func_ (void* func, size_t group, size_t worker);
+    bool take_ (const size_t worker, size_t& group);
+    bool steal_ (const size_t worker, size_t& group);
+    void process_ (const size_t worker);
+    void thread_ (const size_t worker, const int priority);
+    void stop_threads_ ();
+};
+
+inline StreamScheduler::StreamScheduler (const size_t groups, const size_t workers, const int priority) :
+    groups_ (groups),
+    workers_ (std::max<size_t> (1, std::min (groups, (workers ? workers : std::max<size_t> (std::thread::hardware_concurrency (), 1))))),
+    worker_ (new Worker[workers_]),
+    threads_ (),
+    invoke_ (nullptr),
+    func_ (nullptr),
+    pending_ (0),
+    stop_ (false)
+{
+    for (size_t w = 0; w < workers_; ++w) sem_init (&worker_[w].wake, 0, 0);
+
+    try
+    {
+        for (size_t w = 1; w < workers_; ++w) threads_.emplace_back (&StreamScheduler::thread_, this, w, priority);
+    }
+    catch (...)
+    {
+        stop_threads_ ();
+        throw;
+    }
+}
+
+inline StreamScheduler::~StreamScheduler () {stop_threads_ ();}
+
+inline size_t StreamScheduler::groups () const {return groups_;}
+
+inline size_t StreamScheduler::workers () const {return workers_;}
+
+inline size_t StreamScheduler::owner (const size_t group) const {return group * workers_ / groups_;}
+
+template <class Func> inline void StreamScheduler::run (Func& func)
+{
+    if (groups_ == 0) return;
+
+    invoke_ = &invoke_func_<Func>;
+    func_ = &func;
+
+    // Deal the groups in contiguous ranges: group g belongs to worker
+    // g * workers / groups
+    for (size_t w = 0; w < workers_; ++w)
+    {
+        const uint32_t front = (w * groups_ + workers_ - 1) / workers_;
+        const uint32_t back = ((w + 1) * groups_ + workers_ - 1) / workers_;
+        worker_[w].range.store (pack_ (front, back), std::memory_order_relaxed);
+    }
+
+    pending_.store (workers_ - 1, std::memory_order_relaxed);
+    for (size_t w = 1; w < workers_; ++w) sem_post (&worker_[w].wake);
+
+    process_ (0);
+
+    // Barrier
+    while (pending_.load (std::memory_order_acquire) != 0) STREAMSCHEDULER_PAUSE ();
+}
+
+inline uint64_t StreamScheduler::pack_ (const uint32_t front, const uint32_t back)
+{
+    return (static_cast<uint64_t>(back) << 32) | front;
+}
+
+template <class Func> inline void StreamScheduler::invoke_func_ (void* func, size_t group, size_t worker)
+{
+    (*static_cast<Func*>(func)) (group, worker);
+}
+
+inline bool StreamScheduler::take_ (const size_t worker, size_t& group)
+{
+    std::atomic<uint64_t>& range = worker_[worker].range;
+    uint64_t r = range.load (std::memory_order_acquire);
+    while (true)
+    {
+        const uint32_t front = r;
+        const uint32_t back = r >> 32;
+        if (front >= back) return false;
+        if (range.compare_exchange_weak (r, pack_ (front + 1, back), std::memory_order_acq_rel))
+        {
+            group = front;
+            return true;
+        }
+    }
+}
+
+inline bool StreamScheduler::steal_ (const size_t worker, size_t& group)
+{
+    // Neighbours first
+    for (size_t i = 1; i < workers_; ++i)
+    {
+        std::atomic<uint64_t>& range = worker_[(worker + i) % workers_].range;
+        uint64_t r = range.load (std::memory_order_acquire);
+        while (true)
+        {
+            const uint32_t front = r;
+            const uint32_t back = r >> 32;
+            if (front >= back) break;
+            if (range.compare_exchange_weak (r, pack_ (front, back - 1), std::memory_order_acq_rel))
+            {
+                group = back - 1;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+inline void StreamScheduler::process_ (const size_t worker)
+{
+    size_t group;
+    while (take_ (worker, group)) invoke_ (func_, group, worker);
+    while (steal_ (worker, group)) invoke_ (func_, group, worker);
+}
+
+inline void StreamScheduler::thread_ (const size_t worker, const int priority)
+{
+#ifdef __linux__
+    const unsigned int cpus = std::thread::hardware_concurrency ();
+    if (cpus > 1)
+    {
+        cpu_set_t set;
+        CPU_ZERO (&set);
+        CPU_SET (worker % cpus, &set);
+        pthread_setaffinity_np (pthread_self (), sizeof (set), &set);
+    }
+
+    if (priority > 0)
+    {
+        sched_param param = {};
+        param.sched_priority = priority;
+        pthread_setschedparam (pthread_self (), SCHED_FIFO, &param);
+    }
+#else
+    (void) priority;
+#endif
+
+    while (true)
+    {
+        while (sem_wait (&worker_[worker].wake) != 0) {}   // EINTR
+        if (stop_.load (std::memory_order_acquire)) return;
+        process_ (worker);
+        pending_.fetch_sub (1, std::memory_order_release);
+    }
+}
+
+inline void StreamScheduler::stop_threads_ ()
+{
+    stop_.store (true, std::memory_order_release);
+    for (size_t w = 1; w <= threads_.size (); ++w) sem_post (&worker_[w].wake);
+    for (std::thread& t : threads_) t.join ();
+    threads_.clear ();
+    for (size_t w = 0; w < workers_; ++w) sem_destroy (&worker_[w].wake);
+}
+
+#endif /* STREAMSCHEDULER_HPP_ */
@@ -0,0 +1,317 @@
+#ifndef TRACERECORDER_HPP_
+#define TRACERECORDER_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define TRACE_MAGIC "BVTR"
+#define TRACE_VERSION 1
+#define TRACE_RING_SIZE 0x800000        // 8 MB, must be a power of 2
+#define TRACE_DRAIN_INTERVAL_MS 10
+
+/**
+Trace file header. Followed by the records.
+*/
+struct TraceFileHeader
+{
+    char magic[4];          // TRACE_MAGIC
+    uint32_t version;       // TRACE_VERSION
+    double samplerate;
+    uint32_t controllers;   // Number of controller values per run record
+    uint32_t reserved;
+};
+
+enum TraceRecordType
+{
+    TRACE_RUN       = 1,    // run() call
+    TRACE_ACTIVATE  = 2     // activate() call
+};
+
+enum TraceRecordFlags
+{
+    TRACE_AUDIO     = 1     // Record contains the audio input
+};
+
+/**
+Trace record header. Run records are followed by the controller values
+(float), the MIDI events (TraceMidiEvent, each followed by its data padded
+to 4 bytes) and optionally the audio input (float, channel 1 then channel
+2).
+*/
+struct TraceRecordHeader
+{
+    uint32_t type;          // TraceRecordType
+    uint32_t flags;         // TraceRecordFlags
+    uint32_t size;          // Size of the record including this header
+    uint32_t dropped;       // Number of records dropped before this record
+    uint32_t n_samples;
+    uint32_t midi_events;
+};
+
+struct TraceMidiEvent
+{
+    uint32_t frame;
+    uint32_t size;
+};
+
+/**
+Records the input of run() calls to a binary trace file. The realtime
+thread writes the records into a lock-free single producer single
+consumer ring buffer. A non-realtime thread drains the ring buffer to the
+file. Records are dropped (and counted) if the ring buffer is full. The
+realtime thread never blocks, allocates or calls the system.
+
+The writer builds a record with begin_run(), add_midi() and end_run().
+*/
+class TraceRecorder
+{
+public:
+    /**
+    Opens the trace file and starts the drain thread.
+    @param path         Path of the trace file.
+    @param samplerate   Sample rate.
+    @param controllers  Number of controller values per run record.
+    @param audio        True, if the audio input is recorded too.
+    @throws std::runtime_error if the file can't be opened.
+    */
+    TraceRecorder (const std::string& path, const double samplerate, const uint32_t controllers, const bool audio);
+
+    TraceRecorder (const TraceRecorder& that) = delete;
+    ~TraceRecorder ();
+
+    TraceRecorder& operator= (const TraceRecorder& that) = delete;
+
+    bool records_audio () const;
+
+    /**
+    Adds a record of an activate() call. Realtime safe.
+    */
+    void add_activate ();
+
+    /**
+    Starts a record of a run() call. Realtime safe.
+    @param n_samples    Number of samples.
+    @param controllers  Controller values.
+    @return             True if the record fits into the ring buffer.
+    */
+    bool begin_run (const uint32_t n_samples, const float* controllers);
+
+    /**
+    Adds a MIDI event to the record started by begin_run(). Realtime safe.
+    @param frame    Frame.
+    @param data     MIDI message.
+    @param size     Size of the MIDI message.
+    */
+    void add_midi (const uint32_t frame, const uint8_t* data, const uint32_t size);
+
+    /**
+    Completes and publishes the record started by begin_run(). Realtime
+    safe.
+    @param in_1     Audio input channel 1 (ignored if not records_audio()).
+    @param in_2     Audio input channel 2 (ignored if not records_audio()).
+    */
+    void end_run (const float* in_1, const float* in_2);
+
+    /**
+    Gets the number of dropped records.
+    @return Number of dropped records.
+    */
+    uint64_t get_dropped () const;
+
+protected:
+    FILE* file_;
+    uint32_t controllers_;
+    bool audio_;
+    std::vector<uint8_t> ring_;
+    std::atomic<uint64_t> head_;        // Written by the realtime thread
+    std::atomic<uint64_t> tail_;        // Written by the drain thread
+    uint64_t record_start_;
+    uint64_t record_end_;
+    bool record_valid_;
+    uint32_t record_n_samples_;
+    uint32_t record_dropped_;
+    uint32_t record_midi_events_;
+    std::atomic<uint64_t> dropped_;
+    std::atomic<bool> running_;
+    std::thread thread_;
+
+    bool reserve_ (const size_t size) const;
+    void write_ (const uint64_t position, const void* data, const size_t size);
+    void drain_ ();
+    void thread_function_ ();
+};
+
+inline TraceRecorder::TraceRecorder (const std::string& path, const double samplerate, const uint32_t controllers, const bool audio) :
+    file_ (fopen (path.c_str (), "wb")),
+    controllers_ (controllers),
+    audio_ (audio),
+    ring_ (TRACE_RING_SIZE, 0),
+    head_ (0),
+    tail_ (0),
+    record_start_ (0),
+    record_end_ (0),
+    record_valid_ (false),
+    record_n_samples_ (0),
+    record_dropped_ (0),
+    record_midi_events_ (0),
+    dropped_ (0),
+    running_ (true),
+    thread_ ()
+{
+    if (!file_) throw std::runtime_error ("Can't open trace file " + path + ".");
+
+    TraceFileHeader header;
+    memcpy (header.magic, TRACE_MAGIC, 4);
+    header.version = TRACE_VERSION;
+    header.samplerate = samplerate;
+    header.controllers = controllers;
+    header.reserved = 0;
+    fwrite (&header, sizeof (header), 1, file_);
+
+    thread_ = std::thread (&TraceRecorder::thread_function_, this);
+}
+
+inline TraceRecorder::~TraceRecorder ()
+{
+    running_.store (false, std::memory_order_release);
+    if (thread_.joinable ()) thread_.join ();
+    drain_ ();
+    fclose (file_);
+}
+
+inline bool TraceRecorder::records_audio () const {return audio_;}
+
+inline void TraceRecorder::add_activate ()
+{
+    const TraceRecordHeader header = {TRACE_ACTIVATE, 0, sizeof (TraceRecordHeader), record_dropped_, 0, 0};
+    record_end_ = head_.load (std::memory_order_relaxed);
+    if (!reserve_ (sizeof (header)))
+    {
+        ++record_dropped_;
+        dropped_.store (dropped_.load (std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return;
+    }
+
+    const uint64_t head = head_.load (std::memory_order_relaxed);
+    write_ (head, &header, sizeof (header));
+    head_.store (head + sizeof (header), std::memory_order_release);
+    record_dropped_ = 0;
+}
+
+inline bool TraceRecorder::begin_run (const uint32_t n_samples, const float* controllers)
+{
+    // Leave space for the header, written by end_run()
+    record_start_ = head_.load (std::memory_order_relaxed);
+    record_end_ = record_start_ + sizeof (TraceRecordHeader);
+    record_n_samples_ = n_samples;
+    record_midi_events_ = 0;
+    record_valid_ = reserve_ (controllers_ * sizeof (float) + (audio_ ? 2 * n_samples * sizeof (float) : 0));
+    if (record_valid_)
+    {
+        write_ (record_end_, controllers, controllers_ * sizeof (float));
+        record_end_ += controllers_ * sizeof (float);
+    }
+    return record_valid_;
+}
+
+inline void TraceRecorder::add_midi (const uint32_t frame, const uint8_t* data, const uint32_t size)
+{
+    const size_t padded = (size + 3) & ~size_t (3);
+    if (!record_valid_) return;
+    if (!reserve_ (sizeof (TraceMidiEvent) + padded + (audio_ ? 2 * record_n_samples_ * sizeof (float) : 0)))
+    {
+        record_valid_ = false;
+        return;
+    }
+
+    const TraceMidiEvent ev = {frame, size};
+    const uint32_t zero = 0;
+    write_ (record_end_, &ev, sizeof (ev));
+    write_ (record_end_ + sizeof (ev), data, size);
+    if (padded > size) write_ (record_end_ + sizeof (ev) + size, &zero, padded - size);
+    record_end_ += sizeof (ev) + padded;
+    ++record_midi_events_;
+}
+
+inline void TraceRecorder::end_run (const float* in_1, const float* in_2)
+{
+    if (record_valid_ && audio_)
+    {
+        // Space already reserved
+        const size_t n = record_n_samples_ * sizeof (float);
+        write_ (record_end_, in_1, n);
+        write_ (record_end_ + n, in_2, n);
+        record_end_ += 2 * n;
+    }
+
+    if (!record_valid_)
+    {
+        ++record_dropped_;
+        dropped_.store (dropped_.load (std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return;
+    }
+
+    const TraceRecordHeader header =
+    {
+        TRACE_RUN,
+        (audio_ ? uint32_t (TRACE_AUDIO) : 0u),
+        static_cast<uint32_t> (record_end_ - record_start_),
+        record_dropped_,
+        record_n_samples_,
+        record_midi_events_
+    };
+    write_ (record_start_, &header, sizeof (header));
+    head_.store (record_end_, std::memory_order_release);
+    record_dropped_ = 0;
+}
+
+inline uint64_t TraceRecorder::get_dropped () const {return dropped_.load (std::memory_order_relaxed);}
+
+inline bool TraceRecorder::reserve_ (const size_t size) const
+{
+    // The current record reaches from head_ (not yet published) to record_end_
+    const uint64_t used = record_end_ - tail_.load (std::memory_order_acquire);
+    return (used + size <= TRACE_RING_SIZE);
+}
+
+inline void TraceRecorder::write_ (const uint64_t position, const void* data, const size_t size)
+{
+    const size_t start = position & (TRACE_RING_SIZE - 1);
+    const size_t first = std::min<size_t> (size, TRACE_RING_SIZE - start);
+    memcpy (&ring_[start], data, first);
+    if (first < size) memcpy (&ring_[0], static_cast<const uint8_t*> (data) + first, size - first);
+}
+
+inline void TraceRecorder::drain_ ()
+{
+    const uint64_t head = head_.load (std::memory_order_acquire);
+    uint64_t tail = tail_.load (std::memory_order_relaxed);
+    while (tail < head)
+    {
+        const size_t start = tail & (TRACE_RING_SIZE - 1);
+        const size_t size = std::min<size_t> (head - tail, TRACE_RING_SIZE - start);
+        fwrite (&ring_[start], 1, size, file_);
+        tail += size;
+    }
+    tail_.store (tail, std::memory_order_release);
+}
+
+inline void TraceRecorder::thread_function_ ()
+{
+    while (running_.load (std::memory_order_acquire))
+    {
+        drain_ ();
+        std::this_thread::sleep_for (std::chrono::milliseconds (TRACE_DRAIN_INTERVAL_MS));
+    }
+}
+
+#endif /* TRACERECORDER_HPP_ */
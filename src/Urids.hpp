@@ -8,14 +8,31 @@
 #include <lv2/midi/midi.h>
 #include <stdexcept>
 
+#define BVIBRATR_STATS_URI "https://www.jahnichen.de/plugins/lv2/BVibratr#stats"
+
 struct BVibratrURIDs
 {
 	LV2_URID midi_MidiEvent;
 
-	void init (const LV2_Feature* const* features, LV2_URID_Map* map);
+	// Statistics object (notify port) and its properties
+	LV2_URID bvibratr_stats;
+	LV2_URID bvibratr_shift;
+	LV2_URID bvibratr_shiftMin;
+	LV2_URID bvibratr_shiftMax;
+	LV2_URID bvibratr_tremolo;
+	LV2_URID bvibratr_adsrPhase;
+	LV2_URID bvibratr_osc1Mode;
+	LV2_URID bvibratr_osc2Mode;
+	LV2_URID bvibratr_osc3Mode;
+	LV2_URID bvibratr_processTime;
+	LV2_URID bvibratr_processTimeMax;
+	LV2_URID bvibratr_events;
+	LV2_URID bvibratr_blocks;
+
+	void init (const LV2_Feature* const* features, LV2_URID_Map*& map);
 };
 
-inline void BVibratrURIDs::init (const LV2_Feature* const* features, LV2_URID_Map* m)
+inline void BVibratrURIDs::init (const LV2_Feature* const* features, LV2_URID_Map*& m)
 {
 	// Get feature map
 	const char* missing = lv2_features_query (features, LV2_URID__map, &m, true, NULL);
@@ -23,6 +40,19 @@ inline void BVibratrURIDs::init (const LV2_Feature* const* features, LV2_URID_Ma
 
 	// Map urids
     midi_MidiEvent = m->map(m->handle, LV2_MIDI__MidiEvent);
+	bvibratr_stats = m->map(m->handle, BVIBRATR_STATS_URI);
+	bvibratr_shift = m->map(m->handle, BVIBRATR_STATS_URI "Shift");
+	bvibratr_shiftMin = m->map(m->handle, BVIBRATR_STATS_URI "ShiftMin");
+	bvibratr_shiftMax = m->map(m->handle, BVIBRATR_STATS_URI "ShiftMax");
+	bvibratr_tremolo = m->map(m->handle, BVIBRATR_STATS_URI "Tremolo");
+	bvibratr_adsrPhase = m->map(m->handle, BVIBRATR_STATS_URI "AdsrPhase");
+	bvibratr_osc1Mode = m->map(m->handle, BVIBRATR_STATS_URI "Osc1Mode");
+	bvibratr_osc2Mode = m->map(m->handle, BVIBRATR_STATS_URI "Osc2Mode");
+	bvibratr_osc3Mode = m->map(m->handle, BVIBRATR_STATS_URI "Osc3Mode");
+	bvibratr_processTime = m->map(m->handle, BVIBRATR_STATS_URI "ProcessTime");
+	bvibratr_processTimeMax = m->map(m->handle, BVIBRATR_STATS_URI "ProcessTimeMax");
+	bvibratr_events = m->map(m->handle, BVIBRATR_STATS_URI "Events");
+	bvibratr_blocks = m->map(m->handle, BVIBRATR_STATS_URI "Blocks");
 }
 
 #endif /* URIDS_HPP_ */
@@ -0,0 +1,616 @@
+/* B.Vibratr benchmark
+ *
+ * Runs the plugin (via lv2_descriptor) and some of its components and
+ * reports the time per sample (stereo frame) or per call. The results are
+ * also written to a JSON file to compare different runs.
+ *
+ * If compiled with BVIBRATR_CYCLE_STATS (make CYCLESTATS=1 bench), the cycle
+ * statistics of a run with MIDI bursts are reported too. If compiled with
+ * BVIBRATR_PROFILE (make PROFILE=1 bench), the time per processing stage is
+ * reported too.
+ *
+ * Groups of engines (BVibratrEngine) are also run on the StreamScheduler
+ * with different numbers of workers.
+ *
+ * If compiled with BVIBRATR_CHECKPOINTS (default of make bench), random
+ * access to the modulation (BVibratrEngine::get_modulation_at() and
+ * BVibratrTimeline) is compared to stepping (per frame or call).
+ *
+ * Usage: BVibratrBench [-q] [-o FILE]
+ *   -q         Quick run (shorter measurements)
+ *   -o FILE    JSON output file (default: bench.json)
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Host.hpp"
+#include "../src/BVibratr.hpp"	// Also includes the components
+#include "../src/StreamScheduler.hpp"
+#include "../src/BVibratrTimeline.hpp"
+
+extern "C" LV2_SYMBOL_EXPORT const LV2_Descriptor* lv2_descriptor (uint32_t index);
+
+struct EngineConfig
+{
+	uint32_t block;
+	double rate;
+	int osc2_mode;
+	int osc3_mode;
+	int waveform;
+	bool adsr_active;
+};
+
+struct EngineResult
+{
+	EngineConfig config;
+	double ns;
+};
+
+struct SchedulerResult
+{
+	size_t workers;
+	double ns;
+};
+
+struct ComponentResult
+{
+	std::string name;
+	std::string variant;
+	double ns;
+};
+
+static volatile double sink;	// Prevents the compiler from dropping benchmark loops
+
+static double median (std::vector<double> values)
+{
+	std::sort (values.begin(), values.end());
+	return values[values.size() / 2];
+}
+
+/**
+Measures a function.
+@param func		Function to measure, takes the number of calls.
+@param n		Number of calls for each repetition.
+@param repeats	Number of repetitions.
+@return			Median time per call in ns.
+*/
+template <class Func>
+static double measure (Func func, const size_t n, const int repeats)
+{
+	func (n);	// Warm up
+	std::vector<double> times;
+	for (int r = 0; r < repeats; ++r)
+	{
+		const auto t0 = std::chrono::steady_clock::now();
+		func (n);
+		const auto t1 = std::chrono::steady_clock::now();
+		times.push_back (std::chrono::duration<double, std::nano> (t1 - t0).count() / n);
+	}
+	return median (times);
+}
+
+static double bench_engine (const EngineConfig& config, const double seconds, const int repeats)
+{
+	Host host (lv2_descriptor (0), config.rate);
+	host.set_controller (BVIBRATR_OSC2_MODE, config.osc2_mode);
+	host.set_controller (BVIBRATR_OSC3_MODE, config.osc3_mode);
+	host.set_controller (BVIBRATR_OSC1_WAVEFORM, config.waveform);
+	host.set_controller (BVIBRATR_OSC2_WAVEFORM, config.waveform);
+	host.set_controller (BVIBRATR_OSC3_WAVEFORM, config.waveform);
+	host.set_controller (BVIBRATR_TREMOLO, 0.2f);
+
+	std::vector<float> in_1 (config.block);
+	std::vector<float> in_2 (config.block);
+	std::vector<float> out_1 (config.block);
+	std::vector<float> out_2 (config.block);
+	uint32_t seed = 1;
+	for (uint32_t i = 0; i < config.block; ++i)
+	{
+		seed = seed * 1103515245 + 12345;
+		in_1[i] = 0.5f * std::sin (0.05f * i) + static_cast<float>((seed >> 16) & 0x7fff) / 327680.0f;
+		in_2[i] = std::sin (0.013f * i);
+	}
+
+	// Note on (channel 1, note 60) keeps the ADSR in sustain
+	if (config.adsr_active) host.add_midi (0, LV2_MIDI_MSG_NOTE_ON, 60, 100);
+
+	const size_t blocks = std::max<size_t> (1, seconds * config.rate / config.block);
+	const double ns = measure
+	(
+		[&] (const size_t n)
+		{
+			for (size_t i = 0; i < n; ++i) host.run (in_1.data(), in_2.data(), out_1.data(), out_2.data(), config.block);
+		},
+		blocks,
+		repeats
+	);
+	return ns / config.block;
+}
+
+/**
+Measures groups of engines with note on (ADSR in sustain), processed by
+the StreamScheduler.
+@param groups	Number of groups.
+@param n		Number of streams per group.
+@param workers	Number of workers.
+@return			Time per sample and stream in ns.
+*/
+static double bench_scheduler (const uint32_t groups, const uint32_t n, const size_t workers, const double seconds, const int repeats)
+{
+	const double rate = 48000.0;
+	const uint32_t block = 256;
+	const size_t blocks = std::max<size_t> (1, seconds * rate / block / (groups * n));
+
+	BVibratrParameters parameters;
+	parameters.tremolo = 0.2f;
+
+	std::vector<float> audio (2 * groups * n * block);
+	std::vector<float*> channels (2 * groups * n);
+	for (uint32_t c = 0; c < 2 * groups * n; ++c)
+	{
+		channels[c] = audio.data() + c * block;
+		for (uint32_t i = 0; i < block; ++i) channels[c][i] = std::sin (0.01f * (c + 1) * i);
+	}
+
+	const BVibratrEvent note_on = {0, {LV2_MIDI_MSG_NOTE_ON, 60, 100}};
+
+	std::vector<std::unique_ptr<Arena>> arenas;
+	std::vector<std::unique_ptr<BVibratrEngine>> engines;
+	for (uint32_t s = 0; s < groups * n; ++s)
+	{
+		arenas.emplace_back (new Arena (BVibratrEngine::arena_size (rate)));
+		engines.emplace_back (new BVibratrEngine (rate, *arenas[s]));
+		engines[s]->set_parameters (parameters);
+		float* const* ch = channels.data() + 2 * s;
+		engines[s]->process (ch, ch, block, &note_on, 1);
+	}
+
+	StreamScheduler scheduler (groups, workers);
+	auto cycle = [&] (const size_t group, const size_t)
+	{
+		for (uint32_t s = group * n; s < (group + 1) * n; ++s)
+		{
+			float* const* ch = channels.data() + 2 * s;
+			engines[s]->process (ch, ch, block);
+		}
+	};
+
+	const double ns = measure
+	(
+		[&] (const size_t blocks)
+		{
+			for (size_t i = 0; i < blocks; ++i) scheduler.run (cycle);
+			sink = audio[0];
+		},
+		blocks,
+		repeats
+	);
+
+	return ns / (block * groups * n);
+}
+
+#ifdef BVIBRATR_CYCLE_STATS
+static uint64_t percentile (const uint64_t* histogram, const uint64_t count, const double p)
+{
+	uint64_t sum = 0;
+	for (size_t i = 0; i < CYCLESTATS_BUCKETS; ++i)
+	{
+		sum += histogram[i];
+		if (sum >= p * count) return CycleStats::bucket_min (i);
+	}
+	return 0;
+}
+
+/**
+Runs the standard configuration with alternating idle blocks, note bursts,
+and controller streams and prints the cycle statistics.
+@param seconds	Duration.
+*/
+static void report_cycle_stats (const double seconds)
+{
+	Host host (lv2_descriptor (0), 48000.0);
+	const BVibratrCycleStatsInterface* iface = static_cast<const BVibratrCycleStatsInterface*> (host.get_extension_data (BVIBRATR_CYCLE_STATS_URI));
+	if (!iface) return;
+
+	const uint32_t block = 256;
+	std::vector<float> in (block, 0.25f);
+	std::vector<float> out_1 (block);
+	std::vector<float> out_2 (block);
+	const size_t blocks = std::max<size_t> (4, seconds * 48000.0 / block);
+	for (size_t b = 0; b < blocks; ++b)
+	{
+		switch (b % 4)
+		{
+			case 1:		for (uint32_t i = 0; i < 16; ++i) host.add_midi (i * 16, ((i & 1) ? LV2_MIDI_MSG_NOTE_OFF : LV2_MIDI_MSG_NOTE_ON), 60 + (i >> 1), 100);
+						break;
+
+			case 2:		for (uint32_t i = 0; i < 64; ++i) host.add_midi (i * 4, LV2_MIDI_MSG_CONTROLLER, 1, i * 2);
+						break;
+
+			case 3:		host.add_midi (0, LV2_MIDI_MSG_NOTE_ON, 60, 100);
+						break;
+
+			default:	break;
+		}
+		host.run (in.data(), in.data(), out_1.data(), out_2.data(), block);
+	}
+
+	CycleStatsSnapshot s;
+	iface->get (host.get_handle(), &s);
+	printf ("\nCycle statistics (block 256, 48 kHz, %llu runs, %llu play segments)\n", static_cast<unsigned long long>(s.runs), static_cast<unsigned long long>(s.plays));
+	printf ("  run   mean %8.0f  p50 %8llu  p99 %8llu  max %8llu (run #%llu, %u events, %u note ons, %u CCs, ADSR phase %i)\n",
+		(s.runs ? static_cast<double>(s.run_cycles) / s.runs : 0.0),
+		static_cast<unsigned long long>(percentile (s.run_histogram, s.runs, 0.5)),
+		static_cast<unsigned long long>(percentile (s.run_histogram, s.runs, 0.99)),
+		static_cast<unsigned long long>(s.worst_run.cycles), static_cast<unsigned long long>(s.worst_run.run),
+		s.worst_run.events, s.worst_run.note_ons, s.worst_run.controllers, s.worst_run.adsr_phase);
+	printf ("  play               p50 %8llu  p99 %8llu  max %8llu (%u samples)\n",
+		static_cast<unsigned long long>(percentile (s.play_histogram, s.plays, 0.5)),
+		static_cast<unsigned long long>(percentile (s.play_histogram, s.plays, 0.99)),
+		static_cast<unsigned long long>(s.worst_play.cycles), s.worst_play.n_samples);
+	printf ("  max by events ");
+	for (size_t i = 0; i < CYCLESTATS_EVENT_CLASSES; ++i) printf (" %8llu", static_cast<unsigned long long>(s.max_by_events[i]));
+	printf ("\n  max by phase  ");
+	for (size_t i = 0; i < CYCLESTATS_PHASES; ++i) printf (" %8llu", static_cast<unsigned long long>(s.max_by_phase[i]));
+	printf ("\n");
+}
+#endif
+
+#ifdef BVIBRATR_PROFILE
+/**
+Runs the standard configuration (with some MIDI controllers) and prints the
+cycles per sample for each profiling zone.
+@param seconds	Duration.
+*/
+static void report_profile (const double seconds)
+{
+	Host host (lv2_descriptor (0), 48000.0);
+	const BVibratrProfileInterface* iface = static_cast<const BVibratrProfileInterface*> (host.get_extension_data (BVIBRATR_PROFILE_URI));
+	if (!iface) return;
+
+	host.set_controller (BVIBRATR_OSC2_MODE, BVIBRATR_OSC_MODE_ADD);
+	host.set_controller (BVIBRATR_OSC3_MODE, BVIBRATR_OSC_MODE_FM1);
+	host.set_controller (BVIBRATR_TREMOLO, 0.2f);
+	const uint32_t block = 256;
+	std::vector<float> in (block, 0.25f);
+	std::vector<float> out_1 (block);
+	std::vector<float> out_2 (block);
+	const size_t blocks = std::max<size_t> (1, seconds * 48000.0 / block);
+	host.add_midi (0, LV2_MIDI_MSG_NOTE_ON, 60, 100);
+	for (size_t b = 0; b < blocks; ++b)
+	{
+		if (b % 4 == 0) host.add_midi (block / 2, LV2_MIDI_MSG_CONTROLLER, 7, b & 0x7f);
+		host.run (in.data(), in.data(), out_1.data(), out_2.data(), block);
+	}
+
+	ProfileSnapshot p;
+	iface->get (host.get_handle(), &p);
+	const double samples = blocks * block;
+	printf ("\nProfile (block 256, 48 kHz, osc 2 add, osc 3 FM osc 1, ADSR active)\n");
+	printf ("%-16s %14s %12s %8s\n", "zone", "cycles/sample", "calls", "% run");
+	for (size_t i = 0; i < PROFILE_NR_ZONES; ++i)
+	{
+		printf
+		(
+			"%-16s %14.2f %12llu %8.1f\n",
+			profile_zone_names[i], p.cycles[i] / samples, static_cast<unsigned long long>(p.calls[i]),
+			(p.cycles[PROFILE_RUN] ? 100.0 * p.cycles[i] / p.cycles[PROFILE_RUN] : 0.0)
+		);
+	}
+	printf ("Per sample zones (oscillators, adsr) include the timer overhead.\n");
+}
+#endif
+
+static void bench_components (std::vector<ComponentResult>& results, const size_t n, const int repeats)
+{
+	const double dt = 1.0 / 48000.0;
+	const char* waveforms[] = {"sine", "triangle", "square"};
+	for (int w = LFO<double>::SINE; w <= LFO<double>::SQUARE; ++w)
+	{
+		LFO<double> osc (static_cast<LFO<double>::Waveform>(w), 6.0);
+		osc.start();
+		results.push_back
+		({"LFO::get_value", waveforms[w - 1], measure ([&] (const size_t n)
+		{
+			double sum = 0.0;
+			for (size_t i = 0; i < n; ++i) {osc.run (dt); sum += osc.get_value();}
+			sink = sum;
+		}, n, repeats)});
+
+		results.push_back
+		({"LFO::get_integral", waveforms[w - 1], measure ([&] (const size_t n)
+		{
+			double sum = 0.0;
+			for (size_t i = 0; i < n; ++i) {osc.run (dt); sum += osc.get_integral();}
+			sink = sum;
+		}, n, repeats)});
+	}
+
+	const char* faders[] = {"linear", "invsqr", "sqrt", "sine_1_4"};
+	for (int f = ADSR<double>::LINEAR; f <= ADSR<double>::SINE_1_4; ++f)
+	{
+		// Long attack: Stays in the attack phase
+		ADSR<double> adsr (1.0e6, 1.0, 0.5, 1.0, static_cast<ADSR<double>::Fader>(f));
+		adsr.start();
+		results.push_back
+		({"ADSR::get_value", faders[f], measure ([&] (const size_t n)
+		{
+			double sum = 0.0;
+			for (size_t i = 0; i < n; ++i) {adsr.run (dt); sum += adsr.get_value();}
+			sink = sum;
+		}, n, repeats)});
+	}
+
+	std::vector<float> memory (0x2000, 0.0f);
+	DelayLine<float> line (memory.data(), memory.size());
+	results.push_back
+	({"DelayLine::push_front", "float", measure ([&] (const size_t n)
+	{
+		for (size_t i = 0; i < n; ++i) line.push_front (static_cast<float>(i));
+		sink = line[0];
+	}, n, repeats)});
+
+	results.push_back
+	({"DelayLine::operator[]", "float", measure ([&] (const size_t n)
+	{
+		double sum = 0.0;
+		for (size_t i = 0; i < n; ++i) sum += line[(i * 7) & 0x0fff];
+		sink = sum;
+	}, n, repeats)});
+
+	// Block kernels of all variants supported by this CPU
+	std::vector<const Kernels*> variants = {&KernelsGeneric::kernels};
+#ifdef BVIBRATR_KERNELS_X86
+	__builtin_cpu_init ();
+	if (__builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("fma") && __builtin_cpu_supports ("f16c")) variants.push_back (&KernelsAvx2::kernels);
+	if (__builtin_cpu_supports ("avx512f") && __builtin_cpu_supports ("avx512vl") && __builtin_cpu_supports ("f16c")) variants.push_back (&KernelsAvx512::kernels);
+#endif
+
+	const uint32_t block = 256;
+	const size_t blocks = std::max<size_t> (1, n / block);
+	std::vector<uint16_t> half (memory.size(), 0);
+	std::vector<float> in (block, 0.5f);
+	std::vector<float> out (block);
+	std::vector<float> delay (block);
+	for (uint32_t i = 0; i < block; ++i) delay[i] = 2854 + 1000 * std::sin (0.01 * i);
+	const size_t mask = memory.size() - 1;
+
+	for (const Kernels* k : variants)
+	{
+		size_t pos = 0;
+		results.push_back
+		({"Kernels::delay_write", k->name, measure ([&] (const size_t n)
+		{
+			for (size_t i = 0; i < n; ++i) {k->delay_write (memory.data(), mask, pos, in.data(), block); pos -= block;}
+		}, blocks, repeats) / block});
+
+		results.push_back
+		({"Kernels::delay_read", k->name, measure ([&] (const size_t n)
+		{
+			for (size_t i = 0; i < n; ++i) {k->delay_read (memory.data(), mask, pos, delay.data(), out.data(), block); pos -= block;}
+			sink = out[0];
+		}, blocks, repeats) / block});
+
+		results.push_back
+		({"Kernels::delay_write_half", k->name, measure ([&] (const size_t n)
+		{
+			for (size_t i = 0; i < n; ++i) {k->delay_write_half (half.data(), mask, pos, in.data(), block); pos -= block;}
+		}, blocks, repeats) / block});
+
+		results.push_back
+		({"Kernels::delay_read_half", k->name, measure ([&] (const size_t n)
+		{
+			for (size_t i = 0; i < n; ++i) {k->delay_read_half (half.data(), mask, pos, delay.data(), out.data(), block); pos -= block;}
+			sink = out[0];
+		}, blocks, repeats) / block});
+
+		results.push_back
+		({"Kernels::mix", k->name, measure ([&] (const size_t n)
+		{
+			for (size_t i = 0; i < n; ++i) k->mix (in.data(), delay.data(), in.data(), in.data(), out.data(), block);
+			sink = out[0];
+		}, blocks, repeats) / block});
+	}
+
+#ifdef BVIBRATR_CHECKPOINTS
+	// Random access to the modulation: Stepping compared to the prediction
+	// from a checkpoint and from a timeline (FM1 routed to osc1, 10 s)
+	Arena arena (BVibratrEngine::arena_size (48000.0));
+	BVibratrEngine engine (48000.0, arena);
+	BVibratrParameters parameters;
+	parameters.osc3_mode = BVIBRATR_OSC_MODE_FM1;
+	engine.set_parameters (parameters);
+	const uint8_t note_on[3] = {0x90, 60, 100};
+	engine.on_midi (note_on);
+	const uint64_t span = 480000;
+	std::unique_ptr<BVibratrCheckpoint> checkpoint (engine.save_checkpoint ());
+	const BVibratrTimeline timeline (engine, span, 64);
+
+	results.push_back
+	({"BVibratrEngine::advance", "fm1", measure ([&] (const size_t n)
+	{
+		engine.restore_checkpoint (*checkpoint);
+		engine.advance (n);
+		sink = engine.get_shift();
+	}, n, repeats)});
+
+	results.push_back
+	({"BVibratrEngine::get_modulation_at", "fm1", measure ([&] (const size_t n)
+	{
+		double sum = 0.0;
+		for (size_t i = 0; i < n; ++i) sum += engine.get_modulation_at (*checkpoint, (i * 7919) % span).osc_phase[0];
+		sink = sum;
+	}, n, repeats)});
+
+	results.push_back
+	({"BVibratrTimeline::get", "fm1", measure ([&] (const size_t n)
+	{
+		double sum = 0.0;
+		for (size_t i = 0; i < n; ++i) sum += timeline.get ((i * 7919) % span).osc_phase[0];
+		sink = sum;
+	}, n, repeats)});
+#endif
+}
+
+static bool write_json (const std::string& path, const std::vector<EngineResult>& engine, const std::vector<SchedulerResult>& scheduler, const std::vector<ComponentResult>& components)
+{
+	FILE* file = fopen (path.c_str(), "w");
+	if (!file) return false;
+
+	char date[32];
+	const time_t now = time (nullptr);
+	strftime (date, sizeof (date), "%Y-%m-%dT%H:%M:%SZ", gmtime (&now));
+
+	fprintf (file, "{\n");
+	fprintf (file, "  \"benchmark\": \"BVibratrBench\",\n");
+	fprintf (file, "  \"version\": 1,\n");
+	fprintf (file, "  \"date\": \"%s\",\n", date);
+	fprintf (file, "  \"compiler\": \"%s\",\n", __VERSION__);
+	fprintf (file, "  \"kernels\": \"%s\",\n", get_kernels().name);
+	fprintf (file, "  \"engine\": [\n");
+	for (size_t i = 0; i < engine.size(); ++i)
+	{
+		const EngineConfig& c = engine[i].config;
+		fprintf
+		(
+			file,
+			"    {\"block_size\": %u, \"samplerate\": %.0f, \"osc2_mode\": %i, \"osc3_mode\": %i, \"waveform\": %i, \"adsr\": \"%s\", \"ns_per_sample\": %.3f}%s\n",
+			c.block, c.rate, c.osc2_mode, c.osc3_mode, c.waveform, (c.adsr_active ? "active" : "idle"), engine[i].ns,
+			(i + 1 < engine.size() ? "," : "")
+		);
+	}
+	fprintf (file, "  ],\n");
+	fprintf (file, "  \"scheduler\": [\n");
+	for (size_t i = 0; i < scheduler.size(); ++i)
+	{
+		fprintf
+		(
+			file,
+			"    {\"workers\": %zu, \"ns_per_sample\": %.3f}%s\n",
+			scheduler[i].workers, scheduler[i].ns,
+			(i + 1 < scheduler.size() ? "," : "")
+		);
+	}
+	fprintf (file, "  ],\n");
+	fprintf (file, "  \"components\": [\n");
+	for (size_t i = 0; i < components.size(); ++i)
+	{
+		fprintf
+		(
+			file,
+			"    {\"name\": \"%s\", \"variant\": \"%s\", \"ns_per_call\": %.3f}%s\n",
+			components[i].name.c_str(), components[i].variant.c_str(), components[i].ns,
+			(i + 1 < components.size() ? "," : "")
+		);
+	}
+	fprintf (file, "  ]\n");
+	fprintf (file, "}\n");
+	fclose (file);
+	return true;
+}
+
+int main (int argc, char** argv)
+{
+	std::string path = "bench.json";
+	bool quick = false;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (!strcmp (argv[i], "-q")) quick = true;
+		else if (!strcmp (argv[i], "-o") && (i + 1 < argc)) path = argv[++i];
+		else
+		{
+			fprintf (stderr, "Usage: %s [-q] [-o FILE]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	const double seconds = (quick ? 0.1 : 1.0);
+	const int repeats = (quick ? 3 : 7);
+	const EngineConfig standard = {256, 48000.0, 1, 1, 1, true};
+
+	// Matrix: block size x sample rate, routing modes, waveforms x ADSR
+	std::vector<EngineConfig> configs;
+	for (uint32_t block : {16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192})
+	{
+		for (double rate : {44100.0, 48000.0, 88200.0, 96000.0, 176400.0, 192000.0, 352800.0, 384000.0})
+		{
+			EngineConfig c = standard;
+			c.block = block;
+			c.rate = rate;
+			configs.push_back (c);
+		}
+	}
+
+	for (int osc2_mode = 1; osc2_mode <= 5; ++osc2_mode)
+	{
+		for (int osc3_mode = 1; osc3_mode <= 8; ++osc3_mode)
+		{
+			EngineConfig c = standard;
+			c.osc2_mode = osc2_mode;
+			c.osc3_mode = osc3_mode;
+			configs.push_back (c);
+		}
+	}
+
+	for (int waveform = 1; waveform <= 3; ++waveform)
+	{
+		for (bool adsr_active : {false, true})
+		{
+			EngineConfig c = standard;
+			c.waveform = waveform;
+			c.adsr_active = adsr_active;
+			configs.push_back (c);
+		}
+	}
+
+	printf ("Kernels: %s\n\n", get_kernels().name);
+	printf ("%6s %9s %5s %5s %5s %7s %14s\n", "block", "rate", "osc2", "osc3", "wave", "adsr", "ns/sample");
+	std::vector<EngineResult> engine;
+	for (const EngineConfig& c : configs)
+	{
+		const double ns = bench_engine (c, seconds, repeats);
+		engine.push_back ({c, ns});
+		printf ("%6u %9.0f %5i %5i %5i %7s %14.3f\n", c.block, c.rate, c.osc2_mode, c.osc3_mode, c.waveform, (c.adsr_active ? "active" : "idle"), ns);
+	}
+
+	// 16 groups of 32 streams
+	printf ("\n%7s %14s %8s\n", "workers", "ns/sample", "speedup");
+	std::vector<SchedulerResult> scheduler;
+	const size_t max_workers = std::max<size_t> (std::thread::hardware_concurrency(), 1);
+	for (size_t w = 1; w <= std::min<size_t> (max_workers, 16); w *= 2)
+	{
+		const double ns = bench_scheduler (16, 32, w, 10.0 * seconds, repeats);
+		scheduler.push_back ({w, ns});
+		printf ("%7zu %14.3f %8.2f\n", w, ns, scheduler[0].ns / ns);
+	}
+
+	printf ("\n%-34s %10s %14s\n", "component", "variant", "ns/call");
+	std::vector<ComponentResult> components;
+	bench_components (components, (quick ? 100000 : 1000000), repeats);
+	for (const ComponentResult& r : components) printf ("%-34s %10s %14.3f\n", r.name.c_str(), r.variant.c_str(), r.ns);
+
+#ifdef BVIBRATR_CYCLE_STATS
+	report_cycle_stats (10.0 * seconds);
+#endif
+
+#ifdef BVIBRATR_PROFILE
+	report_profile (10.0 * seconds);
+#endif
+
+	if (!write_json (path, engine, scheduler, components))
+	{
+		fprintf (stderr, "Can't write %s\n", path.c_str());
+		return 1;
+	}
+	printf ("\nResults written to %s\n", path.c_str());
+	return 0;
+}
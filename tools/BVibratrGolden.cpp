@@ -0,0 +1,542 @@
+/* B.Vibratr golden output regression harness
+ *
+ * Renders fixed MIDI and audio scenarios through the plugin shared object
+ * and records them as reference renders or compares them to the recorded
+ * reference renders. Scenarios which must not change the output (e.g., an
+ * optional port in its default setting) are also compared bit by bit to the
+ * render of their base scenario.
+ *
+ * Usage: BVibratrGolden record|compare|list [OPTIONS] [SCENARIO ...]
+ *   -p FILE    Plugin shared object (default: BVibratr.lv2/BVibratr.so)
+ *   -r DIR     Directory of the reference renders (default: golden)
+ *   -m MODE    Comparison mode: exact (default) or tolerance
+ *   -e VALUE   Tolerance mode: max. absolute error (default: 1e-4)
+ *   -d VALUE   Tolerance mode: max. log spectral distance in dB (default: 0.1)
+ *
+ * Exit code: 0 if all scenarios passed, 1 if a scenario failed, 2 on errors.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "Host.hpp"
+#include "Wav.hpp"
+
+#define GOLDEN_FFT_SIZE 2048
+#define GOLDEN_FLOOR_DB -100.0		// Spectral floor, relative to a full scale sine
+
+struct MidiEvent
+{
+	uint64_t frame;
+	uint8_t status;
+	uint8_t data1;
+	uint8_t data2;
+};
+
+struct Automation
+{
+	uint64_t frame;
+	int controller;
+	float value;
+};
+
+enum CvInput
+{
+	CV_NONE,		// CV inputs not connected
+	CV_SILENCE,		// Connected to silence
+	CV_SIGNAL		// Connected to a pitch and a tremolo signal
+};
+
+struct Scenario
+{
+	std::string name;
+	double samplerate;
+	uint32_t block;
+	double duration;
+	std::vector<std::pair<int, float>> controllers;
+	std::vector<MidiEvent> midi;
+	std::vector<Automation> automation;
+	bool worker = false;	// Attack and decay precomputed in the worker
+	std::vector<std::pair<int, float>> ports = {};	// Optional control ports
+	CvInput cv = CV_NONE;
+	std::string same_as = "";	// Must render bit-identical to this scenario
+};
+
+struct Result
+{
+	size_t ndiff;
+	double max_abs;
+	double spectral;
+};
+
+static std::vector<Scenario> make_scenarios ()
+{
+	std::vector<Scenario> scenarios;
+	const double rate = 48000.0;
+	const uint64_t s = rate;	// Frames per second
+	const Scenario standard =
+	{
+		"default", rate, 256, 4.0,
+		{{BVIBRATR_DEPTH, 50.0f}},
+		{{s / 10, 0x90, 60, 100}, {5 * s / 2, 0x80, 60, 0}},
+		{}
+	};
+
+	scenarios.push_back (standard);
+
+	Scenario retrigger = standard;
+	retrigger.name = "retrigger";
+	retrigger.controllers.push_back ({BVIBRATR_MIDI_NOTE, 128.0f});
+	retrigger.midi.clear();
+	for (uint64_t i = 0; i < 10; ++i)
+	{
+		retrigger.midi.push_back ({s / 10 + i * s * 3 / 10, 0x90, static_cast<uint8_t>(60 + i), 100});
+		retrigger.midi.push_back ({s / 10 + i * s * 3 / 10 + s / 2, 0x80, static_cast<uint8_t>(60 + i), 0});
+	}
+	scenarios.push_back (retrigger);
+
+	Scenario all_notes_off = standard;
+	all_notes_off.name = "all_notes_off";
+	all_notes_off.midi = {{s / 10, 0x90, 60, 100}, {3 * s / 2, 0xB0, 123, 0}};
+	scenarios.push_back (all_notes_off);
+
+	Scenario all_sounds_off = standard;
+	all_sounds_off.name = "all_sounds_off";
+	all_sounds_off.midi = {{s / 10, 0x90, 60, 100}, {3 * s / 2, 0xB0, 120, 0}};
+	scenarios.push_back (all_sounds_off);
+
+	Scenario trigger_channel = standard;
+	trigger_channel.name = "trigger_channel";
+	trigger_channel.controllers.push_back ({BVIBRATR_MIDI_CHANNEL, 2.0f});
+	scenarios.push_back (trigger_channel);
+
+	Scenario cc_depth = standard;
+	cc_depth.name = "cc_depth";
+	cc_depth.controllers.push_back ({BVIBRATR_DEPTH_IS_CC, 1.0f});
+	for (uint64_t i = 0; i < 128; ++i) cc_depth.midi.push_back ({s / 5 + i * s / 64, 0xB0, 1, static_cast<uint8_t>(i)});
+	scenarios.push_back (cc_depth);
+
+	Scenario osc1_user = standard;
+	osc1_user.name = "osc1_user";
+	osc1_user.controllers.push_back ({BVIBRATR_OSC1_MODE, 2.0f});
+	osc1_user.controllers.push_back ({BVIBRATR_OSC2_MODE, BVIBRATR_OSC_MODE_ADD});
+	scenarios.push_back (osc1_user);
+
+	for (int mode = 1; mode <= 5; ++mode)
+	{
+		Scenario osc2 = standard;
+		osc2.name = "osc2_mode_" + std::to_string (mode);
+		osc2.controllers.push_back ({BVIBRATR_OSC2_MODE, static_cast<float>(mode)});
+		osc2.controllers.push_back ({BVIBRATR_OSC2_AMP, 0.8f});
+		scenarios.push_back (osc2);
+	}
+
+	for (int mode = 1; mode <= 8; ++mode)
+	{
+		Scenario osc3 = standard;
+		osc3.name = "osc3_mode_" + std::to_string (mode);
+		osc3.controllers.push_back ({BVIBRATR_OSC2_MODE, BVIBRATR_OSC_MODE_ADD});
+		osc3.controllers.push_back ({BVIBRATR_OSC3_MODE, static_cast<float>(mode)});
+		osc3.controllers.push_back ({BVIBRATR_OSC3_AMP, 0.5f});
+		scenarios.push_back (osc3);
+	}
+
+	for (int waveform = 1; waveform <= 3; ++waveform)
+	{
+		Scenario wave = standard;
+		wave.name = "waveform_" + std::to_string (waveform);
+		wave.controllers.push_back ({BVIBRATR_OSC1_WAVEFORM, static_cast<float>(waveform)});
+		wave.controllers.push_back ({BVIBRATR_OSC2_WAVEFORM, static_cast<float>(waveform)});
+		wave.controllers.push_back ({BVIBRATR_OSC3_WAVEFORM, static_cast<float>(waveform)});
+		wave.controllers.push_back ({BVIBRATR_OSC2_MODE, BVIBRATR_OSC_MODE_ADD});
+		wave.controllers.push_back ({BVIBRATR_OSC3_MODE, BVIBRATR_OSC_MODE_ADD});
+		scenarios.push_back (wave);
+	}
+
+	Scenario tremolo = standard;
+	tremolo.name = "tremolo";
+	tremolo.controllers.push_back ({BVIBRATR_TREMOLO, 0.5f});
+	tremolo.controllers.push_back ({BVIBRATR_OSC1_WAVEFORM, 3.0f});	// Square
+	scenarios.push_back (tremolo);
+
+	Scenario drywet_bypass = standard;
+	drywet_bypass.name = "drywet_bypass";
+	drywet_bypass.controllers.push_back ({BVIBRATR_DRY_WET, 0.5f});
+	drywet_bypass.automation = {{s, BVIBRATR_BYPASS, 1.0f}, {2 * s, BVIBRATR_BYPASS, 0.0f}, {3 * s, BVIBRATR_DRY_WET, 1.0f}};
+	scenarios.push_back (drywet_bypass);
+
+	Scenario automation = standard;
+	automation.name = "automation";
+	for (uint64_t i = 0; i < 40; ++i)
+	{
+		automation.automation.push_back ({i * s / 10, BVIBRATR_OSC1_FREQ, 1.0f + 0.45f * i});
+		automation.automation.push_back ({i * s / 10, BVIBRATR_DEPTH, 50.0f - 1.25f * i});
+	}
+	scenarios.push_back (automation);
+
+	Scenario block_37 = standard;
+	block_37.name = "block_37";
+	block_37.block = 37;
+	scenarios.push_back (block_37);
+
+	Scenario block_4096 = standard;
+	block_4096.name = "block_4096";
+	block_4096.block = 4096;
+	scenarios.push_back (block_4096);
+
+	// CV inputs connected to silence, but not selected
+	Scenario cv_internal = standard;
+	cv_internal.name = "cv_internal";
+	cv_internal.cv = CV_SILENCE;
+	cv_internal.ports = {{BVIBRATR_MODULATION_SOURCE, BVIBRATR_MODULATION_SOURCE_INTERNAL}};
+	cv_internal.same_as = "default";
+	scenarios.push_back (cv_internal);
+
+	Scenario cv_pitch = standard;
+	cv_pitch.name = "cv_pitch";
+	cv_pitch.controllers.push_back ({BVIBRATR_TREMOLO, 0.3f});
+	cv_pitch.cv = CV_SIGNAL;
+	cv_pitch.ports = {{BVIBRATR_MODULATION_SOURCE, BVIBRATR_MODULATION_SOURCE_CV_PITCH}};
+	scenarios.push_back (cv_pitch);
+
+	Scenario cv_tremolo = cv_pitch;
+	cv_tremolo.name = "cv_tremolo";
+	cv_tremolo.ports = {{BVIBRATR_MODULATION_SOURCE, BVIBRATR_MODULATION_SOURCE_CV}};
+	scenarios.push_back (cv_tremolo);
+
+	// The worker scenarios must render like the live oscillators
+	Scenario worker = standard;
+	worker.name = "worker";
+	worker.worker = true;
+	worker.same_as = "default";
+	scenarios.push_back (worker);
+
+	Scenario worker_tremolo = tremolo;
+	worker_tremolo.name = "worker_tremolo";
+	worker_tremolo.worker = true;
+	worker_tremolo.same_as = "tremolo";
+	scenarios.push_back (worker_tremolo);
+
+	// Leave the trajectory on a note off during the attack and on a
+	// controller change during the decay
+	Scenario leave = standard;
+	leave.name = "leave";
+	leave.controllers.push_back ({BVIBRATR_OSC2_MODE, BVIBRATR_OSC_MODE_FM1});
+	leave.controllers.push_back ({BVIBRATR_OSC3_MODE, BVIBRATR_OSC_MODE_PM2});
+	leave.midi = {{s / 10, 0x90, 60, 100}, {6 * s / 10, 0x80, 60, 0}, {s, 0x90, 60, 100}, {3 * s, 0x80, 60, 0}};
+	leave.automation.push_back ({3 * s / 2 + 1000, BVIBRATR_OSC1_FREQ, 4.0f});
+	scenarios.push_back (leave);
+
+	Scenario worker_leave = leave;
+	worker_leave.name = "worker_leave";
+	worker_leave.worker = true;
+	worker_leave.same_as = "leave";
+	scenarios.push_back (worker_leave);
+
+	for (double r : {44100.0, 96000.0, 192000.0})
+	{
+		Scenario sr = standard;
+		sr.name = "rate_" + std::to_string (static_cast<int>(r));
+		sr.samplerate = r;
+		for (MidiEvent& m : sr.midi) m.frame = m.frame * r / rate;
+		scenarios.push_back (sr);
+	}
+
+	return scenarios;
+}
+
+static Audio render (const LV2_Descriptor* descriptor, const Scenario& scenario)
+{
+	Host host (descriptor, scenario.samplerate, 1024, scenario.worker);
+	for (const std::pair<int, float>& c : scenario.controllers) host.set_controller (c.first, c.second);
+	std::vector<float> ports (scenario.ports.size());
+	for (size_t i = 0; i < ports.size(); ++i)
+	{
+		ports[i] = scenario.ports[i].second;
+		host.connect_port (scenario.ports[i].first, &ports[i]);
+	}
+
+	const uint64_t frames = scenario.duration * scenario.samplerate;
+	Audio audio {2, scenario.samplerate, std::vector<float> (2 * frames)};
+	std::vector<float> in_1 (scenario.block);
+	std::vector<float> in_2 (scenario.block);
+	std::vector<float> out_1 (scenario.block);
+	std::vector<float> out_2 (scenario.block);
+	std::vector<float> cv_pitch (scenario.block, 0.0f);
+	std::vector<float> cv_tremolo (scenario.block, 0.0f);
+	if (scenario.cv != CV_NONE)
+	{
+		host.connect_port (BVIBRATR_CV_PITCH_IN, cv_pitch.data());
+		host.connect_port (BVIBRATR_CV_TREMOLO_IN, cv_tremolo.data());
+	}
+	uint32_t seed = 1;
+
+	// Events in temporal order
+	std::vector<MidiEvent> midi = scenario.midi;
+	std::vector<Automation> automation = scenario.automation;
+	std::stable_sort (midi.begin(), midi.end(), [] (const MidiEvent& a, const MidiEvent& b) {return a.frame < b.frame;});
+	std::stable_sort (automation.begin(), automation.end(), [] (const Automation& a, const Automation& b) {return a.frame < b.frame;});
+	size_t midi_nr = 0;
+	size_t automation_nr = 0;
+
+	for (uint64_t f0 = 0; f0 < frames; f0 += scenario.block)
+	{
+		const uint32_t n = std::min<uint64_t> (scenario.block, frames - f0);
+
+		// Input: 440 Hz sine + noise and 110 Hz sine
+		for (uint32_t i = 0; i < n; ++i)
+		{
+			const double t = (f0 + i) / scenario.samplerate;
+			seed = seed * 1103515245 + 12345;
+			in_1[i] = 0.5 * std::sin (2.0 * M_PI * 440.0 * t) + 0.1 * (static_cast<double>((seed >> 16) & 0x7fff) / 16384.0 - 1.0);
+			in_2[i] = 0.8 * std::sin (2.0 * M_PI * 110.0 * t);
+
+			// CV: 5.5 Hz pitch and 3 Hz tremolo modulation
+			if (scenario.cv == CV_SIGNAL)
+			{
+				cv_pitch[i] = 0.8 * std::sin (2.0 * M_PI * 5.5 * t);
+				cv_tremolo[i] = std::sin (2.0 * M_PI * 3.0 * t);
+			}
+		}
+
+		// Automation at the start of the block
+		while ((automation_nr < automation.size()) && (automation[automation_nr].frame < f0 + n))
+		{
+			host.set_controller (automation[automation_nr].controller, automation[automation_nr].value);
+			++automation_nr;
+		}
+
+		// MIDI
+		while ((midi_nr < midi.size()) && (midi[midi_nr].frame < f0 + n))
+		{
+			const MidiEvent& m = midi[midi_nr];
+			host.add_midi (m.frame - f0, m.status, m.data1, m.data2);
+			++midi_nr;
+		}
+
+		host.run (in_1.data(), in_2.data(), out_1.data(), out_2.data(), n);
+		host.work ();
+		for (uint32_t i = 0; i < n; ++i)
+		{
+			audio.samples[2 * (f0 + i)] = out_1[i];
+			audio.samples[2 * (f0 + i) + 1] = out_2[i];
+		}
+	}
+
+	return audio;
+}
+
+static void fft (std::vector<std::complex<double>>& x)
+{
+	const size_t n = x.size();
+	for (size_t i = 1, j = 0; i < n; ++i)
+	{
+		size_t bit = n >> 1;
+		for (; j & bit; bit >>= 1) j ^= bit;
+		j ^= bit;
+		if (i < j) std::swap (x[i], x[j]);
+	}
+
+	for (size_t len = 2; len <= n; len <<= 1)
+	{
+		const std::complex<double> w = std::polar (1.0, -2.0 * M_PI / len);
+		for (size_t i = 0; i < n; i += len)
+		{
+			std::complex<double> wk = 1.0;
+			for (size_t k = 0; k < len / 2; ++k)
+			{
+				const std::complex<double> u = x[i + k];
+				const std::complex<double> v = x[i + k + len / 2] * wk;
+				x[i + k] = u + v;
+				x[i + k + len / 2] = u - v;
+				wk *= w;
+			}
+		}
+	}
+}
+
+/**
+Calculates the log spectral distance of two signals. Power spectra of Hann
+windowed frames (50% overlap) are compared in dB for each frame. Bins below
+GOLDEN_FLOOR_DB are raised to the floor to ignore differences in the noise
+floor. The result is the mean of the RMS differences of all frames.
+@return Log spectral distance in dB.
+*/
+static double spectral_distance (const Audio& a, const Audio& b)
+{
+	const size_t frames = std::min (a.frames(), b.frames());
+	std::vector<std::complex<double>> x (GOLDEN_FFT_SIZE);
+	std::vector<std::complex<double>> y (GOLDEN_FFT_SIZE);
+	double sum = 0.0;
+	size_t count = 0;
+
+	// Normalization to a full scale sine (0 dB) and floor
+	const double norm = 4.0 / (GOLDEN_FFT_SIZE * GOLDEN_FFT_SIZE);
+	const double floor = std::pow (10.0, 0.1 * GOLDEN_FLOOR_DB);
+
+	for (uint32_t c = 0; c < a.channels; ++c)
+	{
+		for (size_t f0 = 0; f0 + GOLDEN_FFT_SIZE <= frames; f0 += GOLDEN_FFT_SIZE / 2)
+		{
+			for (size_t i = 0; i < GOLDEN_FFT_SIZE; ++i)
+			{
+				const double window = 0.5 - 0.5 * std::cos (2.0 * M_PI * i / GOLDEN_FFT_SIZE);
+				x[i] = window * a.samples[(f0 + i) * a.channels + c];
+				y[i] = window * b.samples[(f0 + i) * b.channels + c];
+			}
+			fft (x);
+			fft (y);
+
+			double frame_sum = 0.0;
+			for (size_t k = 0; k <= GOLDEN_FFT_SIZE / 2; ++k)
+			{
+				const double px = std::max (norm * std::norm (x[k]), floor);
+				const double py = std::max (norm * std::norm (y[k]), floor);
+				const double d = 10.0 * std::log10 (px / py);
+				frame_sum += d * d;
+			}
+			sum += std::sqrt (frame_sum / (GOLDEN_FFT_SIZE / 2 + 1));
+			++count;
+		}
+	}
+
+	return (count ? sum / count : 0.0);
+}
+
+static Result compare (const Audio& reference, const Audio& audio)
+{
+	Result result {0, 0.0, 0.0};
+	for (size_t i = 0; i < reference.samples.size(); ++i)
+	{
+		const double d = std::fabs (static_cast<double>(reference.samples[i]) - static_cast<double>(audio.samples[i]));
+		if (memcmp (&reference.samples[i], &audio.samples[i], sizeof (float))) ++result.ndiff;
+		result.max_abs = std::max (result.max_abs, d);
+	}
+	result.spectral = spectral_distance (reference, audio);
+	return result;
+}
+
+static void usage (const char* name)
+{
+	fprintf (stderr, "Usage: %s record|compare|list [-p PLUGIN] [-r DIR] [-m exact|tolerance] [-e MAX_ABS] [-d MAX_DB] [SCENARIO ...]\n", name);
+}
+
+int main (int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		usage (argv[0]);
+		return 2;
+	}
+
+	const std::string command = argv[1];
+	std::string plugin_path = "BVibratr.lv2/BVibratr.so";
+	std::string dir = "golden";
+	bool exact = true;
+	double max_abs = 1e-4;
+	double max_db = 0.1;
+	std::vector<std::string> selection;
+
+	for (int i = 2; i < argc; ++i)
+	{
+		const std::string arg = argv[i];
+		if ((arg == "-p") && (i + 1 < argc)) plugin_path = argv[++i];
+		else if ((arg == "-r") && (i + 1 < argc)) dir = argv[++i];
+		else if ((arg == "-m") && (i + 1 < argc)) exact = (std::string (argv[++i]) != "tolerance");
+		else if ((arg == "-e") && (i + 1 < argc)) max_abs = atof (argv[++i]);
+		else if ((arg == "-d") && (i + 1 < argc)) max_db = atof (argv[++i]);
+		else if (arg[0] != '-') selection.push_back (arg);
+		else
+		{
+			usage (argv[0]);
+			return 2;
+		}
+	}
+
+	const std::vector<Scenario> all = make_scenarios();
+	std::vector<Scenario> scenarios;
+	for (const Scenario& s : all)
+	{
+		if (selection.empty() || (std::find (selection.begin(), selection.end(), s.name) != selection.end())) scenarios.push_back (s);
+	}
+
+	if (command == "list")
+	{
+		for (const Scenario& s : scenarios) printf ("%s\n", s.name.c_str());
+		return 0;
+	}
+
+	if ((command != "record") && (command != "compare"))
+	{
+		usage (argv[0]);
+		return 2;
+	}
+
+	const LV2_Descriptor* descriptor = load_plugin (plugin_path);
+	if (!descriptor)
+	{
+		fprintf (stderr, "Can't load %s\n", plugin_path.c_str());
+		return 2;
+	}
+
+	if (command == "record") mkdir (dir.c_str(), 0755);
+
+	int failed = 0;
+	if (command == "compare") printf ("%-20s %10s %12s %12s  %s\n", "scenario", "ndiff", "max_abs", "lsd_db", "result");
+
+	for (const Scenario& s : scenarios)
+	{
+		const std::string path = dir + "/" + s.name + ".wav";
+		const Audio audio = render (descriptor, s);
+
+		if (command == "record")
+		{
+			if (!write_wav (path, audio))
+			{
+				fprintf (stderr, "Can't write %s\n", path.c_str());
+				return 2;
+			}
+			printf ("%s\n", path.c_str());
+			continue;
+		}
+
+		Audio reference;
+		if (!read_wav (path, reference))
+		{
+			fprintf (stderr, "Can't read %s\n", path.c_str());
+			return 2;
+		}
+
+		if ((reference.channels != audio.channels) || (reference.samples.size() != audio.samples.size()) || (reference.samplerate != audio.samplerate))
+		{
+			printf ("%-20s %10s %12s %12s  %s\n", s.name.c_str(), "-", "-", "-", "FAIL (format)");
+			++failed;
+			continue;
+		}
+
+		const Result r = compare (reference, audio);
+		const bool pass = (exact ? (r.ndiff == 0) : ((r.max_abs <= max_abs) && (r.spectral <= max_db)));
+		if (!pass) ++failed;
+		printf ("%-20s %10zu %12.3g %12.3g  %s\n", s.name.c_str(), r.ndiff, r.max_abs, r.spectral, (pass ? "pass" : "FAIL"));
+
+		// Always exact
+		if (!s.same_as.empty())
+		{
+			const std::vector<Scenario>::const_iterator base = std::find_if (all.begin(), all.end(), [&s] (const Scenario& b) {return b.name == s.same_as;});
+			const Result rb = compare (render (descriptor, *base), audio);
+			if (rb.ndiff) ++failed;
+			const std::string name = "= " + s.same_as;
+			printf ("%-20s %10zu %12.3g %12.3g  %s\n", name.c_str(), rb.ndiff, rb.max_abs, rb.spectral, (rb.ndiff ? "FAIL" : "pass"));
+		}
+	}
+
+	if (command == "compare") printf ("\n%zu scenarios, %i failed (%s)\n", scenarios.size(), failed, (exact ? "exact" : "tolerance"));
+	return (failed ? 1 : 0);
+}
@@ -0,0 +1,597 @@
+/* B.Vibratr realtime safety checker
+ *
+ * Drives the plugin shared object through all oscillator routing modes,
+ * waveforms, ADSR phases, MIDI scenarios, block sizes and sample rates (with
+ * and without a worker, with the pitch bend output, the CV inputs and outputs,
+ * and with modulation groups of instances running in parallel) and checks
+ * that run() and work_response() never allocate or free memory, lock or wait,
+ * or call the system. The memory, pthread and system call functions of the C
+ * library are interposed by this program. Each violation is reported
+ * together with a stack trace (once per call site).
+ *
+ * Usage: BVibratrRTCheck [OPTIONS]
+ *   -p FILE    Plugin shared object (default: BVibratr.lv2/BVibratr.so)
+ *   -t         Self test: Violates the rules inside the checked section
+ *
+ * Exit code: 0 if no violations were found, 1 on violations, 2 on errors.
+ *
+ * Needs to be linked with -rdynamic to export the interposed functions.
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <memory>
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include "Host.hpp"
+
+#define RTCHECK_MAX_FRAMES 32
+#define RTCHECK_MAX_SITES 256
+
+// Glibc allocator entry points (not interposed)
+extern "C" void* __libc_malloc (size_t size);
+extern "C" void* __libc_calloc (size_t n, size_t size);
+extern "C" void* __libc_realloc (void* ptr, size_t size);
+extern "C" void* __libc_memalign (size_t alignment, size_t size);
+extern "C" void __libc_free (void* ptr);
+
+static thread_local bool checking = false;		// Inside the checked section
+static thread_local bool reporting = false;		// Prevents recursion
+static std::atomic<uint64_t> violations (0);
+static uint64_t sites[RTCHECK_MAX_SITES];		// Hashes of the reported call sites
+static size_t nr_sites = 0;
+
+/**
+Reports a violation if called from inside the checked section. Only uses
+functions which don't allocate.
+@param function	Name of the interposed function.
+*/
+static void violation (const char* function)
+{
+	if ((!checking) || reporting) return;
+	reporting = true;
+	++violations;
+
+	void* frames[RTCHECK_MAX_FRAMES];
+	const int n = backtrace (frames, RTCHECK_MAX_FRAMES);
+
+	// Report each call site only once
+	uint64_t hash = 14695981039346656037ull;
+	for (int i = 0; i < n; ++i) hash = (hash ^ reinterpret_cast<uintptr_t> (frames[i])) * 1099511628211ull;
+	bool known = false;
+	for (size_t i = 0; i < nr_sites; ++i) known |= (sites[i] == hash);
+	if ((!known) && (nr_sites < RTCHECK_MAX_SITES))
+	{
+		sites[nr_sites++] = hash;
+		char msg[256];
+		const int len = snprintf (msg, sizeof (msg), "\nViolation: %s() called from run()\n", function);
+		if (write (STDERR_FILENO, msg, len) < 0) {}
+		backtrace_symbols_fd (frames + 1, n - 1, STDERR_FILENO);
+	}
+
+	reporting = false;
+}
+
+/**
+Gets the next definition of a C library function. Resolved before the
+checks start (see main), so dlsym doesn't run inside the checked section.
+*/
+template <class Func>
+static Func next (Func& cache, const char* name)
+{
+	if (!cache) cache = reinterpret_cast<Func> (dlsym (RTLD_NEXT, name));
+	return cache;
+}
+
+// Memory
+extern "C" void* malloc (size_t size) noexcept {violation ("malloc"); return __libc_malloc (size);}
+extern "C" void* calloc (size_t n, size_t size) noexcept {violation ("calloc"); return __libc_calloc (n, size);}
+extern "C" void* realloc (void* ptr, size_t size) noexcept {violation ("realloc"); return __libc_realloc (ptr, size);}
+extern "C" void free (void* ptr) noexcept {if (ptr) violation ("free"); __libc_free (ptr);}
+
+extern "C" int posix_memalign (void** ptr, size_t alignment, size_t size) noexcept
+{
+	violation ("posix_memalign");
+	*ptr = __libc_memalign (alignment, size);
+	return (*ptr ? 0 : ENOMEM);
+}
+
+extern "C" void* aligned_alloc (size_t alignment, size_t size) noexcept {violation ("aligned_alloc"); return __libc_memalign (alignment, size);}
+
+extern "C" void* mmap (void* addr, size_t length, int prot, int flags, int fd, off_t offset) noexcept
+{
+	typedef void* (*Func) (void*, size_t, int, int, int, off_t);
+	violation ("mmap");
+	static Func func = nullptr;
+	return next (func, "mmap") (addr, length, prot, flags, fd, offset);
+}
+
+extern "C" int munmap (void* addr, size_t length) noexcept
+{
+	typedef int (*Func) (void*, size_t);
+	violation ("munmap");
+	static Func func = nullptr;
+	return next (func, "munmap") (addr, length);
+}
+
+extern "C" int madvise (void* addr, size_t length, int advice) noexcept
+{
+	typedef int (*Func) (void*, size_t, int);
+	violation ("madvise");
+	static Func func = nullptr;
+	return next (func, "madvise") (addr, length, advice);
+}
+
+// Locks and waits
+extern "C" int pthread_mutex_lock (pthread_mutex_t* mutex) noexcept
+{
+	typedef int (*Func) (pthread_mutex_t*);
+	violation ("pthread_mutex_lock");
+	static Func func = nullptr;
+	return next (func, "pthread_mutex_lock") (mutex);
+}
+
+extern "C" int pthread_mutex_trylock (pthread_mutex_t* mutex) noexcept
+{
+	typedef int (*Func) (pthread_mutex_t*);
+	violation ("pthread_mutex_trylock");
+	static Func func = nullptr;
+	return next (func, "pthread_mutex_trylock") (mutex);
+}
+
+extern "C" int pthread_mutex_unlock (pthread_mutex_t* mutex) noexcept
+{
+	typedef int (*Func) (pthread_mutex_t*);
+	violation ("pthread_mutex_unlock");
+	static Func func = nullptr;
+	return next (func, "pthread_mutex_unlock") (mutex);
+}
+
+extern "C" int pthread_cond_wait (pthread_cond_t* cond, pthread_mutex_t* mutex)
+{
+	typedef int (*Func) (pthread_cond_t*, pthread_mutex_t*);
+	violation ("pthread_cond_wait");
+	static Func func = nullptr;
+	return next (func, "pthread_cond_wait") (cond, mutex);
+}
+
+extern "C" int pthread_cond_signal (pthread_cond_t* cond) noexcept
+{
+	typedef int (*Func) (pthread_cond_t*);
+	violation ("pthread_cond_signal");
+	static Func func = nullptr;
+	return next (func, "pthread_cond_signal") (cond);
+}
+
+extern "C" int pthread_create (pthread_t* thread, const pthread_attr_t* attr, void* (*start) (void*), void* arg) noexcept
+{
+	typedef int (*Func) (pthread_t*, const pthread_attr_t*, void* (*) (void*), void*);
+	violation ("pthread_create");
+	static Func func = nullptr;
+	return next (func, "pthread_create") (thread, attr, start, arg);
+}
+
+extern "C" int sched_yield () noexcept
+{
+	typedef int (*Func) ();
+	violation ("sched_yield");
+	static Func func = nullptr;
+	return next (func, "sched_yield") ();
+}
+
+extern "C" int nanosleep (const struct timespec* req, struct timespec* rem)
+{
+	typedef int (*Func) (const struct timespec*, struct timespec*);
+	violation ("nanosleep");
+	static Func func = nullptr;
+	return next (func, "nanosleep") (req, rem);
+}
+
+extern "C" int usleep (useconds_t usec)
+{
+	typedef int (*Func) (useconds_t);
+	violation ("usleep");
+	static Func func = nullptr;
+	return next (func, "usleep") (usec);
+}
+
+// System calls
+extern "C" ssize_t write (int fd, const void* buf, size_t count)
+{
+	typedef ssize_t (*Func) (int, const void*, size_t);
+	violation ("write");
+	static Func func = nullptr;
+	return next (func, "write") (fd, buf, count);
+}
+
+extern "C" ssize_t read (int fd, void* buf, size_t count)
+{
+	typedef ssize_t (*Func) (int, void*, size_t);
+	violation ("read");
+	static Func func = nullptr;
+	return next (func, "read") (fd, buf, count);
+}
+
+extern "C" int open (const char* path, int flags, ...)
+{
+	typedef int (*Func) (const char*, int, ...);
+	violation ("open");
+	va_list args;
+	va_start (args, flags);
+	const mode_t mode = va_arg (args, mode_t);
+	va_end (args);
+	static Func func = nullptr;
+	return next (func, "open") (path, flags, mode);
+}
+
+extern "C" int close (int fd)
+{
+	typedef int (*Func) (int);
+	violation ("close");
+	static Func func = nullptr;
+	return next (func, "close") (fd);
+}
+
+extern "C" long syscall (long number, ...)
+{
+	typedef long (*Func) (long, ...);
+	violation ("syscall");
+	va_list args;
+	va_start (args, number);
+	long a[6];
+	for (long& v : a) v = va_arg (args, long);
+	va_end (args);
+	static Func func = nullptr;
+	return next (func, "syscall") (number, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+/**
+Resolves all interposed functions by calling them once outside of the
+checked section.
+*/
+static void prepare ()
+{
+	void* frames[2];
+	backtrace (frames, 2);		// Loads libgcc
+	free (malloc (1));
+	free (calloc (1, 1));
+	void* ptr = nullptr;
+	if (!posix_memalign (&ptr, 64, 64)) free (ptr);
+	munmap (mmap (nullptr, 4096, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0), 4096);
+	pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+	pthread_mutex_lock (&mutex);
+	pthread_mutex_unlock (&mutex);
+	if (!pthread_mutex_trylock (&mutex)) pthread_mutex_unlock (&mutex);
+	pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+	pthread_cond_signal (&cond);
+	sched_yield ();
+	const struct timespec ts = {0, 0};
+	nanosleep (&ts, nullptr);
+	usleep (0);
+	if (write (STDOUT_FILENO, "", 0) < 0) {}
+	int fd = open ("/dev/null", O_RDONLY);
+	char c;
+	if (read (fd, &c, 0) < 0) {}
+	close (fd);
+	syscall (SYS_getpid);
+	madvise (nullptr, 0, MADV_NORMAL);
+}
+
+struct Scenario
+{
+	std::string name;
+	std::vector<std::pair<int, float>> controllers;
+	bool worker = false;	// Provide a worker (also checks work_response())
+	std::vector<std::pair<int, float>> ports = {};	// Optional control ports
+	bool cv_inputs = false;	// Connect the CV inputs
+	bool cv_outputs = false;	// Connect the CV outputs
+	bool midi_out = false;	// Connect the MIDI output
+	int members = 0;		// Further instances with the same ports, run in parallel
+};
+
+/**
+Plugin instance with its port buffers.
+*/
+struct Instance
+{
+	Host host;
+	std::vector<float> ports;
+	std::vector<uint64_t> notify_buffer;
+	std::vector<uint64_t> midi_out_buffer;
+	std::vector<float> out_1;
+	std::vector<float> out_2;
+	std::vector<float> cv_modulation;
+	std::vector<float> cv_tremolo;
+	std::vector<float> cv_shift;
+
+	/**
+	Instantiates the plugin and connects the ports of a scenario.
+	@param descriptor	Plugin descriptor.
+	@param scenario		Scenario.
+	@param rate			Sample rate.
+	@param block		Block size.
+	@param notify		Connect the notify port.
+	@param member		Number of the instance. Members other than 0 are
+						delayed by the modulation offset.
+	*/
+	Instance (const LV2_Descriptor* descriptor, const Scenario& scenario, const double rate, const uint32_t block, const bool notify, const int member) :
+		host (descriptor, rate, 1024, scenario.worker),
+		ports (scenario.ports.size() + 1),
+		notify_buffer (1024),
+		midi_out_buffer (4096),
+		out_1 (block),
+		out_2 (block),
+		cv_modulation (block),
+		cv_tremolo (block),
+		cv_shift (block)
+	{
+		for (const std::pair<int, float>& c : scenario.controllers) host.set_controller (c.first, c.second);
+
+		// Short ADSR to pass all phases
+		host.set_controller (BVIBRATR_DEPTH_ATTACK, 0.05f);
+		host.set_controller (BVIBRATR_DEPTH_DECAY, 0.05f);
+		host.set_controller (BVIBRATR_DEPTH_RELEASE, 0.05f);
+
+		if (notify) host.connect_port (BVIBRATR_NOTIFY, notify_buffer.data());
+		if (scenario.midi_out) host.connect_port (BVIBRATR_MIDI_OUT, midi_out_buffer.data());
+
+		for (size_t i = 0; i < scenario.ports.size(); ++i)
+		{
+			ports[i] = scenario.ports[i].second;
+			host.connect_port (scenario.ports[i].first, &ports[i]);
+		}
+		if (member)
+		{
+			ports.back() = 5.0f * member;
+			host.connect_port (BVIBRATR_MODULATION_OFFSET, &ports.back());
+		}
+
+		if (scenario.cv_outputs)
+		{
+			host.connect_port (BVIBRATR_CV_MODULATION, cv_modulation.data());
+			host.connect_port (BVIBRATR_CV_TREMOLO, cv_tremolo.data());
+			host.connect_port (BVIBRATR_CV_SHIFT, cv_shift.data());
+		}
+	}
+
+	/**
+	Resets the capacities of the atom output buffers. Needs to be called
+	before each run.
+	*/
+	void prepare_outputs ()
+	{
+		LV2_Atom_Sequence* notify_seq = reinterpret_cast<LV2_Atom_Sequence*> (notify_buffer.data());
+		notify_seq->atom.size = notify_buffer.size() * sizeof (uint64_t) - sizeof (LV2_Atom);
+		LV2_Atom_Sequence* midi_out_seq = reinterpret_cast<LV2_Atom_Sequence*> (midi_out_buffer.data());
+		midi_out_seq->atom.size = midi_out_buffer.size() * sizeof (uint64_t) - sizeof (LV2_Atom);
+	}
+};
+
+/**
+Runs a scenario with a note on, MIDI controllers, a note off and a
+retrigger for each block size and sample rate, with and without the notify
+port. Also automates some controllers. Further members of a scenario run in
+a second thread at the same time as the first instance.
+@param descriptor	Plugin descriptor.
+@param scenario		Scenario.
+@param self_test	Violates the rules inside the checked section.
+*/
+static void check (const LV2_Descriptor* descriptor, const Scenario& scenario, const bool self_test)
+{
+	const uint64_t before = violations;
+	for (double rate : {44100.0, 96000.0})
+	{
+		for (uint32_t block : {1u, 37u, 256u, 1024u, 4096u})
+		{
+			for (bool notify : {false, true})
+			{
+				std::vector<std::unique_ptr<Instance>> instances;
+				for (int m = 0; m <= scenario.members; ++m)
+				{
+					instances.emplace_back (new Instance (descriptor, scenario, rate, block, notify, m));
+				}
+
+				std::vector<float> in_1 (block);
+				std::vector<float> in_2 (block);
+				for (uint32_t i = 0; i < block; ++i)
+				{
+					in_1[i] = 0.5f * std::sin (0.05f * i);
+					in_2[i] = 0.5f * std::cos (0.03f * i);
+				}
+
+				std::vector<float> cv_pitch (block);
+				std::vector<float> cv_tremolo (block);
+				for (uint32_t i = 0; i < block; ++i)
+				{
+					cv_pitch[i] = std::sin (0.001f * i);
+					cv_tremolo[i] = std::cos (0.002f * i);
+				}
+				if (scenario.cv_inputs)
+				{
+					for (std::unique_ptr<Instance>& instance : instances)
+					{
+						instance->host.connect_port (BVIBRATR_CV_PITCH_IN, cv_pitch.data());
+						instance->host.connect_port (BVIBRATR_CV_TREMOLO_IN, cv_tremolo.data());
+					}
+				}
+
+				// Members: Wait for the block number (outside the checked
+				// section), run and report the block number as done
+				std::atomic<uint32_t> go (0);
+				std::atomic<uint32_t> done (0);
+				std::atomic<bool> quit (false);
+				std::thread members;
+				if (scenario.members)
+				{
+					members = std::thread
+					(
+						[&] ()
+						{
+							for (uint32_t n = 1; ; ++n)
+							{
+								while ((go.load (std::memory_order_acquire) < n) && (!quit.load (std::memory_order_acquire))) sched_yield ();
+								if (go.load (std::memory_order_acquire) < n) break;
+
+								checking = true;
+								for (size_t m = 1; m < instances.size(); ++m)
+								{
+									Instance& instance = *instances[m];
+									instance.host.run (in_1.data(), in_2.data(), instance.out_1.data(), instance.out_2.data(), block);
+								}
+								checking = false;
+								done.store (n, std::memory_order_release);
+							}
+						}
+					);
+				}
+
+				// 0.5 s: note on, CCs, note off, retrigger, all notes off
+				const uint64_t frames = rate / 2;
+				const uint32_t blocks = (frames + block - 1) / block;
+				for (uint32_t b = 0; b < blocks; ++b)
+				{
+					const uint64_t t0 = uint64_t (b) * block;
+					const uint64_t t1 = t0 + block;
+					auto at = [&] (const uint64_t t) {return (t >= t0) && (t < t1);};
+					for (std::unique_ptr<Instance>& instance : instances)
+					{
+						Host& host = instance->host;
+						if (at (frames / 20)) host.add_midi (t0 ? 0 : frames / 20, LV2_MIDI_MSG_NOTE_ON, 60, 100);
+						if (at (frames / 10)) host.add_midi (0, LV2_MIDI_MSG_CONTROLLER, 1, 64);
+						if (at (frames / 2)) host.add_midi (0, LV2_MIDI_MSG_NOTE_OFF, 60, 0);
+						if (at (frames / 2 + frames / 10)) host.add_midi (0, LV2_MIDI_MSG_NOTE_ON, 62, 100);
+						if (at (frames / 2 + frames / 5)) host.add_midi (0, LV2_MIDI_MSG_PGM_CHANGE, 1, 0);
+						if (at (frames / 2 + frames / 4)) host.add_midi (0, LV2_MIDI_MSG_BENDER, 0, 64);
+						if (at (3 * frames / 4)) host.add_midi (0, LV2_MIDI_MSG_CONTROLLER, LV2_MIDI_CTL_ALL_NOTES_OFF, 0);
+						if (at (7 * frames / 8)) host.add_midi (0, LV2_MIDI_MSG_CONTROLLER, LV2_MIDI_CTL_ALL_SOUNDS_OFF, 0);
+						if (b % 16 == 8)
+						{
+							host.set_controller (BVIBRATR_OSC1_FREQ, 1.0f + (b % 7));
+							host.set_controller (BVIBRATR_DRY_WET, 0.1f * (b % 10));
+						}
+						instance->prepare_outputs ();
+					}
+
+					go.store (b + 1, std::memory_order_release);
+
+					Instance& leader = *instances[0];
+					checking = true;
+					leader.host.run (in_1.data(), in_2.data(), leader.out_1.data(), leader.out_2.data(), block);
+					if (self_test && (b == 0)) free (malloc (16));
+					checking = false;
+
+					if (scenario.members)
+					{
+						while (done.load (std::memory_order_acquire) < b + 1) sched_yield ();
+					}
+					for (std::unique_ptr<Instance>& instance : instances) instance->host.work ();
+				}
+
+				if (scenario.members)
+				{
+					quit.store (true, std::memory_order_release);
+					members.join ();
+				}
+			}
+		}
+	}
+
+	const uint64_t found = violations - before;
+	printf ("%-24s %s\n", scenario.name.c_str(), (found ? ("FAILED (" + std::to_string (found) + " violations)").c_str() : "ok"));
+}
+
+int main (int argc, char** argv)
+{
+	std::string plugin = "BVibratr.lv2/BVibratr.so";
+	bool self_test = false;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (!strcmp (argv[i], "-p") && (i + 1 < argc)) plugin = argv[++i];
+		else if (!strcmp (argv[i], "-t")) self_test = true;
+		else
+		{
+			fprintf (stderr, "Usage: %s [-p PLUGIN] [-t]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	prepare ();
+	const LV2_Descriptor* descriptor = load_plugin (plugin);
+	if (!descriptor)
+	{
+		fprintf (stderr, "Can't load %s: %s\n", plugin.c_str(), dlerror());
+		return 2;
+	}
+
+	// Routing modes x waveforms, osc1 user mode, MIDI controlled depth,
+	// precomputed attack and decay
+	std::vector<Scenario> scenarios;
+	for (int osc2_mode = BVIBRATR_OSC_MODE_ADD; osc2_mode <= BVIBRATR_OSC_MODE_AM1; ++osc2_mode)
+	{
+		for (int osc3_mode = BVIBRATR_OSC_MODE_ADD; osc3_mode <= BVIBRATR_OSC_MODE_AM2; ++osc3_mode)
+		{
+			for (int waveform = 1; waveform <= 3; ++waveform)
+			{
+				scenarios.push_back
+				({
+					"osc2_" + std::to_string (osc2_mode) + "_osc3_" + std::to_string (osc3_mode) + "_wave_" + std::to_string (waveform),
+					{
+						{BVIBRATR_OSC2_MODE, osc2_mode}, {BVIBRATR_OSC3_MODE, osc3_mode},
+						{BVIBRATR_OSC2_AMP, 0.5f}, {BVIBRATR_OSC3_AMP, 0.5f},
+						{BVIBRATR_OSC1_WAVEFORM, waveform}, {BVIBRATR_OSC2_WAVEFORM, waveform}, {BVIBRATR_OSC3_WAVEFORM, waveform},
+						{BVIBRATR_TREMOLO, 0.3f}
+					}
+				});
+			}
+		}
+	}
+	scenarios.push_back ({"osc1_user", {{BVIBRATR_OSC1_MODE, BVIBRATR_OSC_MODE_USER}, {BVIBRATR_OSC2_MODE, BVIBRATR_OSC_MODE_ADD}}});
+	scenarios.push_back ({"depth_cc", {{BVIBRATR_DEPTH_IS_CC, 1.0f}}});
+	scenarios.push_back ({"any_note_bypass", {{BVIBRATR_MIDI_NOTE, 128.0f}, {BVIBRATR_BYPASS, 1.0f}}});
+	scenarios.push_back ({"worker", {{BVIBRATR_OSC2_MODE, BVIBRATR_OSC_MODE_ADD}, {BVIBRATR_OSC3_MODE, BVIBRATR_OSC_MODE_FM1}}, true});
+	scenarios.push_back ({"worker_pm", {{BVIBRATR_OSC2_MODE, BVIBRATR_OSC_MODE_PM1}, {BVIBRATR_OSC3_MODE, BVIBRATR_OSC_MODE_AM2}}, true});
+	scenarios.push_back ({"cv_pitch", {{BVIBRATR_TREMOLO, 0.3f}}, false, {{BVIBRATR_MODULATION_SOURCE, BVIBRATR_MODULATION_SOURCE_CV_PITCH}}, true, true});
+	scenarios.push_back ({"cv_tremolo", {{BVIBRATR_TREMOLO, 0.3f}}, false, {{BVIBRATR_MODULATION_SOURCE, BVIBRATR_MODULATION_SOURCE_CV}}, true, true});
+	scenarios.push_back ({"cv_outputs", {{BVIBRATR_TREMOLO, 0.3f}}, false, {}, false, true});
+
+	// Pitch bend output, also with a worker
+	const std::vector<std::pair<int, float>> bend =
+	{
+		{BVIBRATR_VIBRATO_OUTPUT, BVIBRATR_VIBRATO_OUTPUT_PITCH_BEND}, {BVIBRATR_BEND_RATE, 200.0f},
+		{BVIBRATR_BEND_RANGE, 2.0f}, {BVIBRATR_BEND_CHANNEL, 1.0f}
+	};
+	scenarios.push_back ({"pitch_bend", {{BVIBRATR_TREMOLO, 0.3f}}, false, bend, false, true, true});
+	scenarios.push_back ({"pitch_bend_worker", {{BVIBRATR_OSC2_MODE, BVIBRATR_OSC_MODE_PM1}}, true, bend, false, true, true});
+
+	// Modulation groups: A leader and two delayed members in parallel, also
+	// with a worker, with pitch bend and with the CV inputs
+	const std::vector<std::pair<int, float>> group = {{BVIBRATR_MODULATION_GROUP, 1.0f}};
+	std::vector<std::pair<int, float>> group_bend = bend;
+	group_bend.push_back ({BVIBRATR_MODULATION_GROUP, 2.0f});
+	const std::vector<std::pair<int, float>> group_cv = {{BVIBRATR_MODULATION_GROUP, 3.0f}, {BVIBRATR_MODULATION_SOURCE, BVIBRATR_MODULATION_SOURCE_CV}};
+	scenarios.push_back ({"group", {{BVIBRATR_TREMOLO, 0.3f}}, false, group, false, true, false, 2});
+	scenarios.push_back ({"group_worker", {{BVIBRATR_OSC3_MODE, BVIBRATR_OSC_MODE_FM1}}, true, group, false, true, false, 2});
+	scenarios.push_back ({"group_pitch_bend", {{BVIBRATR_TREMOLO, 0.3f}}, false, group_bend, false, true, true, 2});
+	scenarios.push_back ({"group_cv", {{BVIBRATR_TREMOLO, 0.3f}}, false, group_cv, true, true, false, 2});
+
+	for (const Scenario& s : scenarios) check (descriptor, s, self_test);
+
+	printf ("\n%zu scenarios, %llu violations\n", scenarios.size(), static_cast<unsigned long long> (violations.load()));
+	return (violations ? 1 : 0);
+}
@@ -0,0 +1,313 @@
+/* B.Vibratr offline renderer
+ *
+ * Renders WAV files through the plugin (linked in, no LV2 host needed).
+ * The input is memory mapped and the output is streamed, block by block. The
+ * memory used doesn't depend on the file size. Files larger than 4 GB are
+ * written as RF64. Each pair of channels is processed by its own plugin
+ * instance, an odd last channel by an instance with both inputs connected to
+ * this channel. All instances get the same MIDI messages and controller
+ * values. The latency is compensated unless -L is given.
+ *
+ * Batch mode (-j) renders the jobs of a manifest file on all cores. Each
+ * line of the manifest contains the input and output file and optionally
+ * render options (same as below) for this job, e.g.:
+ *   stems/bass.wav out/bass.wav -n 40:0.0:12.5 -s depth=30
+ * Empty lines and lines starting with # are ignored. Paths containing spaces
+ * must be quoted ("..."). Render options given on the command line apply to
+ * all jobs. Each worker renders one job at a time with its own instances.
+ *
+ * Parallel mode (-P) splits a single file into chunks and renders them on
+ * all cores. A serial pass first computes the modulation only and saves its
+ * state (checkpoint) before each chunk. Each chunk starts from its
+ * checkpoint with a warm-up of 2 * latency + 1 frames to fill the delay
+ * lines. The result is identical to the serial rendering.
+ *
+ * Usage: BVibratrRender [OPTIONS] INPUT OUTPUT
+ *        BVibratrRender [OPTIONS] -P [-w WORKERS] INPUT OUTPUT
+ *        BVibratrRender [OPTIONS] -j MANIFEST [-w WORKERS]
+ *   -m FILE        Standard MIDI file
+ *   -n NOTE        Note NOTE:START:END[:VELOCITY[:CHANNEL]], START and END in
+ *                  seconds (repeatable)
+ *   -s SYM=VALUE   Controller value by symbol, e.g., -s depth=40
+ *                  (repeatable)
+ *   -B FRAMES      Block size (default: 4096)
+ *   -b BITS        Output format: 16 or 24 (PCM), 32 or 64 (float, default:
+ *                  32)
+ *   -t SECONDS     Additional time rendered after the end of the input
+ *   -L             Don't compensate the latency
+ *   -j FILE        Batch mode: Render the jobs of a manifest file
+ *   -P             Parallel mode: Render a single file on all cores
+ *   -w NUMBER      Number of workers in batch and parallel mode (default:
+ *                  number of hardware threads)
+ *   -q             Quiet
+ *
+ * Exit code: 0 on success, 1 on errors (in batch mode: if any job failed).
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "Render.hpp"
+
+extern "C" LV2_SYMBOL_EXPORT const LV2_Descriptor* lv2_descriptor (uint32_t index);
+
+static void usage (const char* name)
+{
+	fprintf
+	(
+		stderr,
+		"Usage: %s [-m MIDIFILE] [-n NOTE:START:END[:VELOCITY[:CHANNEL]]] [-s SYMBOL=VALUE] [-B FRAMES] [-b BITS] [-t SECONDS] [-L] [-q] INPUT OUTPUT\n"
+		"       %s [OPTIONS] -P [-w WORKERS] INPUT OUTPUT\n"
+		"       %s [OPTIONS] -j MANIFEST [-w WORKERS]\n",
+		name, name, name
+	);
+}
+
+/**
+Splits a manifest line into arguments. Arguments are separated by white
+space, double quotes enclose arguments with white space.
+@param line	Line.
+@return		Arguments.
+*/
+static std::vector<std::string> split_line (const std::string& line)
+{
+	std::vector<std::string> args;
+	std::string arg;
+	bool in_arg = false;
+	bool quoted = false;
+	for (char c : line)
+	{
+		if (c == '"')
+		{
+			quoted = !quoted;
+			in_arg = true;
+		}
+		else if ((!quoted) && ((c == ' ') || (c == '\t') || (c == '\r')))
+		{
+			if (in_arg) args.push_back (arg);
+			arg.clear();
+			in_arg = false;
+		}
+		else
+		{
+			arg += c;
+			in_arg = true;
+		}
+	}
+	if (in_arg) args.push_back (arg);
+	return args;
+}
+
+/**
+Reads the jobs of a manifest file.
+@param path		Path to the manifest file.
+@param defaults	Default settings for all jobs.
+@param jobs		Target.
+@return			Empty string on success, otherwise an error message.
+*/
+static std::string read_manifest (const std::string& path, const RenderJob& defaults, std::vector<RenderJob>& jobs)
+{
+	std::ifstream file (path);
+	if (!file) return "Can't open " + path;
+
+	std::string line;
+	int nr = 0;
+	while (std::getline (file, line))
+	{
+		++nr;
+		const std::vector<std::string> args = split_line (line);
+		if (args.empty() || (args[0][0] == '#')) continue;
+
+		RenderJob job = defaults;
+		const std::string error = parse_render_args (args, job);
+		if (!error.empty()) return path + ":" + std::to_string (nr) + ": " + error;
+		if (job.output.empty()) return path + ":" + std::to_string (nr) + ": Input and output required";
+		jobs.push_back (job);
+	}
+
+	return "";
+}
+
+static int render_single (const RenderJob& job, const bool parallel, const size_t workers, const bool quiet)
+{
+	const auto t0 = std::chrono::steady_clock::now();
+	RenderResult result;
+	const std::string error =	(parallel ?
+								render_parallel (lv2_descriptor (0), job, result, workers) :
+								render (lv2_descriptor (0), job, result));
+	if (!error.empty())
+	{
+		fprintf (stderr, "%s\n", error.c_str());
+		return 1;
+	}
+
+	const double seconds = std::chrono::duration<double> (std::chrono::steady_clock::now() - t0).count();
+	if (!quiet)
+	{
+		printf
+		(
+			"%s: %" PRIu64 " frames, %u channels, %.0f Hz, %zu MIDI messages, %.3f s (%.1f x realtime)\n",
+			job.output.c_str(), result.frames, result.channels, result.samplerate, job.events.size(), seconds,
+			result.frames / result.samplerate / std::max (seconds, 1e-9)
+		);
+	}
+	return 0;
+}
+
+static int render_batch (const std::vector<RenderJob>& jobs, const size_t workers, const bool quiet)
+{
+	// Size of each job to start with the largest jobs
+	std::vector<uint64_t> frames (jobs.size(), 0);
+	uint64_t total_frames = 0;
+	double total_duration = 0.0;
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		WavReader reader;
+		if (reader.open (jobs[i].input).empty())
+		{
+			frames[i] = reader.frames() + uint64_t (jobs[i].tail * reader.samplerate());
+			total_frames += frames[i];
+			total_duration += frames[i] / reader.samplerate();
+		}
+	}
+
+	std::vector<size_t> order (jobs.size());
+	for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+	std::stable_sort (order.begin(), order.end(), [&frames] (size_t a, size_t b) {return frames[a] > frames[b];});
+
+	WorkPool pool (workers);
+	std::atomic<uint64_t> progress (0);
+	std::atomic<size_t> done (0);
+	std::atomic<size_t> failed (0);
+	std::atomic<bool> running (true);
+	std::mutex output_mutex;
+	const bool tty = isatty (fileno (stderr));
+	const auto t0 = std::chrono::steady_clock::now();
+	auto elapsed = [&t0] () {return std::chrono::duration<double> (std::chrono::steady_clock::now() - t0).count();};
+
+	if (!quiet) fprintf (stderr, "%zu jobs, %.1f s audio, %zu workers\n", jobs.size(), total_duration, std::min (pool.workers(), jobs.size()));
+
+	// Progress line on terminals, a line for each job otherwise
+	std::thread reporter
+	(
+		[&] ()
+		{
+			while (running.load() && tty && (!quiet))
+			{
+				std::this_thread::sleep_for (std::chrono::milliseconds (500));
+				const double part = (total_frames ? double (progress.load()) / total_frames : 0.0);
+				std::lock_guard<std::mutex> lock (output_mutex);
+				fprintf
+				(
+					stderr, "\r[%zu/%zu] %5.1f %%, %.1f x realtime  ",
+					done.load(), jobs.size(), 100.0 * part, part * total_duration / std::max (elapsed(), 1e-9)
+				);
+			}
+		}
+	);
+
+	pool.run
+	(
+		jobs.size(),
+		[&] (size_t task, size_t worker)
+		{
+			const RenderJob& job = jobs[order[task]];
+			RenderResult result;
+			const auto j0 = std::chrono::steady_clock::now();
+			const std::string error = render (lv2_descriptor (0), job, result, &progress);
+			const double seconds = std::chrono::duration<double> (std::chrono::steady_clock::now() - j0).count();
+			const size_t nr = ++done;
+			if (!error.empty()) ++failed;
+
+			std::lock_guard<std::mutex> lock (output_mutex);
+			if (!error.empty()) fprintf (stderr, "%s%s\n", (tty ? "\r" : ""), error.c_str());
+			else if ((!quiet) && (!tty))
+			{
+				fprintf
+				(
+					stderr, "[%zu/%zu] %s: %.3f s (%.1f x realtime)\n",
+					nr, jobs.size(), job.output.c_str(), seconds, result.frames / result.samplerate / std::max (seconds, 1e-9)
+				);
+			}
+		}
+	);
+
+	running.store (false);
+	reporter.join();
+
+	const double seconds = elapsed();
+	if (!quiet)
+	{
+		if (tty) fprintf (stderr, "\n");
+		printf
+		(
+			"%zu jobs, %zu failed, %.1f s audio in %.3f s (%.1f x realtime, %.2f jobs/s)\n",
+			jobs.size(), failed.load(), total_duration, seconds, total_duration / std::max (seconds, 1e-9), jobs.size() / std::max (seconds, 1e-9)
+		);
+	}
+	return (failed.load() ? 1 : 0);
+}
+
+int main (int argc, char** argv)
+{
+	std::vector<std::string> args;
+	std::string manifest;
+	size_t workers = 0;
+	bool parallel = false;
+	bool quiet = false;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (!strcmp (argv[i], "-j") && (i + 1 < argc)) manifest = argv[++i];
+		else if (!strcmp (argv[i], "-w") && (i + 1 < argc)) workers = std::max (atoi (argv[++i]), 0);
+		else if (!strcmp (argv[i], "-P")) parallel = true;
+		else if (!strcmp (argv[i], "-q")) quiet = true;
+		else args.push_back (argv[i]);
+	}
+
+	RenderJob job;
+	const std::string error = parse_render_args (args, job);
+	if (!error.empty())
+	{
+		fprintf (stderr, "%s\n", error.c_str());
+		usage (argv[0]);
+		return 1;
+	}
+
+	// Single file
+	if (manifest.empty())
+	{
+		if (job.output.empty())
+		{
+			usage (argv[0]);
+			return 1;
+		}
+		return render_single (job, parallel, workers, quiet);
+	}
+
+	// Batch
+	if ((!job.input.empty()) || parallel)
+	{
+		usage (argv[0]);
+		return 1;
+	}
+
+	std::vector<RenderJob> jobs;
+	const std::string manifest_error = read_manifest (manifest, job, jobs);
+	if (!manifest_error.empty())
+	{
+		fprintf (stderr, "%s\n", manifest_error.c_str());
+		return 1;
+	}
+	return render_batch (jobs, workers, quiet);
+}
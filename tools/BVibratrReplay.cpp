@@ -0,0 +1,260 @@
+/* B.Vibratr trace replayer
+ *
+ * Replays a trace recorded by a plugin built with TRACE=1 (see README.md)
+ * through the plugin shared object at full speed and reports the time used
+ * by the run() calls. The audio input is replaced by silence if it isn't
+ * part of the trace.
+ *
+ * Usage: BVibratrReplay [OPTIONS] TRACE
+ *   -p FILE    Plugin shared object (default: BVibratr.lv2/BVibratr.so)
+ *   -n NUMBER  Number of passes (default: 1)
+ *   -o FILE    Write the output of the first pass to a WAV file
+ *
+ * Exit code: 0 on success, 1 on errors.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "Host.hpp"
+#include "Wav.hpp"
+#include "../src/TraceRecorder.hpp"
+
+struct Trace
+{
+	TraceFileHeader header;
+	std::vector<uint8_t> data;					// Records
+	std::vector<size_t> records;				// Record offsets in data
+	size_t runs;
+	size_t activates;
+	size_t dropped;
+	uint64_t frames;
+	uint32_t max_block;
+	uint32_t max_events;
+	bool audio;									// Audio input recorded
+};
+
+/**
+Reads and validates a trace file.
+@param path		Path to the trace file.
+@param trace	Trace.
+@return			Empty string on success, otherwise an error message.
+*/
+static std::string read_trace (const std::string& path, Trace& trace)
+{
+	FILE* file = fopen (path.c_str(), "rb");
+	if (!file) return "Can't open " + path;
+
+	bool ok = (fread (&trace.header, sizeof (trace.header), 1, file) == 1);
+	if (ok)
+	{
+		uint8_t buffer[65536];
+		size_t n;
+		while ((n = fread (buffer, 1, sizeof (buffer), file)) > 0) trace.data.insert (trace.data.end(), buffer, buffer + n);
+	}
+	fclose (file);
+
+	if ((!ok) || memcmp (trace.header.magic, TRACE_MAGIC, 4)) return path + " is not a trace file";
+	if (trace.header.version != TRACE_VERSION) return "Unsupported trace version " + std::to_string (trace.header.version);
+	if (trace.header.controllers != BVIBRATR_NR_CONTROLLERS) return "Trace doesn't match the number of controllers";
+
+	trace.records.clear();
+	trace.runs = 0;
+	trace.activates = 0;
+	trace.dropped = 0;
+	trace.frames = 0;
+	trace.max_block = 0;
+	trace.max_events = 0;
+	trace.audio = false;
+	size_t pos = 0;
+	while (pos + sizeof (TraceRecordHeader) <= trace.data.size())
+	{
+		TraceRecordHeader record;
+		memcpy (&record, &trace.data[pos], sizeof (record));
+		if ((record.size < sizeof (record)) || (pos + record.size > trace.data.size())) break;	// Truncated
+
+		trace.records.push_back (pos);
+		trace.dropped += record.dropped;
+		if (record.type == TRACE_ACTIVATE) ++trace.activates;
+		else if (record.type == TRACE_RUN)
+		{
+			++trace.runs;
+			trace.frames += record.n_samples;
+			trace.max_block = std::max (trace.max_block, record.n_samples);
+			trace.max_events = std::max (trace.max_events, record.midi_events);
+			if (record.flags & TRACE_AUDIO) trace.audio = true;
+		}
+		pos += record.size;
+	}
+
+	return "";
+}
+
+/**
+Replays a trace.
+@param descriptor	Plugin descriptor.
+@param trace		Trace.
+@param times		Time used by each run() call in ns.
+@param output		Output audio or nullptr.
+*/
+static void replay (const LV2_Descriptor* descriptor, const Trace& trace, std::vector<double>& times, Audio* output)
+{
+	Host host (descriptor, trace.header.samplerate, std::max<uint32_t> (trace.max_events, 1024));
+	std::vector<float> in_1 (trace.max_block, 0.0f);
+	std::vector<float> in_2 (trace.max_block, 0.0f);
+	std::vector<float> out_1 (trace.max_block, 0.0f);
+	std::vector<float> out_2 (trace.max_block, 0.0f);
+	times.clear();
+	times.reserve (trace.runs);
+	if (output)
+	{
+		output->channels = 2;
+		output->samplerate = trace.header.samplerate;
+		output->samples.clear();
+		output->samples.reserve (2 * trace.frames);
+	}
+
+	bool activated = true;	// By Host
+	for (size_t pos : trace.records)
+	{
+		TraceRecordHeader record;
+		memcpy (&record, &trace.data[pos], sizeof (record));
+		if (record.type == TRACE_ACTIVATE)
+		{
+			// The first activate() was already called by Host
+			if (!activated) host.activate();
+			activated = false;
+			continue;
+		}
+		if (record.type != TRACE_RUN) continue;
+		activated = false;
+
+		// Controllers
+		const uint8_t* ptr = &trace.data[pos + sizeof (record)];
+		for (int i = 0; i < BVIBRATR_NR_CONTROLLERS; ++i)
+		{
+			float value;
+			memcpy (&value, ptr, sizeof (value));
+			host.set_controller (i, value);
+			ptr += sizeof (value);
+		}
+
+		// MIDI
+		for (uint32_t i = 0; i < record.midi_events; ++i)
+		{
+			TraceMidiEvent ev;
+			memcpy (&ev, ptr, sizeof (ev));
+			ptr += sizeof (ev);
+			host.add_midi (ev.frame, ptr, ev.size);
+			ptr += (ev.size + 3) & ~uint32_t (3);
+		}
+
+		// Audio
+		const uint32_t n = record.n_samples;
+		if (record.flags & TRACE_AUDIO)
+		{
+			memcpy (in_1.data(), ptr, n * sizeof (float));
+			memcpy (in_2.data(), ptr + n * sizeof (float), n * sizeof (float));
+		}
+
+		const auto t0 = std::chrono::steady_clock::now();
+		host.run (in_1.data(), in_2.data(), out_1.data(), out_2.data(), n);
+		const auto t1 = std::chrono::steady_clock::now();
+		times.push_back (std::chrono::duration<double, std::nano> (t1 - t0).count());
+
+		if (output)
+		{
+			for (uint32_t i = 0; i < n; ++i)
+			{
+				output->samples.push_back (out_1[i]);
+				output->samples.push_back (out_2[i]);
+			}
+		}
+	}
+}
+
+int main (int argc, char** argv)
+{
+	std::string plugin = "BVibratr.lv2/BVibratr.so";
+	std::string wav;
+	std::string path;
+	int passes = 1;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (!strcmp (argv[i], "-p") && (i + 1 < argc)) plugin = argv[++i];
+		else if (!strcmp (argv[i], "-n") && (i + 1 < argc)) passes = std::max (1, atoi (argv[++i]));
+		else if (!strcmp (argv[i], "-o") && (i + 1 < argc)) wav = argv[++i];
+		else if ((argv[i][0] != '-') && path.empty()) path = argv[i];
+		else
+		{
+			fprintf (stderr, "Usage: %s [-p PLUGIN] [-n PASSES] [-o WAV] TRACE\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (path.empty())
+	{
+		fprintf (stderr, "Usage: %s [-p PLUGIN] [-n PASSES] [-o WAV] TRACE\n", argv[0]);
+		return 1;
+	}
+
+	Trace trace;
+	const std::string error = read_trace (path, trace);
+	if (!error.empty())
+	{
+		fprintf (stderr, "%s\n", error.c_str());
+		return 1;
+	}
+
+	const LV2_Descriptor* descriptor = load_plugin (plugin);
+	if (!descriptor)
+	{
+		fprintf (stderr, "Can't load %s: %s\n", plugin.c_str(), dlerror());
+		return 1;
+	}
+
+	const double duration = trace.frames / trace.header.samplerate;
+	printf ("Trace: %s\n", path.c_str());
+	printf ("  %.0f Hz, %zu runs, %zu activates, %.3f s, max. block %u, %s\n",
+		trace.header.samplerate, trace.runs, trace.activates, duration, trace.max_block,
+		(trace.audio ? "with audio" : "without audio (silence)"));
+	if (trace.dropped) printf ("  Warning: %zu records were dropped while recording\n", trace.dropped);
+	if (!trace.runs) return 0;
+
+	printf ("\n%5s %12s %10s %12s %12s %12s %12s\n", "pass", "total ms", "x realtime", "mean ns", "p50 ns", "p99 ns", "max ns");
+	for (int p = 0; p < passes; ++p)
+	{
+		Audio output;
+		std::vector<double> times;
+		try {replay (descriptor, trace, times, ((p == 0) && (!wav.empty()) ? &output : nullptr));}
+		catch (const std::exception& e)
+		{
+			fprintf (stderr, "%s\n", e.what());
+			return 1;
+		}
+
+		double total = 0.0;
+		for (double t : times) total += t;
+		std::vector<double> sorted = times;
+		std::sort (sorted.begin(), sorted.end());
+		printf
+		(
+			"%5i %12.3f %10.1f %12.0f %12.0f %12.0f %12.0f\n",
+			p + 1, total * 1e-6, duration / (total * 1e-9), total / times.size(),
+			sorted[sorted.size() / 2], sorted[std::min (sorted.size() - 1, sorted.size() * 99 / 100)], sorted.back()
+		);
+
+		if ((p == 0) && (!wav.empty()) && (!write_wav (wav, output)))
+		{
+			fprintf (stderr, "Can't write %s\n", wav.c_str());
+			return 1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,186 @@
+/* B.Vibratr random access check
+ *
+ * Compares the modulation state predicted by
+ * BVibratrEngine::get_modulation_at() and by BVibratrTimeline with frame by
+ * frame processing (BVibratrEngine::advance()) for all oscillator routing
+ * modes and waveforms through all ADSR phases (note on, attack, decay,
+ * sustain, note off, release, idle).
+ *
+ * Exact predictions (see BVibratrModulationAt::exact) and the timeline at its
+ * checkpoints must match within rounding (SEEKCHECK_EXACT). Approximated
+ * predictions of the timeline (FM and PM routed to osc1 or osc2) must stay
+ * within SEEKCHECK_TIMELINE. The error of approximated predictions without
+ * a timeline is only reported.
+ *
+ * Usage: BVibratrSeekCheck [-v]
+ *   -v         Report the max. errors of each case
+ *
+ * Exit code: 0 if all predictions are within the limits, 1 otherwise.
+ *
+ * Needs to be compiled with BVIBRATR_CHECKPOINTS.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include "../src/BVibratrTimeline.hpp"
+
+#ifndef BVIBRATR_CHECKPOINTS
+#error "BVibratrSeekCheck needs BVIBRATR_CHECKPOINTS"
+#endif
+
+#define SEEKCHECK_RATE 48000.0
+#define SEEKCHECK_INTERVAL 64		// Frames between two timeline checkpoints
+#define SEEKCHECK_STEP 997			// Frames between two compared positions
+#define SEEKCHECK_EXACT 1.0e-9		// Max. error of exact predictions
+#define SEEKCHECK_TIMELINE 1.0e-4	// Max. phase error of approximated timeline predictions
+
+struct Errors
+{
+	double exact = 0.0;				// Exact predictions and timeline checkpoints
+	double approximated = 0.0;		// Approximated predictions (only reported)
+	double timeline = 0.0;			// Approximated timeline predictions
+	bool mismatch = false;			// Different ADSR phase or oscillator mode
+};
+
+static double phase_error (const double a, const double b)
+{
+	const double d = a - b;
+	return std::fabs (d - std::floor (d + 0.5));
+}
+
+/**
+Compares a predicted with the actual modulation state.
+@param predicted	Predicted state.
+@param actual		State of the stepped engine.
+@param mismatch		Set to true if the ADSR phase or an oscillator mode differ.
+@return				Max. absolute error of the envelope and the phases.
+*/
+static double compare (const BVibratrModulationAt& predicted, const BVibratrModulationAt& actual, bool& mismatch)
+{
+	if (predicted.adsr_phase_nr != actual.adsr_phase_nr) mismatch = true;
+	double error = std::fabs (predicted.envelope - actual.envelope);
+	for (int i = 0; i < 3; ++i)
+	{
+		if (predicted.osc_mode[i] != actual.osc_mode[i]) mismatch = true;
+		error = std::max (error, phase_error (predicted.osc_phase[i], actual.osc_phase[i]));
+	}
+	return error;
+}
+
+/**
+Checks one segment from the current state of an engine: Steps the engine
+frame by frame and compares each SEEKCHECK_STEP frames and at the timeline
+checkpoints in between with the predictions from the start of the segment.
+@param engine	Engine.
+@param frames	Length of the segment.
+@param errors	Errors to update.
+*/
+static void check_segment (BVibratrEngine& engine, const uint64_t frames, Errors& errors)
+{
+	std::unique_ptr<BVibratrCheckpoint> start (engine.save_checkpoint ());
+	const BVibratrTimeline timeline (engine, frames, SEEKCHECK_INTERVAL);
+
+	uint64_t position = 0;
+	for (uint64_t t = 0; t <= frames; t += SEEKCHECK_STEP)
+	{
+		// Also a checkpoint in between
+		const uint64_t checkpoint = (t / SEEKCHECK_INTERVAL) * SEEKCHECK_INTERVAL;
+		for (const uint64_t s : {checkpoint, t})
+		{
+			if (s < position) continue;
+			engine.advance (s - position);
+			position = s;
+			const BVibratrModulationAt actual = engine.get_modulation_at (0);
+
+			const BVibratrModulationAt predicted = engine.get_modulation_at (*start, s);
+			const double e = compare (predicted, actual, errors.mismatch);
+			if (predicted.exact) errors.exact = std::max (errors.exact, e);
+			else errors.approximated = std::max (errors.approximated, e);
+
+			const double et = compare (timeline.get (s), actual, errors.mismatch);
+			if (predicted.exact || (s % SEEKCHECK_INTERVAL == 0)) errors.exact = std::max (errors.exact, et);
+			else errors.timeline = std::max (errors.timeline, et);
+		}
+	}
+
+	engine.advance (frames - position);
+}
+
+int main (int argc, char** argv)
+{
+	bool verbose = false;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (!strcmp (argv[i], "-v")) verbose = true;
+		else
+		{
+			fprintf (stderr, "Usage: %s [-v]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	const char* waveforms[] = {"sine", "triangle", "square"};
+	const uint8_t note_on[3] = {0x90, 60, 100};
+	const uint8_t note_off[3] = {0x80, 60, 0};
+	Arena memory (BVibratrEngine::arena_size (SEEKCHECK_RATE));
+	std::unique_ptr<BVibratrEngine> engine (new BVibratrEngine (SEEKCHECK_RATE, memory));
+
+	size_t cases = 0;
+	size_t failed = 0;
+	Errors max;
+	for (int osc1 : {BVIBRATR_OSC_MODE_LFO, BVIBRATR_OSC_MODE_USER})
+	{
+		for (int osc2 = BVIBRATR_OSC_MODE_PASS; osc2 <= BVIBRATR_OSC_MODE_AM1; ++osc2)
+		{
+			for (int osc3 = BVIBRATR_OSC_MODE_PASS; osc3 <= BVIBRATR_OSC_MODE_AM2; ++osc3)
+			{
+				for (int w = LFO<double>::SINE; w <= LFO<double>::SQUARE; ++w)
+				{
+					BVibratrParameters parameters;
+					parameters.depth_attack = 0.3f;
+					parameters.depth_decay = 0.3f;
+					parameters.depth_sustain = 0.5f;
+					parameters.depth_release = 0.3f;
+					parameters.osc1_mode = osc1;
+					parameters.osc1_waveform = static_cast<LFO<double>::Waveform>(w);
+					parameters.osc2_mode = osc2;
+					parameters.osc2_waveform = static_cast<LFO<double>::Waveform>(w);
+					parameters.osc3_mode = osc3;
+					parameters.osc3_waveform = static_cast<LFO<double>::Waveform>(w);
+					engine->reset ();
+					engine->set_parameters (parameters);
+
+					// Attack, decay and sustain, then release and idle
+					Errors errors;
+					engine->on_midi (note_on);
+					check_segment (*engine, static_cast<uint64_t>(0.9 * SEEKCHECK_RATE), errors);
+					engine->on_midi (note_off);
+					check_segment (*engine, static_cast<uint64_t>(0.5 * SEEKCHECK_RATE), errors);
+
+					const bool ok = !errors.mismatch && (errors.exact <= SEEKCHECK_EXACT) && (errors.timeline <= SEEKCHECK_TIMELINE);
+					if (verbose || !ok)
+					{
+						printf	("%s osc1 %d osc2 %d osc3 %d %-8s exact %.3g approximated %.3g timeline %.3g%s\n",
+								 (ok ? "  " : "!!"), osc1, osc2, osc3, waveforms[w - 1],
+								 errors.exact, errors.approximated, errors.timeline, (errors.mismatch ? " (phase or mode mismatch)" : ""));
+					}
+
+					++cases;
+					if (!ok) ++failed;
+					max.exact = std::max (max.exact, errors.exact);
+					max.approximated = std::max (max.approximated, errors.approximated);
+					max.timeline = std::max (max.timeline, errors.timeline);
+				}
+			}
+		}
+	}
+
+	printf	("%zu cases, %zu failed. Max. error exact %.3g (limit %.3g), approximated %.3g, timeline %.3g (limit %.3g)\n",
+			 cases, failed, max.exact, SEEKCHECK_EXACT, max.approximated, max.timeline, SEEKCHECK_TIMELINE);
+	return (failed ? 1 : 0);
+}
@@ -0,0 +1,351 @@
+#ifndef HOST_HPP_
+#define HOST_HPP_
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <dlfcn.h>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <lv2/core/lv2.h>
+#include <lv2/atom/atom.h>
+#include <lv2/midi/midi.h>
+#include <lv2/urid/urid.h>
+#include <lv2/worker/worker.h>
+#include "../src/Ports.hpp"
+
+// Default controller values as declared in the .ttl file
+constexpr std::array<float, BVIBRATR_NR_CONTROLLERS> controller_defaults =
+{{
+    0.0f, 1.0f, 1.0f, 60.0f, 128.0f, 20.0f, 1.0f, 1.0f, 0.8f, 2.0f,
+    6.0f, 1.0f, 1.0f, 0.5f, 1.8f, 1.0f, 1.0f, 0.2f, 1.0f, 1.0f, 1.0f,
+    0.0f
+}};
+
+// Controller symbols as declared in the .ttl file
+static const char* const controller_symbols[BVIBRATR_NR_CONTROLLERS] =
+{
+    "bypass", "dry_wet", "trigger_channels", "trigger_note", "depth_is_cc", "depth", "depth_attack", "depth_decay",
+    "depth_sustain", "depth_release", "osc1_frequency", "osc1_mode", "osc1_waveform", "osc2_amp", "osc2_frequency",
+    "osc2_mode", "osc2_waveform", "osc3_amp", "osc3_frequency", "osc3_mode", "osc3_waveform", "tremolo"
+};
+
+/**
+Loads the plugin from a shared object (e.g., BVibratr.lv2/BVibratr.so). The
+shared object stays loaded until the program ends.
+@param path Path to the shared object.
+@return     Pointer to the plugin descriptor or nullptr on failure.
+*/
+inline const LV2_Descriptor* load_plugin (const std::string& path)
+{
+    void* lib = dlopen (path.c_str (), RTLD_NOW | RTLD_LOCAL);
+    if (!lib) return nullptr;
+    typedef const LV2_Descriptor* (*DescriptorFunction) (uint32_t index);
+    DescriptorFunction func = reinterpret_cast<DescriptorFunction> (dlsym (lib, "lv2_descriptor"));
+    return (func ? func (0) : nullptr);
+}
+
+/**
+Minimal LV2 host for the tools. Runs a single BVibratr instance (either
+linked into the tool or loaded by load_plugin()) and provides the urid:map
+feature and optionally the work:schedule feature. All ports are connected by
+the host, the audio ports for each run.
+*/
+class Host
+{
+public:
+    /**
+    Instantiates and activates a plugin instance.
+    @param descriptor   Plugin descriptor (e.g., lv2_descriptor (0)).
+    @param samplerate   Sample rate.
+    @param max_events   Max. number of MIDI events per run.
+    @param worker       Provides the work:schedule feature (see work()).
+    @throws std::runtime_error if the plugin can't be instantiated.
+    */
+    Host (const LV2_Descriptor* descriptor, const double samplerate, const size_t max_events = 1024, const bool worker = false);
+
+    Host (const Host& that) = delete;
+    ~Host ();
+
+    Host& operator= (const Host& that) = delete;
+
+    void set_controller (const int nr, const float value);
+    float get_controller (const int nr) const;
+    float get_latency () const;
+    double get_samplerate () const;
+    LV2_Handle get_handle () const;
+
+    /**
+    Connects an optional port (e.g., BVIBRATR_NOTIFY) not handled by Host.
+    @param port Port index.
+    @param data Port buffer.
+    */
+    void connect_port (const uint32_t port, void* data);
+    void activate ();
+
+    /**
+    Gets extension data from the plugin.
+    @param uri  Extension URI.
+    @return     Pointer to the extension data or nullptr if not supported.
+    */
+    const void* get_extension_data (const char* uri) const;
+
+    /**
+    Schedules a MIDI message for the next run.
+    @param frame    Frame within the next run.
+    @param status   MIDI status byte.
+    @param data1    First MIDI data byte.
+    @param data2    Second MIDI data byte.
+    @return         True on success, false if the event buffer is full.
+    */
+    bool add_midi (const uint32_t frame, const uint8_t status, const uint8_t data1, const uint8_t data2);
+
+    /**
+    Schedules a MIDI message of any size for the next run.
+    @param frame    Frame within the next run.
+    @param data     MIDI message.
+    @param size     Size of the MIDI message.
+    @return         True on success, false if the event buffer is full.
+    */
+    bool add_midi (const uint32_t frame, const uint8_t* data, const uint32_t size);
+
+    /**
+    Runs the plugin for n frames with the scheduled MIDI messages. The MIDI
+    messages are removed afterwards. In and out buffers may be shared.
+    @param in_1     Audio input channel 1.
+    @param in_2     Audio input channel 2.
+    @param out_1    Audio output channel 1.
+    @param out_2    Audio output channel 2.
+    @param n        Number of frames.
+    */
+    void run (const float* in_1, const float* in_2, float* out_1, float* out_2, const uint32_t n);
+
+    /**
+    Calls a run()-like function of the plugin (e.g., from extension data)
+    with the scheduled MIDI messages instead of run(). The MIDI messages are
+    removed afterwards.
+    @param func Function.
+    @param n    Number of frames.
+    */
+    void run_with (void (*func) (LV2_Handle instance, uint32_t n_samples), const uint32_t n);
+
+    /**
+    Does the work scheduled by the plugin like a worker thread between two
+    runs. The responses are delivered at the end of the next run (in the
+    audio thread). Does nothing without the worker feature.
+    */
+    void work ();
+
+protected:
+    double samplerate_;
+    const LV2_Descriptor* descriptor_;
+    LV2_Handle handle_;
+    std::map<std::string, LV2_URID> urids_;
+    LV2_URID_Map map_;
+    LV2_Feature map_feature_;
+    std::array<float, BVIBRATR_NR_CONTROLLERS> controllers_;
+    float latency_;
+    std::vector<uint64_t> midi_;    // LV2_Atom_Sequence, 64 bit aligned
+    LV2_URID sequence_urid_;
+    LV2_URID midi_event_urid_;
+    LV2_Worker_Schedule schedule_;
+    LV2_Feature schedule_feature_;
+    const LV2_Worker_Interface* worker_;
+    std::vector<uint8_t> requests_;     // Scheduled work, size (uint32_t) and data each, preallocated
+    std::vector<uint8_t> responses_;    // Responses of the worker, same format
+
+    static LV2_URID map_uri_ (LV2_URID_Map_Handle handle, const char* uri);
+    static LV2_Worker_Status schedule_work_ (LV2_Worker_Schedule_Handle handle, uint32_t size, const void* data);
+    static LV2_Worker_Status respond_ (LV2_Worker_Respond_Handle handle, uint32_t size, const void* data);
+    static LV2_Worker_Status push_ (std::vector<uint8_t>& queue, const uint32_t size, const void* data);
+    LV2_Atom_Sequence* sequence_ ();
+    void clear_midi_ ();
+    void deliver_responses_ ();
+};
+
+inline Host::Host (const LV2_Descriptor* descriptor, const double samplerate, const size_t max_events, const bool worker) :
+    samplerate_ (samplerate),
+    descriptor_ (descriptor),
+    handle_ (nullptr),
+    urids_ (),
+    map_ {this, &map_uri_},
+    map_feature_ {LV2_URID__map, &map_},
+    controllers_ (controller_defaults),
+    latency_ (0.0f),
+    midi_ ((sizeof (LV2_Atom_Sequence) + max_events * (sizeof (LV2_Atom_Event) + 8)) / sizeof (uint64_t) + 1, 0),
+    sequence_urid_ (map_uri_ (this, LV2_ATOM__Sequence)),
+    midi_event_urid_ (map_uri_ (this, LV2_MIDI__MidiEvent)),
+    schedule_ {this, &schedule_work_},
+    schedule_feature_ {LV2_WORKER__schedule, &schedule_},
+    worker_ (nullptr),
+    requests_ (),
+    responses_ ()
+{
+    const LV2_Feature* features[] = {&map_feature_, (worker ? &schedule_feature_ : nullptr), nullptr};
+    if (descriptor_) handle_ = descriptor_->instantiate (descriptor_, samplerate, "", features);
+    if (!handle_) throw std::runtime_error ("Can't instantiate the plugin.");
+
+    // Queues don't allocate in run()
+    if (worker)
+    {
+        worker_ = static_cast<const LV2_Worker_Interface*> (get_extension_data (LV2_WORKER__interface));
+        requests_.reserve (65536);
+        responses_.reserve (65536);
+    }
+
+    for (int i = 0; i < BVIBRATR_NR_CONTROLLERS; ++i) descriptor_->connect_port (handle_, BVIBRATR_NR_PORTS + i, &controllers_[i]);
+    descriptor_->connect_port (handle_, BVIBRATR_NR_PORTS + BVIBRATR_LATENCY, &latency_);
+    descriptor_->connect_port (handle_, BVIBRATR_MIDI_IN, sequence_ ());
+    clear_midi_ ();
+    descriptor_->activate (handle_);
+}
+
+inline Host::~Host ()
+{
+    descriptor_->deactivate (handle_);
+    descriptor_->cleanup (handle_);
+}
+
+inline void Host::set_controller (const int nr, const float value) {controllers_.at (nr) = value;}
+
+inline float Host::get_controller (const int nr) const {return controllers_.at (nr);}
+
+inline float Host::get_latency () const {return latency_;}
+
+inline double Host::get_samplerate () const {return samplerate_;}
+
+inline LV2_Handle Host::get_handle () const {return handle_;}
+
+inline void Host::connect_port (const uint32_t port, void* data) {descriptor_->connect_port (handle_, port, data);}
+
+inline const void* Host::get_extension_data (const char* uri) const
+{
+    return (descriptor_->extension_data ? descriptor_->extension_data (uri) : nullptr);
+}
+
+inline void Host::activate ()
+{
+    descriptor_->deactivate (handle_);
+    descriptor_->activate (handle_);
+}
+
+inline bool Host::add_midi (const uint32_t frame, const uint8_t status, const uint8_t data1, const uint8_t data2)
+{
+    const uint8_t msg[3] = {status, data1, data2};
+    return add_midi (frame, msg, 3);
+}
+
+inline bool Host::add_midi (const uint32_t frame, const uint8_t* data, const uint32_t size)
+{
+    LV2_Atom_Sequence* seq = sequence_ ();
+    const size_t capacity = midi_.size () * sizeof (uint64_t) - sizeof (LV2_Atom);
+    const size_t event_size = sizeof (LV2_Atom_Event) + ((size + 7) & ~uint32_t (7));    // Padded to 64 bit
+    if (seq->atom.size + event_size > capacity) return false;
+
+    uint8_t* ptr = reinterpret_cast<uint8_t*> (midi_.data ()) + sizeof (LV2_Atom) + seq->atom.size;
+    LV2_Atom_Event* ev = reinterpret_cast<LV2_Atom_Event*> (ptr);
+    ev->time.frames = frame;
+    ev->body.size = size;
+    ev->body.type = midi_event_urid_;
+    memcpy (ev + 1, data, size);
+    seq->atom.size += event_size;
+    return true;
+}
+
+inline void Host::run (const float* in_1, const float* in_2, float* out_1, float* out_2, const uint32_t n)
+{
+    descriptor_->connect_port (handle_, BVIBRATR_AUDIO_IN_1, const_cast<float*> (in_1));
+    descriptor_->connect_port (handle_, BVIBRATR_AUDIO_IN_2, const_cast<float*> (in_2));
+    descriptor_->connect_port (handle_, BVIBRATR_AUDIO_OUT_1, out_1);
+    descriptor_->connect_port (handle_, BVIBRATR_AUDIO_OUT_2, out_2);
+    descriptor_->run (handle_, n);
+    deliver_responses_ ();
+    clear_midi_ ();
+}
+
+inline void Host::run_with (void (*func) (LV2_Handle instance, uint32_t n_samples), const uint32_t n)
+{
+    func (handle_, n);
+    deliver_responses_ ();
+    clear_midi_ ();
+}
+
+inline void Host::work ()
+{
+    if (!worker_)
+    {
+        requests_.clear ();
+        return;
+    }
+
+    for (size_t i = 0; i < requests_.size (); )
+    {
+        uint32_t size;
+        memcpy (&size, requests_.data () + i, sizeof (size));
+        worker_->work (handle_, &respond_, this, size, requests_.data () + i + sizeof (size));
+        i += sizeof (size) + size;
+    }
+    requests_.clear ();
+}
+
+inline LV2_URID Host::map_uri_ (LV2_URID_Map_Handle handle, const char* uri)
+{
+    Host* host = static_cast<Host*> (handle);
+    std::map<std::string, LV2_URID>::iterator it = host->urids_.find (uri);
+    if (it != host->urids_.end ()) return it->second;
+    const LV2_URID urid = host->urids_.size () + 1;
+    host->urids_[uri] = urid;
+    return urid;
+}
+
+inline LV2_Worker_Status Host::schedule_work_ (LV2_Worker_Schedule_Handle handle, uint32_t size, const void* data)
+{
+    Host* host = static_cast<Host*> (handle);
+    return push_ (host->requests_, size, data);
+}
+
+inline LV2_Worker_Status Host::respond_ (LV2_Worker_Respond_Handle handle, uint32_t size, const void* data)
+{
+    Host* host = static_cast<Host*> (handle);
+    return push_ (host->responses_, size, data);
+}
+
+inline LV2_Worker_Status Host::push_ (std::vector<uint8_t>& queue, const uint32_t size, const void* data)
+{
+    if (queue.size () + sizeof (size) + size > queue.capacity ()) return LV2_WORKER_ERR_NO_SPACE;
+    const uint8_t* size_ptr = reinterpret_cast<const uint8_t*> (&size);
+    const uint8_t* data_ptr = static_cast<const uint8_t*> (data);
+    queue.insert (queue.end (), size_ptr, size_ptr + sizeof (size));
+    queue.insert (queue.end (), data_ptr, data_ptr + size);
+    return LV2_WORKER_SUCCESS;
+}
+
+inline void Host::deliver_responses_ ()
+{
+    if (!worker_) return;
+
+    for (size_t i = 0; i < responses_.size (); )
+    {
+        uint32_t size;
+        memcpy (&size, responses_.data () + i, sizeof (size));
+        worker_->work_response (handle_, size, responses_.data () + i + sizeof (size));
+        i += sizeof (size) + size;
+    }
+    responses_.clear ();
+    if (worker_->end_run) worker_->end_run (handle_);
+}
+
+inline LV2_Atom_Sequence* Host::sequence_ () {return reinterpret_cast<LV2_Atom_Sequence*> (midi_.data ());}
+
+inline void Host::clear_midi_ ()
+{
+    LV2_Atom_Sequence* seq = sequence_ ();
+    seq->atom.type = sequence_urid_;
+    seq->atom.size = sizeof (LV2_Atom_Sequence_Body);
+    seq->body.unit = 0;
+    seq->body.pad = 0;
+}
+
+#endif /* HOST_HPP_ */
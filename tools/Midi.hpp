@@ -0,0 +1,191 @@
+#ifndef MIDI_HPP_
+#define MIDI_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+/**
+Timed MIDI channel message.
+*/
+struct MidiEvent
+{
+    double time;        // Seconds
+    uint8_t size;
+    uint8_t data[3];
+};
+
+/**
+Sorts MIDI events by time. Keeps the order of simultaneous events.
+@param events   MIDI events.
+*/
+inline void sort_midi (std::vector<MidiEvent>& events)
+{
+    std::stable_sort
+    (
+        events.begin (), events.end (),
+        [] (const MidiEvent& a, const MidiEvent& b) {return a.time < b.time;}
+    );
+}
+
+/**
+Reads the channel messages of a Standard MIDI File (format 0 or 1). The
+tracks are merged and the times are calculated from the tempo map. Note on
+messages with velocity 0 are converted to note off messages. Meta events
+(except tempo) and system exclusive messages are skipped.
+@param path     Path to the MIDI file.
+@param events   Target, sorted by time.
+@return         Empty string on success, otherwise an error message.
+*/
+inline std::string read_smf (const std::string& path, std::vector<MidiEvent>& events)
+{
+    FILE* file = fopen (path.c_str (), "rb");
+    if (!file) return "Can't open " + path;
+    std::vector<uint8_t> data;
+    uint8_t buffer[65536];
+    size_t n;
+    while ((n = fread (buffer, 1, sizeof (buffer), file)) > 0) data.insert (data.end (), buffer, buffer + n);
+    fclose (file);
+
+    auto u16 = [&data] (const size_t p) {return uint32_t (data[p] << 8) | data[p + 1];};
+    auto u32 = [&data] (const size_t p) {return (uint32_t (data[p]) << 24) | (uint32_t (data[p + 1]) << 16) | (uint32_t (data[p + 2]) << 8) | data[p + 3];};
+
+    if ((data.size () < 14) || (std::string (data.begin (), data.begin () + 4) != "MThd")) return path + " is not a MIDI file";
+    const uint32_t format = u16 (8);
+    const uint32_t division = u16 (12);
+    if (format > 1) return path + ": Unsupported MIDI file format " + std::to_string (format);
+
+    // Ticks of all tracks and tempo changes
+    struct TickEvent
+    {
+        uint64_t tick;
+        uint32_t tempo;     // Microseconds per quarter note or 0 for channel messages
+        MidiEvent event;
+    };
+    std::vector<TickEvent> tick_events;
+
+    size_t pos = 8 + u32 (4);
+    while (pos + 8 <= data.size ())
+    {
+        const size_t size = u32 (pos + 4);
+        const size_t end = std::min (data.size (), pos + 8 + size);
+        const bool track = (std::string (data.begin () + pos, data.begin () + pos + 4) == "MTrk");
+        size_t p = pos + 8;
+        pos = end;
+        if (!track) continue;
+
+        uint64_t tick = 0;
+        uint8_t status = 0;
+        while (p < end)
+        {
+            // Delta time (variable length)
+            uint32_t delta = 0;
+            do {delta = (delta << 7) | (data[p] & 0x7F);} while ((data[p++] & 0x80) && (p < end));
+            tick += delta;
+            if (p >= end) break;
+
+            if ((data[p] == 0xFF) && (p + 2 < end))
+            {
+                // Meta event
+                const uint8_t type = data[p + 1];
+                p += 2;
+                uint32_t length = 0;
+                do {length = (length << 7) | (data[p] & 0x7F);} while ((data[p++] & 0x80) && (p < end));
+                if ((type == 0x51) && (length == 3) && (p + 3 <= end))
+                {
+                    tick_events.push_back ({tick, (uint32_t (data[p]) << 16) | (uint32_t (data[p + 1]) << 8) | data[p + 2], {}});
+                }
+                if (type == 0x2F) break;    // End of track
+                p += length;
+            }
+
+            else if ((data[p] == 0xF0) || (data[p] == 0xF7))
+            {
+                // System exclusive
+                ++p;
+                uint32_t length = 0;
+                do {length = (length << 7) | (data[p] & 0x7F);} while ((data[p++] & 0x80) && (p < end));
+                p += length;
+            }
+
+            else
+            {
+                // Channel message, running status
+                if (data[p] & 0x80) status = data[p++];
+                if (!status) return path + ": Invalid MIDI data";
+                const uint8_t type = status & 0xF0;
+                const uint8_t size = ((type == 0xC0) || (type == 0xD0) ? 2 : 3);
+                if (p + size - 1 > end) break;
+                MidiEvent ev = {0.0, size, {status, data[p], (size == 3 ? data[p + 1] : uint8_t (0))}};
+                if ((type == 0x90) && (ev.data[2] == 0)) ev.data[0] = 0x80 | (status & 0x0F);
+                tick_events.push_back ({tick, 0, ev});
+                p += size - 1;
+            }
+        }
+    }
+
+    // Merge tracks (tempo changes first) and convert ticks to seconds
+    std::stable_sort
+    (
+        tick_events.begin (), tick_events.end (),
+        [] (const TickEvent& a, const TickEvent& b) {return (a.tick < b.tick) || ((a.tick == b.tick) && (a.tempo > b.tempo));}
+    );
+
+    events.clear ();
+    double seconds_per_tick;
+    if (division & 0x8000)
+    {
+        // SMPTE: frames per second and ticks per frame
+        const int fps = -static_cast<int8_t> (division >> 8);
+        seconds_per_tick = 1.0 / ((fps == 29 ? 29.97 : fps) * (division & 0xFF));
+    }
+    else seconds_per_tick = 0.5 / std::max<uint32_t> (division, 1);    // 120 bpm
+
+    double time = 0.0;
+    uint64_t last_tick = 0;
+    for (const TickEvent& te : tick_events)
+    {
+        time += (te.tick - last_tick) * seconds_per_tick;
+        last_tick = te.tick;
+        if (te.tempo)
+        {
+            if (!(division & 0x8000)) seconds_per_tick = te.tempo * 1e-6 / std::max<uint32_t> (division, 1);
+        }
+        else
+        {
+            events.push_back (te.event);
+            events.back ().time = time;
+        }
+    }
+
+    return "";
+}
+
+/**
+Parses a note (NOTE:START:END[:VELOCITY[:CHANNEL]]) from the command line
+and adds the note on and note off messages. START and END are in seconds,
+CHANNEL is 1 to 16.
+@param spec     Note specification.
+@param events   Target.
+@return         True on success, otherwise false.
+*/
+inline bool parse_note (const std::string& spec, std::vector<MidiEvent>& events)
+{
+    int note = 0;
+    double start = 0.0;
+    double end = 0.0;
+    int velocity = 100;
+    int channel = 1;
+    const int n = sscanf (spec.c_str (), "%i:%lf:%lf:%i:%i", &note, &start, &end, &velocity, &channel);
+    if ((n < 3) || (note < 0) || (note > 127) || (start < 0.0) || (end < start) ||
+        (velocity < 1) || (velocity > 127) || (channel < 1) || (channel > 16)) return false;
+
+    events.push_back ({start, 3, {uint8_t (0x90 | (channel - 1)), uint8_t (note), uint8_t (velocity)}});
+    events.push_back ({end, 3, {uint8_t (0x80 | (channel - 1)), uint8_t (note), 0}});
+    return true;
+}
+
+#endif /* MIDI_HPP_ */
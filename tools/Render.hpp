@@ -0,0 +1,453 @@
+#ifndef RENDER_HPP_
+#define RENDER_HPP_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Host.hpp"
+#include "Midi.hpp"
+#include "Wav.hpp"
+#include "WorkPool.hpp"
+#include "../src/BVibratr.hpp"
+
+#ifndef BVIBRATR_CHECKPOINTS
+#error "The renderer requires the plugin DSP built with BVIBRATR_CHECKPOINTS (see makefile)."
+#endif
+
+#define RENDER_RELEASE_BYTES 0x4000000      // Release the read input every 64 MB
+#define RENDER_READAHEAD_BYTES 0x1000000    // Read-ahead 16 MB
+#define RENDER_MIN_CHUNK_WARMUPS 16         // Min. chunk size for render_parallel() in warm-up lengths
+
+/**
+Offline render job: Input and output file and the settings.
+*/
+struct RenderJob
+{
+    std::string input;
+    std::string output;
+    std::vector<MidiEvent> events;          // Sorted by time
+    std::array<float, BVIBRATR_NR_CONTROLLERS> controllers;
+    uint32_t block;
+    WavFormat format;
+    double tail;                            // Seconds rendered after the end of the input
+    bool compensate;                        // Compensate the latency
+
+    RenderJob () :
+        input (), output (), events (), controllers (controller_defaults), block (4096),
+        format (WAV_FLOAT_32), tail (0.0), compensate (true)
+    {}
+};
+
+/**
+Parses render options and sets a job. Supported options:
+-m FILE, -n NOTE:START:END[:VELOCITY[:CHANNEL]], -s SYMBOL=VALUE,
+-B FRAMES, -b BITS, -t SECONDS and -L. The first and second non-option
+argument set the input and the output. Settings of the job which are not
+given are kept and MIDI messages are added.
+@param args Arguments.
+@param job  Job.
+@return     Empty string on success, otherwise an error message.
+*/
+inline std::string parse_render_args (const std::vector<std::string>& args, RenderJob& job)
+{
+    bool input = false;
+    bool output = false;
+    for (size_t i = 0; i < args.size (); ++i)
+    {
+        const std::string& arg = args[i];
+        const bool has_value = (i + 1 < args.size ());
+        bool ok = true;
+        if ((arg == "-m") && has_value)
+        {
+            std::vector<MidiEvent> smf;
+            const std::string error = read_smf (args[++i], smf);
+            if (!error.empty ()) return error;
+            job.events.insert (job.events.end (), smf.begin (), smf.end ());
+        }
+
+        else if ((arg == "-n") && has_value) ok = parse_note (args[++i], job.events);
+
+        else if ((arg == "-s") && has_value)
+        {
+            const std::string& spec = args[++i];
+            const size_t eq = spec.find ('=');
+            const int nr = std::find (controller_symbols, controller_symbols + BVIBRATR_NR_CONTROLLERS, spec.substr (0, eq)) - controller_symbols;
+            char* end = nullptr;
+            if ((eq != std::string::npos) && (nr < BVIBRATR_NR_CONTROLLERS)) job.controllers[nr] = strtof (spec.c_str () + eq + 1, &end);
+            ok = end && (end != spec.c_str () + eq + 1) && (*end == '\0');
+        }
+
+        else if ((arg == "-B") && has_value) ok = ((job.block = atoi (args[++i].c_str ())) > 0);
+
+        else if ((arg == "-b") && has_value)
+        {
+            const int bits = atoi (args[++i].c_str ());
+            if (bits == 16) job.format = WAV_PCM_16;
+            else if (bits == 24) job.format = WAV_PCM_24;
+            else if (bits == 32) job.format = WAV_FLOAT_32;
+            else if (bits == 64) job.format = WAV_FLOAT_64;
+            else ok = false;
+        }
+
+        else if ((arg == "-t") && has_value) ok = ((job.tail = atof (args[++i].c_str ())) >= 0.0);
+        else if (arg == "-L") job.compensate = false;
+        else if ((!arg.empty ()) && (arg[0] != '-') && (!input)) {job.input = arg; input = true;}
+        else if ((!arg.empty ()) && (arg[0] != '-') && (!output)) {job.output = arg; output = true;}
+        else ok = false;
+
+        if (!ok) return "Invalid argument: " + args[i];
+    }
+
+    sort_midi (job.events);
+    return "";
+}
+
+/**
+Result of a render job.
+*/
+struct RenderResult
+{
+    uint64_t frames;
+    uint32_t channels;
+    double samplerate;
+};
+
+/**
+Plugin instances for all channels of a file. Each pair of channels is
+processed by its own plugin instance, an odd last channel by an instance
+with both inputs connected to this channel. All instances get the same MIDI
+messages and controller values.
+*/
+class RenderInstances
+{
+public:
+    /**
+    @param descriptor   Plugin descriptor.
+    @param job          Render job (controllers, max. block size).
+    @param channels     Number of channels.
+    @param samplerate   Sample rate.
+    @throws std::runtime_error if the plugin can't be instantiated.
+    */
+    RenderInstances (const LV2_Descriptor* descriptor, const RenderJob& job, const uint32_t channels, const double samplerate);
+
+    Host& operator[] (const size_t nr);
+    size_t size () const;
+
+    /**
+    Schedules the MIDI messages due within the next n frames for all
+    instances. Late messages are scheduled at the start.
+    @param events   MIDI messages (sorted).
+    @param next     Index of the next message.
+    @param position Frame position.
+    @param n        Number of frames.
+    @return         Index of the next message after this block.
+    */
+    size_t schedule (const std::vector<MidiEvent>& events, size_t next, const uint64_t position, const uint32_t n);
+
+    /**
+    Runs all instances.
+    @param in   Input buffers, one for each channel.
+    @param out  Output buffers, one for each channel.
+    @param n    Number of frames.
+    */
+    void run (float* const* in, float* const* out, const uint32_t n);
+
+protected:
+    std::vector<std::unique_ptr<Host>> hosts_;
+    uint32_t channels_;
+    double samplerate_;
+    std::vector<float> scratch_;
+};
+
+inline RenderInstances::RenderInstances (const LV2_Descriptor* descriptor, const RenderJob& job, const uint32_t channels, const double samplerate) :
+    hosts_ (), channels_ (channels), samplerate_ (samplerate), scratch_ (job.block, 0.0f)
+{
+    for (uint32_t c = 0; c < channels; c += 2)
+    {
+        hosts_.emplace_back (new Host (descriptor, samplerate, std::max<size_t> (job.events.size (), 1024)));
+        for (int i = 0; i < BVIBRATR_NR_CONTROLLERS; ++i) hosts_.back ()->set_controller (i, job.controllers[i]);
+    }
+}
+
+inline Host& RenderInstances::operator[] (const size_t nr) {return *hosts_[nr];}
+
+inline size_t RenderInstances::size () const {return hosts_.size ();}
+
+inline size_t RenderInstances::schedule (const std::vector<MidiEvent>& events, size_t next, const uint64_t position, const uint32_t n)
+{
+    while ((next < events.size ()) && (uint64_t (std::llround (events[next].time * samplerate_)) < position + n))
+    {
+        const MidiEvent& ev = events[next];
+        const uint64_t frame = std::max<uint64_t> (std::llround (ev.time * samplerate_), position);
+        for (std::unique_ptr<Host>& h : hosts_) h->add_midi (frame - position, ev.data, ev.size);
+        ++next;
+    }
+    return next;
+}
+
+inline void RenderInstances::run (float* const* in, float* const* out, const uint32_t n)
+{
+    for (uint32_t c = 0; c < channels_; c += 2)
+    {
+        Host& h = *hosts_[c / 2];
+        if (c + 1 < channels_) h.run (in[c], in[c + 1], out[c], out[c + 1], n);
+        else h.run (in[c], in[c], out[c], scratch_.data (), n);
+    }
+}
+
+/**
+Renders a job. See RenderInstances. The input is memory mapped with
+read-ahead, and the read parts are released. The output is streamed. Thus
+the memory use doesn't depend on the file size.
+@param descriptor   Plugin descriptor.
+@param job          Render job.
+@param result       Result.
+@param progress     Optional counter, increased by the number of rendered
+                    frames after each block.
+@return             Empty string on success, otherwise an error message.
+*/
+inline std::string render (const LV2_Descriptor* descriptor, const RenderJob& job, RenderResult& result, std::atomic<uint64_t>* progress = nullptr)
+{
+    WavReader reader;
+    const std::string error = reader.open (job.input);
+    if (!error.empty ()) return error;
+
+    const uint32_t channels = reader.channels ();
+    const double samplerate = reader.samplerate ();
+    const uint32_t block = job.block;
+    const uint64_t frames = reader.frames () + uint64_t (job.tail * samplerate);
+    result = {frames, channels, samplerate};
+
+    std::unique_ptr<RenderInstances> instances;
+    try {instances.reset (new RenderInstances (descriptor, job, channels, samplerate));}
+    catch (const std::exception& e) {return e.what ();}
+
+    WavWriter writer;
+    if (!writer.open (job.output, channels, samplerate, job.format)) return "Can't create " + job.output;
+
+    std::vector<float> in (channels * block, 0.0f);
+    std::vector<float> out (channels * block, 0.0f);
+    std::vector<float*> in_ptrs (channels);
+    std::vector<float*> out_ptrs (channels);
+    for (uint32_t c = 0; c < channels; ++c)
+    {
+        in_ptrs[c] = &in[c * block];
+        out_ptrs[c] = &out[c * block];
+    }
+
+    const size_t frame_size = channels * wav_sample_size (reader.format ());
+    const uint64_t release_frames = std::max<uint64_t> (RENDER_RELEASE_BYTES / frame_size, block);
+    const uint64_t readahead_frames = std::max<uint64_t> (RENDER_READAHEAD_BYTES / frame_size, block);
+    std::vector<const float*> write_ptrs (channels);
+    uint64_t position = 0;      // Input frames
+    uint64_t written = 0;       // Output frames
+    uint64_t released = 0;
+    uint64_t prefetched = 0;
+    uint64_t skip = 0;
+    size_t next_event = 0;
+    bool first = true;
+    while (written < frames)
+    {
+        // Keep the next readahead_frames loading
+        if (position + readahead_frames / 2 >= prefetched)
+        {
+            reader.prefetch (prefetched, position + readahead_frames - prefetched);
+            prefetched = position + readahead_frames;
+        }
+
+        reader.read (position, block, in_ptrs.data ());
+        next_event = instances->schedule (job.events, next_event, position, block);
+        instances->run (in_ptrs.data (), out_ptrs.data (), block);
+
+        if (first)
+        {
+            skip = (job.compensate ? static_cast<uint64_t> ((*instances)[0].get_latency ()) : 0);
+            first = false;
+        }
+
+        const uint32_t offset = std::min<uint64_t> (skip, block);
+        const uint32_t n = std::min<uint64_t> (block - offset, frames - written);
+        skip -= offset;
+        for (uint32_t c = 0; c < channels; ++c) write_ptrs[c] = out_ptrs[c] + offset;
+        if (!writer.write (write_ptrs.data (), n)) return "Can't write " + job.output;
+        written += n;
+        position += block;
+        if (progress) progress->fetch_add (n, std::memory_order_relaxed);
+
+        if (position - released >= release_frames)
+        {
+            reader.release (position);
+            released = position;
+        }
+    }
+
+    if (!writer.close ()) return "Can't write " + job.output;
+    return "";
+}
+
+/**
+Renders a job using multiple threads. The file is split into chunks. A
+serial pass computes the modulation only (BVibratrCheckpointInterface::
+advance) and saves a checkpoint at the start of each chunk minus a warm-up
+of 2 * latency + 1 frames. Then the chunks are rendered in parallel, each
+from its checkpoint on, and the output of the warm-up is discarded. The
+result is identical to render(). Falls back to render() if the plugin
+doesn't provide checkpoints.
+@param descriptor   Plugin descriptor.
+@param job          Render job.
+@param result       Result.
+@param workers      Number of threads, 0 = number of hardware threads.
+@param progress     Optional counter, increased by the number of rendered
+                    frames after each block.
+@return             Empty string on success, otherwise an error message.
+*/
+inline std::string render_parallel (const LV2_Descriptor* descriptor, const RenderJob& job, RenderResult& result, const size_t workers, std::atomic<uint64_t>* progress = nullptr)
+{
+    WavReader reader;
+    const std::string error = reader.open (job.input);
+    if (!error.empty ()) return error;
+
+    const uint32_t channels = reader.channels ();
+    const double samplerate = reader.samplerate ();
+    const uint32_t block = job.block;
+    const uint64_t frames = reader.frames () + uint64_t (job.tail * samplerate);
+    result = {frames, channels, samplerate};
+
+    // Serial pass instance. Also gets the latency.
+    std::unique_ptr<RenderInstances> serial;
+    try {serial.reset (new RenderInstances (descriptor, job, 1, samplerate));}
+    catch (const std::exception& e) {return e.what ();}
+    const BVibratrCheckpointInterface* checkpoints =
+        static_cast<const BVibratrCheckpointInterface*> ((*serial)[0].get_extension_data (BVIBRATR_CHECKPOINT_URI));
+    if (!checkpoints) return render (descriptor, job, result, progress);
+
+    // Latency from a zero length run of another instance
+    uint64_t latency;
+    try
+    {
+        RenderInstances probe (descriptor, job, 1, samplerate);
+        float buffer = 0.0f;
+        float* ptrs[2] = {&buffer, &buffer};
+        probe.run (ptrs, ptrs, 0);
+        latency = probe[0].get_latency ();
+    }
+    catch (const std::exception& e) {return e.what ();}
+
+    // Chunks in plugin frames (output frame + skip)
+    WorkPool pool (workers);
+    const uint64_t skip = (job.compensate ? latency : 0);
+    const uint64_t total = frames + skip;
+    const uint64_t warmup = 2 * latency + 1;
+    const uint64_t chunk = std::max<uint64_t> ({total / (4 * pool.workers ()) + 1, RENDER_MIN_CHUNK_WARMUPS * warmup, block});
+    const size_t nr_chunks = (total + chunk - 1) / chunk;
+
+    // Serial pass: Checkpoints at chunk start - warmup
+    std::vector<BVibratrCheckpoint*> saved (nr_chunks, nullptr);
+    uint64_t position = 0;
+    size_t next_event = 0;
+    for (size_t k = 1; k < nr_chunks; ++k)
+    {
+        const uint64_t target = k * chunk - warmup;
+        while (position < target)
+        {
+            const uint32_t n = std::min<uint64_t> (block, target - position);
+            next_event = serial->schedule (job.events, next_event, position, n);
+            (*serial)[0].run_with (checkpoints->advance, n);
+            position += n;
+        }
+        saved[k] = checkpoints->save ((*serial)[0].get_handle ());
+    }
+    serial.reset ();
+
+    WavWriter writer;
+    if (!writer.open (job.output, channels, samplerate, job.format)) return "Can't create " + job.output;
+    if (!writer.reserve (frames)) return "Can't write " + job.output;
+
+    // Parallel pass
+    std::atomic<bool> ok (true);
+    std::string chunk_error;
+    std::mutex error_mutex;
+    pool.run
+    (
+        nr_chunks,
+        [&] (size_t k, size_t worker)
+        {
+            if (!ok.load ()) return;
+            const uint64_t start = k * chunk;
+            const uint64_t end = std::min (start + chunk, total);
+            uint64_t pos = (k ? start - warmup : 0);
+
+            std::unique_ptr<RenderInstances> instances;
+            try {instances.reset (new RenderInstances (descriptor, job, channels, samplerate));}
+            catch (const std::exception& e)
+            {
+                std::lock_guard<std::mutex> lock (error_mutex);
+                chunk_error = e.what ();
+                ok.store (false);
+                return;
+            }
+            if (saved[k])
+            {
+                for (size_t i = 0; i < instances->size (); ++i) checkpoints->restore ((*instances)[i].get_handle (), saved[k]);
+            }
+
+            // First message at or after pos
+            size_t next = std::lower_bound
+            (
+                job.events.begin (), job.events.end (), pos,
+                [samplerate] (const MidiEvent& ev, uint64_t frame) {return uint64_t (std::llround (ev.time * samplerate)) < frame;}
+            ) - job.events.begin ();
+
+            std::vector<float> in (channels * block, 0.0f);
+            std::vector<float> out (channels * block, 0.0f);
+            std::vector<float*> in_ptrs (channels);
+            std::vector<float*> out_ptrs (channels);
+            std::vector<const float*> write_ptrs (channels);
+            for (uint32_t c = 0; c < channels; ++c)
+            {
+                in_ptrs[c] = &in[c * block];
+                out_ptrs[c] = &out[c * block];
+            }
+
+            reader.prefetch (pos, end - pos);
+            while (pos < end)
+            {
+                const uint32_t n = std::min<uint64_t> (block, end - pos);
+                reader.read (pos, n, in_ptrs.data ());
+                next = instances->schedule (job.events, next, pos, n);
+                instances->run (in_ptrs.data (), out_ptrs.data (), n);
+
+                // Output frames within this chunk (not warm-up) and after skip
+                const uint64_t from = std::max ({pos, start, skip});
+                if (from < pos + n)
+                {
+                    for (uint32_t c = 0; c < channels; ++c) write_ptrs[c] = out_ptrs[c] + (from - pos);
+                    if (!writer.write_at (from - skip, write_ptrs.data (), pos + n - from))
+                    {
+                        std::lock_guard<std::mutex> lock (error_mutex);
+                        chunk_error = "Can't write " + job.output;
+                        ok.store (false);
+                        return;
+                    }
+                    if (progress) progress->fetch_add (pos + n - from, std::memory_order_relaxed);
+                }
+                pos += n;
+            }
+        }
+    );
+
+    for (BVibratrCheckpoint* c : saved) if (c) checkpoints->free (c);
+    if (!ok.load ()) return chunk_error;
+    if (!writer.close ()) return "Can't write " + job.output;
+    return "";
+}
+
+#endif /* RENDER_HPP_ */
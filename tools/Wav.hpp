@@ -0,0 +1,600 @@
+#ifndef WAV_HPP_
+#define WAV_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+/**
+Audio data with interleaved samples.
+*/
+struct Audio
+{
+    uint32_t channels;
+    double samplerate;
+    std::vector<float> samples;
+
+    size_t frames () const {return (channels ? samples.size () / channels : 0);}
+};
+
+/**
+Writes audio data to a WAV file (32 bit float).
+@param path     Path to the WAV file.
+@param audio    Audio data.
+@return         True on success, otherwise false.
+*/
+inline bool write_wav (const std::string& path, const Audio& audio)
+{
+    FILE* file = fopen (path.c_str (), "wb");
+    if (!file) return false;
+
+    const uint32_t data_size = audio.samples.size () * sizeof (float);
+    const uint32_t riff_size = 4 + (8 + 16) + (8 + data_size);
+    const uint16_t format = 3;  // IEEE float
+    const uint16_t channels = audio.channels;
+    const uint32_t rate = audio.samplerate;
+    const uint32_t byte_rate = rate * channels * sizeof (float);
+    const uint16_t block_align = channels * sizeof (float);
+    const uint16_t bits = 32;
+    const uint32_t fmt_size = 16;
+
+    bool ok = true;
+    ok &= (fwrite ("RIFF", 1, 4, file) == 4);
+    ok &= (fwrite (&riff_size, 4, 1, file) == 1);
+    ok &= (fwrite ("WAVEfmt ", 1, 8, file) == 8);
+    ok &= (fwrite (&fmt_size, 4, 1, file) == 1);
+    ok &= (fwrite (&format, 2, 1, file) == 1);
+    ok &= (fwrite (&channels, 2, 1, file) == 1);
+    ok &= (fwrite (&rate, 4, 1, file) == 1);
+    ok &= (fwrite (&byte_rate, 4, 1, file) == 1);
+    ok &= (fwrite (&block_align, 2, 1, file) == 1);
+    ok &= (fwrite (&bits, 2, 1, file) == 1);
+    ok &= (fwrite ("data", 1, 4, file) == 4);
+    ok &= (fwrite (&data_size, 4, 1, file) == 1);
+    ok &= (fwrite (audio.samples.data (), sizeof (float), audio.samples.size (), file) == audio.samples.size ());
+    ok &= (fclose (file) == 0);
+    return ok;
+}
+
+/**
+Reads a WAV file (32 bit float).
+@param path     Path to the WAV file.
+@param audio    Audio data.
+@return         True on success, otherwise false.
+*/
+inline bool read_wav (const std::string& path, Audio& audio)
+{
+    FILE* file = fopen (path.c_str (), "rb");
+    if (!file) return false;
+
+    char id[4];
+    uint32_t size;
+    bool fmt_ok = false;
+    bool ok = (fread (id, 1, 4, file) == 4) && (!memcmp (id, "RIFF", 4)) &&
+              (fread (&size, 4, 1, file) == 1) &&
+              (fread (id, 1, 4, file) == 4) && (!memcmp (id, "WAVE", 4));
+
+    // Chunks
+    while (ok && (fread (id, 1, 4, file) == 4) && (fread (&size, 4, 1, file) == 1))
+    {
+        if (!memcmp (id, "fmt ", 4) && (size >= 16))
+        {
+            uint16_t format, channels, block_align, bits;
+            uint32_t rate, byte_rate;
+            ok = (fread (&format, 2, 1, file) == 1) && (fread (&channels, 2, 1, file) == 1) &&
+                 (fread (&rate, 4, 1, file) == 1) && (fread (&byte_rate, 4, 1, file) == 1) &&
+                 (fread (&block_align, 2, 1, file) == 1) && (fread (&bits, 2, 1, file) == 1) &&
+                 (format == 3) && (bits == 32) && (channels > 0) &&
+                 (fseek (file, size - 16 + (size & 1), SEEK_CUR) == 0);
+            audio.channels = channels;
+            audio.samplerate = rate;
+            fmt_ok = ok;
+        }
+
+        else if (!memcmp (id, "data", 4) && fmt_ok)
+        {
+            audio.samples.resize (size / sizeof (float));
+            ok = (fread (audio.samples.data (), sizeof (float), audio.samples.size (), file) == audio.samples.size ());
+            fclose (file);
+            return ok;
+        }
+
+        else ok = (fseek (file, size + (size & 1), SEEK_CUR) == 0);
+    }
+
+    fclose (file);
+    return false;
+}
+
+enum WavFormat
+{
+    WAV_PCM_16,
+    WAV_PCM_24,
+    WAV_PCM_32,
+    WAV_FLOAT_32,
+    WAV_FLOAT_64
+};
+
+inline size_t wav_sample_size (const WavFormat format)
+{
+    static const size_t sizes[] = {2, 3, 4, 4, 8};
+    return sizes[format];
+}
+
+/**
+Memory mapped WAV (and RF64) file reader for PCM (16, 24, 32 bit) and float
+(32, 64 bit) data with any number of channels. The file is mapped as a
+whole, but only the read parts are loaded. read() doesn't change the reader
+and may be called from multiple threads.
+*/
+class WavReader
+{
+public:
+    WavReader ();
+    WavReader (const WavReader& that) = delete;
+    ~WavReader ();
+
+    WavReader& operator= (const WavReader& that) = delete;
+
+    /**
+    Opens and maps a WAV file.
+    @param path Path to the WAV file.
+    @return     Empty string on success, otherwise an error message.
+    */
+    std::string open (const std::string& path);
+    void close ();
+
+    uint32_t channels () const;
+    double samplerate () const;
+    uint64_t frames () const;
+    WavFormat format () const;
+
+    /**
+    Reads and converts frames to float. Frames beyond the end are filled
+    with zeros.
+    @param frame    First frame.
+    @param n        Number of frames.
+    @param out      Output buffers, one for each channel.
+    */
+    void read (const uint64_t frame, const size_t n, float* const* out) const;
+
+    /**
+    Releases the memory of the already read frames before frame. Realtime
+    readers shouldn't call this.
+    @param frame    Frame.
+    */
+    void release (const uint64_t frame) const;
+
+    /**
+    Asks the system to load frames in the background (read-ahead).
+    @param frame    First frame.
+    @param n        Number of frames.
+    */
+    void prefetch (const uint64_t frame, const uint64_t n) const;
+
+protected:
+    uint8_t* map_;
+    size_t map_size_;
+    const uint8_t* data_;
+    uint32_t channels_;
+    double samplerate_;
+    uint64_t frames_;
+    WavFormat format_;
+};
+
+#define WAV_WRITER_HEADER_SIZE 80    // RIFF, JUNK (ds64), fmt, data chunk header
+
+/**
+Streaming WAV file writer. Converts float to PCM (16, 24, 32 bit) or float
+(32, 64 bit) data. Frames are either appended by write() or, after
+reserve(), written to any position by write_at(). Switches to RF64 on
+close() if the data exceed the 4 GB limit of WAV files.
+*/
+class WavWriter
+{
+public:
+    WavWriter ();
+    WavWriter (const WavWriter& that) = delete;
+    ~WavWriter ();
+
+    WavWriter& operator= (const WavWriter& that) = delete;
+
+    /**
+    Creates a WAV file and writes the header.
+    @param path         Path to the WAV file.
+    @param channels     Number of channels.
+    @param samplerate   Sample rate.
+    @param format       Sample format.
+    @return             True on success, otherwise false.
+    */
+    bool open (const std::string& path, const uint32_t channels, const double samplerate, const WavFormat format);
+
+    /**
+    Converts and appends frames.
+    @param in   Input buffers, one for each channel.
+    @param n    Number of frames.
+    @return     True on success, otherwise false.
+    */
+    bool write (const float* const* in, const size_t n);
+
+    /**
+    Sets the size of the data for write_at().
+    @param frames   Number of frames.
+    @return         True on success, otherwise false.
+    */
+    bool reserve (const uint64_t frames);
+
+    /**
+    Converts and writes frames to a position within the reserved data. May
+    be called from multiple threads for different positions.
+    @param frame    Position.
+    @param in       Input buffers, one for each channel.
+    @param n        Number of frames.
+    @return         True on success, otherwise false.
+    */
+    bool write_at (const uint64_t frame, const float* const* in, const size_t n) const;
+
+    /**
+    Completes the header and closes the file.
+    @return True on success, otherwise false.
+    */
+    bool close ();
+
+protected:
+    FILE* file_;
+    uint32_t channels_;
+    WavFormat format_;
+    uint64_t data_size_;
+    std::vector<uint8_t> buffer_;
+    bool ok_;
+
+    void convert_ (const float* const* in, const size_t n, std::vector<uint8_t>& buffer) const;
+};
+
+inline WavReader::WavReader () :
+    map_ (nullptr), map_size_ (0), data_ (nullptr), channels_ (0), samplerate_ (0.0), frames_ (0), format_ (WAV_FLOAT_32)
+{}
+
+inline WavReader::~WavReader () {close ();}
+
+inline std::string WavReader::open (const std::string& path)
+{
+    close ();
+    const int fd = ::open (path.c_str (), O_RDONLY);
+    if (fd < 0) return "Can't open " + path;
+    struct stat st;
+    if ((fstat (fd, &st) != 0) || (st.st_size < 12))
+    {
+        ::close (fd);
+        return path + " is not a WAV file";
+    }
+
+    map_size_ = st.st_size;
+    void* map = mmap (nullptr, map_size_, PROT_READ, MAP_SHARED, fd, 0);
+    ::close (fd);
+    if (map == MAP_FAILED)
+    {
+        map_size_ = 0;
+        return "Can't map " + path;
+    }
+    map_ = static_cast<uint8_t*> (map);
+    madvise (map_, map_size_, MADV_SEQUENTIAL);
+
+    auto u16 = [] (const uint8_t* p) {uint16_t v; memcpy (&v, p, 2); return v;};
+    auto u32 = [] (const uint8_t* p) {uint32_t v; memcpy (&v, p, 4); return v;};
+    auto u64 = [] (const uint8_t* p) {uint64_t v; memcpy (&v, p, 8); return v;};
+
+    const bool rf64 = !memcmp (map_, "RF64", 4);
+    if ((memcmp (map_, "RIFF", 4) && !rf64) || memcmp (map_ + 8, "WAVE", 4))
+    {
+        close ();
+        return path + " is not a WAV file";
+    }
+
+    // Chunks
+    uint64_t data_size = 0;
+    uint64_t ds64_data_size = 0;
+    bool fmt_ok = false;
+    uint16_t bits = 0;
+    uint16_t tag = 0;
+    size_t pos = 12;
+    while (pos + 8 <= map_size_)
+    {
+        const uint8_t* chunk = map_ + pos;
+        const uint64_t size = u32 (chunk + 4);
+        if (!memcmp (chunk, "ds64", 4) && (size >= 16) && (pos + 8 + 16 <= map_size_)) ds64_data_size = u64 (chunk + 16);
+
+        else if (!memcmp (chunk, "fmt ", 4) && (size >= 16) && (pos + 8 + 16 <= map_size_))
+        {
+            tag = u16 (chunk + 8);
+            channels_ = u16 (chunk + 10);
+            samplerate_ = u32 (chunk + 12);
+            bits = u16 (chunk + 22);
+            if ((tag == 0xFFFE) && (size >= 40) && (pos + 8 + 40 <= map_size_)) tag = u16 (chunk + 32);  // Extensible: Sub format
+            fmt_ok = true;
+        }
+
+        else if (!memcmp (chunk, "data", 4))
+        {
+            data_ = chunk + 8;
+            data_size = ((rf64 && (size == 0xFFFFFFFF)) ? ds64_data_size : size);
+            data_size = std::min<uint64_t> (data_size, map_size_ - (pos + 8));
+            break;
+        }
+
+        pos += 8 + size + (size & 1);
+    }
+
+    if ((!fmt_ok) || (!data_) || (channels_ == 0))
+    {
+        close ();
+        return path + " is not a supported WAV file";
+    }
+
+    if ((tag == 1) && (bits == 16)) format_ = WAV_PCM_16;
+    else if ((tag == 1) && (bits == 24)) format_ = WAV_PCM_24;
+    else if ((tag == 1) && (bits == 32)) format_ = WAV_PCM_32;
+    else if ((tag == 3) && (bits == 32)) format_ = WAV_FLOAT_32;
+    else if ((tag == 3) && (bits == 64)) format_ = WAV_FLOAT_64;
+    else
+    {
+        close ();
+        return path + ": Unsupported sample format (format " + std::to_string (tag) + ", " + std::to_string (bits) + " bit)";
+    }
+
+    frames_ = data_size / (channels_ * wav_sample_size (format_));
+    return "";
+}
+
+inline void WavReader::close ()
+{
+    if (map_) munmap (map_, map_size_);
+    map_ = nullptr;
+    map_size_ = 0;
+    data_ = nullptr;
+    frames_ = 0;
+}
+
+inline uint32_t WavReader::channels () const {return channels_;}
+
+inline double WavReader::samplerate () const {return samplerate_;}
+
+inline uint64_t WavReader::frames () const {return frames_;}
+
+inline WavFormat WavReader::format () const {return format_;}
+
+inline void WavReader::read (const uint64_t frame, const size_t n, float* const* out) const
+{
+    const size_t ssize = wav_sample_size (format_);
+    const size_t fsize = channels_ * ssize;
+    const size_t valid = (frame < frames_ ? std::min<uint64_t> (n, frames_ - frame) : 0);
+    for (uint32_t c = 0; c < channels_; ++c)
+    {
+        const uint8_t* p = data_ + frame * fsize + c * ssize;
+        float* o = out[c];
+        switch (format_)
+        {
+            case WAV_PCM_16:
+                for (size_t i = 0; i < valid; ++i, p += fsize) {int16_t v; memcpy (&v, p, 2); o[i] = v * (1.0f / 32768.0f);}
+                break;
+
+            case WAV_PCM_24:
+                for (size_t i = 0; i < valid; ++i, p += fsize)
+                {
+                    const int32_t v = static_cast<int32_t> ((uint32_t (p[0]) << 8) | (uint32_t (p[1]) << 16) | (uint32_t (p[2]) << 24)) >> 8;
+                    o[i] = v * (1.0f / 8388608.0f);
+                }
+                break;
+
+            case WAV_PCM_32:
+                for (size_t i = 0; i < valid; ++i, p += fsize) {int32_t v; memcpy (&v, p, 4); o[i] = v * (1.0 / 2147483648.0);}
+                break;
+
+            case WAV_FLOAT_32:
+                for (size_t i = 0; i < valid; ++i, p += fsize) memcpy (&o[i], p, 4);
+                break;
+
+            case WAV_FLOAT_64:
+                for (size_t i = 0; i < valid; ++i, p += fsize) {double v; memcpy (&v, p, 8); o[i] = v;}
+                break;
+        }
+        std::fill (o + valid, o + n, 0.0f);
+    }
+}
+
+inline void WavReader::release (const uint64_t frame) const
+{
+    const size_t page = sysconf (_SC_PAGESIZE);
+    const size_t end = (data_ - map_) + std::min (frame, frames_) * channels_ * wav_sample_size (format_);
+    const size_t aligned = end & ~(page - 1);
+    if (aligned) madvise (map_, aligned, MADV_DONTNEED);
+}
+
+inline void WavReader::prefetch (const uint64_t frame, const uint64_t n) const
+{
+    if (frame >= frames_) return;
+    const size_t page = sysconf (_SC_PAGESIZE);
+    const size_t fsize = channels_ * wav_sample_size (format_);
+    const size_t start = ((data_ - map_) + frame * fsize) & ~(page - 1);
+    const size_t end = (data_ - map_) + std::min (frame + n, frames_) * fsize;
+    madvise (map_ + start, end - start, MADV_WILLNEED);
+}
+
+inline WavWriter::WavWriter () :
+    file_ (nullptr), channels_ (0), format_ (WAV_FLOAT_32), data_size_ (0), buffer_ (), ok_ (false)
+{}
+
+inline WavWriter::~WavWriter () {if (file_) close ();}
+
+inline bool WavWriter::open (const std::string& path, const uint32_t channels, const double samplerate, const WavFormat format)
+{
+    if (file_) close ();
+    file_ = fopen (path.c_str (), "wb");
+    if (!file_) return false;
+
+    channels_ = channels;
+    format_ = format;
+    data_size_ = 0;
+
+    // RIFF header, JUNK chunk (replaced by ds64 for RF64), fmt chunk, data
+    // chunk header
+    const uint16_t tag = ((format == WAV_FLOAT_32) || (format == WAV_FLOAT_64) ? 3 : 1);
+    const uint16_t ch = channels;
+    const uint32_t rate = samplerate;
+    const uint16_t block_align = channels * wav_sample_size (format);
+    const uint32_t byte_rate = rate * block_align;
+    const uint16_t bits = 8 * wav_sample_size (format);
+    const uint32_t riff_size = 0;
+    const uint32_t junk_size = 28;
+    const uint32_t fmt_size = 16;
+    const uint8_t junk[28] = {};
+
+    ok_ = true;
+    ok_ &= (fwrite ("RIFF", 1, 4, file_) == 4);
+    ok_ &= (fwrite (&riff_size, 4, 1, file_) == 1);
+    ok_ &= (fwrite ("WAVEJUNK", 1, 8, file_) == 8);
+    ok_ &= (fwrite (&junk_size, 4, 1, file_) == 1);
+    ok_ &= (fwrite (junk, 1, 28, file_) == 28);
+    ok_ &= (fwrite ("fmt ", 1, 4, file_) == 4);
+    ok_ &= (fwrite (&fmt_size, 4, 1, file_) == 1);
+    ok_ &= (fwrite (&tag, 2, 1, file_) == 1);
+    ok_ &= (fwrite (&ch, 2, 1, file_) == 1);
+    ok_ &= (fwrite (&rate, 4, 1, file_) == 1);
+    ok_ &= (fwrite (&byte_rate, 4, 1, file_) == 1);
+    ok_ &= (fwrite (&block_align, 2, 1, file_) == 1);
+    ok_ &= (fwrite (&bits, 2, 1, file_) == 1);
+    ok_ &= (fwrite ("data", 1, 4, file_) == 4);
+    ok_ &= (fwrite (&riff_size, 4, 1, file_) == 1);
+    return ok_;
+}
+
+inline bool WavWriter::write (const float* const* in, const size_t n)
+{
+    if (!file_) return false;
+
+    convert_ (in, n, buffer_);
+    ok_ &= (fwrite (buffer_.data (), 1, buffer_.size (), file_) == buffer_.size ());
+    data_size_ += buffer_.size ();
+    return ok_;
+}
+
+inline bool WavWriter::reserve (const uint64_t frames)
+{
+    if (!file_) return false;
+
+    data_size_ = frames * channels_ * wav_sample_size (format_);
+    ok_ &= (fflush (file_) == 0) && (ftruncate (fileno (file_), WAV_WRITER_HEADER_SIZE + data_size_) == 0);
+    return ok_;
+}
+
+inline bool WavWriter::write_at (const uint64_t frame, const float* const* in, const size_t n) const
+{
+    if (!file_) return false;
+
+    std::vector<uint8_t> buffer;
+    convert_ (in, n, buffer);
+    const off_t offset = WAV_WRITER_HEADER_SIZE + frame * channels_ * wav_sample_size (format_);
+    size_t done = 0;
+    while (done < buffer.size ())
+    {
+        const ssize_t w = pwrite (fileno (file_), buffer.data () + done, buffer.size () - done, offset + done);
+        if (w <= 0) return false;
+        done += w;
+    }
+    return true;
+}
+
+inline void WavWriter::convert_ (const float* const* in, const size_t n, std::vector<uint8_t>& buffer) const
+{
+    const size_t ssize = wav_sample_size (format_);
+    const size_t fsize = channels_ * ssize;
+    buffer.resize (n * fsize);
+    for (uint32_t c = 0; c < channels_; ++c)
+    {
+        uint8_t* p = buffer.data () + c * ssize;
+        const float* x = in[c];
+        switch (format_)
+        {
+            case WAV_PCM_16:
+                for (size_t i = 0; i < n; ++i, p += fsize)
+                {
+                    const int16_t v = std::lrint (std::max (-32768.0f, std::min (x[i] * 32768.0f, 32767.0f)));
+                    memcpy (p, &v, 2);
+                }
+                break;
+
+            case WAV_PCM_24:
+                for (size_t i = 0; i < n; ++i, p += fsize)
+                {
+                    const int32_t v = std::lrint (std::max (-8388608.0f, std::min (x[i] * 8388608.0f, 8388607.0f)));
+                    p[0] = v & 0xFF;
+                    p[1] = (v >> 8) & 0xFF;
+                    p[2] = (v >> 16) & 0xFF;
+                }
+                break;
+
+            case WAV_PCM_32:
+                for (size_t i = 0; i < n; ++i, p += fsize)
+                {
+                    const int32_t v = std::llrint (std::max (-2147483648.0, std::min (x[i] * 2147483648.0, 2147483647.0)));
+                    memcpy (p, &v, 4);
+                }
+                break;
+
+            case WAV_FLOAT_32:
+                for (size_t i = 0; i < n; ++i, p += fsize) memcpy (p, &x[i], 4);
+                break;
+
+            case WAV_FLOAT_64:
+                for (size_t i = 0; i < n; ++i, p += fsize) {const double v = x[i]; memcpy (p, &v, 8);}
+                break;
+        }
+    }
+}
+
+inline bool WavWriter::close ()
+{
+    if (!file_) return false;
+
+    // Pad byte
+    ok_ &= (fseeko (file_, 0, SEEK_END) == 0);
+    if (data_size_ & 1) ok_ &= (fwrite ("", 1, 1, file_) == 1);
+
+    const uint64_t header_size = WAV_WRITER_HEADER_SIZE;
+    const uint64_t riff_size = header_size - 8 + data_size_ + (data_size_ & 1);
+    if (riff_size <= 0xFFFFFFFF)
+    {
+        const uint32_t riff_size32 = riff_size;
+        const uint32_t data_size32 = data_size_;
+        ok_ &= (fseeko (file_, 4, SEEK_SET) == 0) && (fwrite (&riff_size32, 4, 1, file_) == 1);
+        ok_ &= (fseeko (file_, header_size - 4, SEEK_SET) == 0) && (fwrite (&data_size32, 4, 1, file_) == 1);
+    }
+
+    else
+    {
+        // RF64: ds64 chunk instead of the JUNK chunk
+        const uint32_t max = 0xFFFFFFFF;
+        const uint64_t frames = data_size_ / (channels_ * wav_sample_size (format_));
+        const uint32_t table = 0;
+        ok_ &= (fseeko (file_, 0, SEEK_SET) == 0) && (fwrite ("RF64", 1, 4, file_) == 4) && (fwrite (&max, 4, 1, file_) == 1);
+        ok_ &= (fseeko (file_, 12, SEEK_SET) == 0) && (fwrite ("ds64", 1, 4, file_) == 4);
+        ok_ &= (fseeko (file_, 20, SEEK_SET) == 0);
+        ok_ &= (fwrite (&riff_size, 8, 1, file_) == 1) && (fwrite (&data_size_, 8, 1, file_) == 1);
+        ok_ &= (fwrite (&frames, 8, 1, file_) == 1) && (fwrite (&table, 4, 1, file_) == 1);
+        ok_ &= (fseeko (file_, header_size - 4, SEEK_SET) == 0) && (fwrite (&max, 4, 1, file_) == 1);
+    }
+
+    ok_ &= (fclose (file_) == 0);
+    file_ = nullptr;
+    return ok_;
+}
+
+#endif /* WAV_HPP_ */
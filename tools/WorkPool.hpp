@@ -0,0 +1,108 @@
+#ifndef WORKPOOL_HPP_
+#define WORKPOOL_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+Work-stealing thread pool for coarse grained tasks (e.g., whole files).
+Each worker has its own task queue. The tasks are dealt round robin to the
+queues in their given order. A worker takes the next task from the front of
+its own queue or, if empty, steals from the back of another queue. Tasks
+are independent and never wait for each other.
+*/
+class WorkPool
+{
+public:
+    /**
+    @param workers  Number of worker threads, 0 = number of hardware
+                    threads.
+    */
+    explicit WorkPool (const size_t workers = 0);
+
+    size_t workers () const;
+
+    /**
+    Runs the tasks 0 to n - 1 and blocks until all tasks are done. Put the
+    largest tasks first for a better balance.
+    @param n    Number of tasks.
+    @param func Task function, called with the task and the worker number.
+    */
+    void run (const size_t n, const std::function<void (size_t task, size_t worker)>& func);
+
+protected:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+
+    size_t workers_;
+
+    static bool take_ (std::vector<Queue>& queues, const size_t worker, size_t& task);
+};
+
+inline WorkPool::WorkPool (const size_t workers) :
+    workers_ (workers ? workers : std::max<size_t> (std::thread::hardware_concurrency (), 1))
+{}
+
+inline size_t WorkPool::workers () const {return workers_;}
+
+inline void WorkPool::run (const size_t n, const std::function<void (size_t task, size_t worker)>& func)
+{
+    const size_t nr_threads = std::min (workers_, n);
+    if (nr_threads == 0) return;
+
+    std::vector<Queue> queues (nr_threads);
+    for (size_t i = 0; i < n; ++i) queues[i % nr_threads].tasks.push_back (i);
+
+    std::vector<std::thread> threads;
+    for (size_t w = 0; w < nr_threads; ++w)
+    {
+        threads.emplace_back
+        (
+            [&queues, &func, w] ()
+            {
+                size_t task;
+                while (take_ (queues, w, task)) func (task, w);
+            }
+        );
+    }
+    for (std::thread& t : threads) t.join ();
+}
+
+inline bool WorkPool::take_ (std::vector<Queue>& queues, const size_t worker, size_t& task)
+{
+    // Own queue first
+    {
+        std::lock_guard<std::mutex> lock (queues[worker].mutex);
+        if (!queues[worker].tasks.empty ())
+        {
+            task = queues[worker].tasks.front ();
+            queues[worker].tasks.pop_front ();
+            return true;
+        }
+    }
+
+    // Steal
+    for (size_t i = 1; i < queues.size (); ++i)
+    {
+        Queue& victim = queues[(worker + i) % queues.size ()];
+        std::lock_guard<std::mutex> lock (victim.mutex);
+        if (!victim.tasks.empty ())
+        {
+            task = victim.tasks.back ();
+            victim.tasks.pop_back ();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+#endif /* WORKPOOL_HPP_ */